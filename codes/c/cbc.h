@@ -0,0 +1,655 @@
+// Cycle-Based Compressor - public interface
+//
+// Formats, status codes and the cbc_* API of libcbc. The bit writer push
+// functions are static inline here so they inline into callers across
+// translation units; their slow paths (bw_grow, bw64_grow) live in the
+// library.
+
+#ifndef CBC_H
+#define CBC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ------------------------------------------------------------
+// Constants
+#define MAX_SIZE_MESSAGE 1024
+#define ALPHABET_SIZE 256   // ASCII
+#define MAX_CODE_LENGTH 24  // longest cycle assigned when K = 255
+
+// Status codes
+#define CBC_OK             0
+#define CBC_ERR_OVERFLOW  -1   // output buffer too small
+#define CBC_ERR_SYMBOLS   -2   // more than 255 distinct symbols
+#define CBC_ERR_INPUT     -3   // invalid arguments
+#define CBC_ERR_CORRUPT   -4   // malformed header or invalid cycle
+#define CBC_ERR_TRUNCATED -5   // payload ended before original_len symbols
+#define CBC_ERR_NOMEM     -6   // allocation failed
+#define CBC_ERR_IO        -7   // stream sink reported an error
+
+// Second header byte of frames starting with 0 (else the bounded code
+// length N)
+#define CBC_EXT_RAW        0x00   // input stored as is
+
+// Stream block tags
+#define CBC_BLOCK_END      0x00
+#define CBC_BLOCK_TABLE    0x01   // block carries its own symbol table
+#define CBC_BLOCK_INHERIT  0x02   // block reuses the previous table
+#define CBC_BLOCK_RAW      0x03   // block stored as is (all 256 byte values)
+
+#define CBC_SESSION_DRIFT_DEFAULT 10   // percent
+
+// Session frame tags
+#define CBC_SESSION_SAME   0x00   // previous table unchanged
+#define CBC_SESSION_DELTA  0x01   // previous table with edited ranks
+#define CBC_SESSION_FULL   0x02   // new table
+
+// Versioned container: [magic] [version << 4 | flags] [varint len]
+// [varint header size] [header] [payload]
+#define CBC_CONTAINER_MAGIC    0xCB
+#define CBC_CONTAINER_VERSION  1
+#define CBC_CF_BOUNDED  0x01   // header [N][K][symbols], escapes 0^N + 8 bits
+#define CBC_CF_RAW      0x02   // empty header, payload is the message
+#define CBC_CF_DICT     0x04   // header [dictionary id]
+#define CBC_CF_INDEXED  0x08   // header [interval][checkpoints][tables]
+#define CBC_CF_KNOWN    0x0F   // flags this version reads
+#define CBC_BOUNDED_PAIRS 0x80 // in N: header [N][K][pair bitmap][tokens]
+
+// Modes of cbc_estimate_size: the encoder whose output size is computed
+#define CBC_EST_PLAIN           0   // cbc_compress_into
+#define CBC_EST_FRAMED          1   // cbc_compress_framed_into
+#define CBC_EST_BOUNDED         2   // cbc_compress_bounded_into, max_len
+#define CBC_EST_CONTAINER       3   // cbc_compress_container_into, max_len
+#define CBC_EST_DICT            4   // cbc_compress_dict_into, dict
+#define CBC_EST_CONTAINER_DICT  5   // cbc_compress_container_dict_into, dict
+
+// Stages timed in cbc_stats.stage_ticks
+#define CBC_STAGE_COUNT    0   // byte histogram
+#define CBC_STAGE_RANK     1   // code table
+#define CBC_STAGE_ENCODE   2   // bit payload
+#define CBC_STAGE_COPY     3   // headers and raw stores
+#define CBC_STAGE_DECODE   4
+#define CBC_STAGES         5
+
+// Longest code emitted: an escape, 0^N + 8 bits
+#define CBC_STATS_MAX_CODE (MAX_CODE_LENGTH + 8)
+
+// Flags of cbc_ctx_size, cbc_ctx_init_static and cbc_ctx_create
+#define CBC_CTX_PAIRS  0x01   // room for cbc_ctx_compress_container_pairs_into
+
+// cbc_trace_event.event
+#define CBC_TRACE_MESSAGE       1   // a message was compressed
+#define CBC_TRACE_DECODE_ERROR  2   // a decoder returned an error status
+
+// ------------------------------------------------------------
+// Structures
+
+// Entry in the code table: symbol, frequency, pair (m, j)
+typedef struct {
+    unsigned char symbol;
+    int freq;
+    int m;
+    int j;
+} CodeEntry;
+
+// Code word of a symbol: the cycle 0^m 1^j as right-aligned bits
+// (len == 0 for symbols not in the table)
+typedef struct {
+    uint32_t bits;
+    uint8_t len;
+} CodeWord;
+
+// One message of a batch
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+} cbc_msg;
+
+// Shared dictionary: a symbol ranking agreed on by encoder and decoder
+// and referenced in frames by its 1-byte id
+typedef struct {
+    uint8_t id;
+    int K;                            // symbols in the ranking (1..256)
+    uint8_t symbols[ALPHABET_SIZE];   // in cycle order
+    CodeWord words[ALPHABET_SIZE];    // code word per byte value
+} cbc_dict;
+
+// Bit writer for the compressed payload
+typedef struct {
+    unsigned char *data;
+    int capacity;   // capacity in bytes
+    int size;       // bytes actually used
+    int bit_pos;    // next bit position (0..7) inside the last byte
+    int failed;     // set when growing data failed; later bits are dropped
+} BitWriter;
+
+// Bit writer with a 64-bit accumulator: whole codes are shifted into acc
+// and flushed to data 32 bits at a time
+typedef struct {
+    unsigned char *data;
+    size_t capacity;  // capacity in bytes
+    size_t size;      // bytes flushed to data
+    uint64_t acc;     // pending bits, right-aligned
+    int acc_bits;     // number of pending bits (0..31 between calls)
+    int growable;     // 1 if data is ours and may be realloc'ed
+    int overflow;     // set when data ran out of space (full or realloc failed)
+} BitWriter64;
+
+// Memory source of a cbc_ctx or a stream; alloc returns blocks aligned
+// for any type, or NULL
+typedef struct {
+    void *(*alloc)(void *user, size_t size);
+    void (*free)(void *user, void *ptr);
+    void *user;
+} cbc_allocator;
+
+// Sink for streamed output; returns 0 on success
+typedef int (*cbc_write_fn)(void *user, const uint8_t *data, size_t len);
+
+// Streaming encoder: input is cut into blocks of block_size bytes, each
+// encoded as soon as it is complete and handed to the sink
+typedef struct {
+    size_t block_size;
+    uint8_t *block;                  // pending input of the current block
+    size_t block_len;
+    BitWriter64 bw;                  // payload writer, reused by every block
+    int K;                           // table inherited by the next block (0 = none)
+    uint8_t symbols[ALPHABET_SIZE];  // its symbols in cycle order
+    CodeWord words[ALPHABET_SIZE];   // and its code words
+    cbc_write_fn write;
+    void *user;
+    cbc_allocator alloc;             // source of block and bw's buffer
+} cbc_stream;
+
+// Streaming decoder: buffers at most one encoded block and emits every
+// block to the sink as soon as it has fully arrived
+typedef struct {
+    size_t block_size;
+    uint8_t *frame;                  // bytes of the block being received
+    size_t frame_len;
+    size_t frame_cap;
+    uint8_t *block;                  // decoded block
+    int K;                           // table of the previous block
+    uint8_t symbols[ALPHABET_SIZE];
+    int finished;                    // end-of-stream marker seen
+    cbc_write_fn write;
+    void *user;
+    cbc_allocator alloc;             // source of frame and block
+} cbc_stream_decoder;
+
+// One side of a session: the table of the last frame. The decoder only
+// uses K and symbols; the encoder also keeps their code words and, for
+// cbc_session_compress_cached, the running byte counts.
+typedef struct {
+    int K;                           // 0 until the first frame
+    uint8_t symbols[ALPHABET_SIZE];  // in cycle order
+    CodeWord words[ALPHABET_SIZE];
+    int hist[ALPHABET_SIZE];         // decayed counts of recent messages
+    uint64_t hist_total;
+    uint64_t base_bits;              // estimated cost of hist at the last re-rank
+    uint64_t base_symbols;
+    int drift;                       // re-rank threshold, percent over base
+    int stale;                       // re-rank on the next message
+} cbc_session;
+
+// Sizes of one compressed message, reported by compress_cycle_based
+typedef struct {
+    int K;                 // distinct symbols
+    size_t header_bytes;   // 1 + K
+    size_t payload_bytes;
+    size_t total_bytes;
+} cbc_compress_info;
+
+// Counters of a CBC_STATS build, per thread and summed by
+// cbc_stats_collect. Messages and the encoder stage ticks are counted
+// by the encoder that writes the frame, not by size probes (out == NULL),
+// overflows or cbc_estimate_size.
+typedef struct {
+    uint64_t messages;
+    uint64_t in_bytes;
+    uint64_t out_bytes;
+    uint64_t header_bytes;                           // of out_bytes
+    uint64_t k_hist[ALPHABET_SIZE + 1];              // messages by K
+    uint64_t code_lengths[CBC_STATS_MAX_CODE + 1];   // codes emitted by length
+    uint64_t decoded_bytes;
+    uint64_t decode_errors[8];                       // by -status
+    uint64_t stage_ticks[CBC_STAGES];                // TSC / counter ticks, else ns
+} cbc_stats;
+
+// Passed to the trace hook, on the thread that did the work
+typedef struct {
+    int event;             // CBC_TRACE_*
+    int status;            // decoder status for CBC_TRACE_DECODE_ERROR
+    int K;                 // table size of a compressed message
+    size_t in_bytes;
+    size_t out_bytes;      // compressed size, or bytes decoded before the error
+    size_t header_bytes;
+} cbc_trace_event;
+
+typedef void (*cbc_trace_fn)(void *user, const cbc_trace_event *ev);
+
+// Compression context: the encoders' tables and buffers, allocated once
+// and reused by every message
+typedef struct cbc_ctx cbc_ctx;
+
+// Parsed container prefix; header and payload point into the frame
+typedef struct {
+    int version;
+    int flags;
+    size_t original_len;
+    const uint8_t *header;
+    size_t header_size;
+    const uint8_t *payload;
+    size_t payload_size;
+} cbc_container;
+
+// ------------------------------------------------------------
+// Cycle order
+//
+// Rank r is the r-th cycle in order of length L = m + j, m counting down
+// within a length: 01, 001, 011, 0001, 0011, 0111, ... CBC_CYCLE_LIST(X)
+// expands X(m, j) for every cycle up to MAX_CODE_LENGTH bits in rank
+// order; the library builds its const rank tables from it at compile
+// time.
+
+#define CBC_CYCLES_L2(X) X(1, 1)
+#define CBC_CYCLES_L3(X) X(2, 1) X(1, 2)
+#define CBC_CYCLES_L4(X) X(3, 1) X(2, 2) X(1, 3)
+#define CBC_CYCLES_L5(X) X(4, 1) X(3, 2) X(2, 3) X(1, 4)
+#define CBC_CYCLES_L6(X) X(5, 1) X(4, 2) X(3, 3) X(2, 4) X(1, 5)
+#define CBC_CYCLES_L7(X) X(6, 1) X(5, 2) X(4, 3) X(3, 4) X(2, 5) X(1, 6)
+#define CBC_CYCLES_L8(X) X(7, 1) X(6, 2) X(5, 3) X(4, 4) X(3, 5) X(2, 6) \
+    X(1, 7)
+#define CBC_CYCLES_L9(X) X(8, 1) X(7, 2) X(6, 3) X(5, 4) X(4, 5) X(3, 6) \
+    X(2, 7) X(1, 8)
+#define CBC_CYCLES_L10(X) X(9, 1) X(8, 2) X(7, 3) X(6, 4) X(5, 5) X(4, 6) \
+    X(3, 7) X(2, 8) X(1, 9)
+#define CBC_CYCLES_L11(X) X(10, 1) X(9, 2) X(8, 3) X(7, 4) X(6, 5) X(5, 6) \
+    X(4, 7) X(3, 8) X(2, 9) X(1, 10)
+#define CBC_CYCLES_L12(X) X(11, 1) X(10, 2) X(9, 3) X(8, 4) X(7, 5) X(6, 6) \
+    X(5, 7) X(4, 8) X(3, 9) X(2, 10) X(1, 11)
+#define CBC_CYCLES_L13(X) X(12, 1) X(11, 2) X(10, 3) X(9, 4) X(8, 5) \
+    X(7, 6) X(6, 7) X(5, 8) X(4, 9) X(3, 10) X(2, 11) X(1, 12)
+#define CBC_CYCLES_L14(X) X(13, 1) X(12, 2) X(11, 3) X(10, 4) X(9, 5) \
+    X(8, 6) X(7, 7) X(6, 8) X(5, 9) X(4, 10) X(3, 11) X(2, 12) X(1, 13)
+#define CBC_CYCLES_L15(X) X(14, 1) X(13, 2) X(12, 3) X(11, 4) X(10, 5) \
+    X(9, 6) X(8, 7) X(7, 8) X(6, 9) X(5, 10) X(4, 11) X(3, 12) X(2, 13) \
+    X(1, 14)
+#define CBC_CYCLES_L16(X) X(15, 1) X(14, 2) X(13, 3) X(12, 4) X(11, 5) \
+    X(10, 6) X(9, 7) X(8, 8) X(7, 9) X(6, 10) X(5, 11) X(4, 12) X(3, 13) \
+    X(2, 14) X(1, 15)
+#define CBC_CYCLES_L17(X) X(16, 1) X(15, 2) X(14, 3) X(13, 4) X(12, 5) \
+    X(11, 6) X(10, 7) X(9, 8) X(8, 9) X(7, 10) X(6, 11) X(5, 12) X(4, 13) \
+    X(3, 14) X(2, 15) X(1, 16)
+#define CBC_CYCLES_L18(X) X(17, 1) X(16, 2) X(15, 3) X(14, 4) X(13, 5) \
+    X(12, 6) X(11, 7) X(10, 8) X(9, 9) X(8, 10) X(7, 11) X(6, 12) X(5, 13) \
+    X(4, 14) X(3, 15) X(2, 16) X(1, 17)
+#define CBC_CYCLES_L19(X) X(18, 1) X(17, 2) X(16, 3) X(15, 4) X(14, 5) \
+    X(13, 6) X(12, 7) X(11, 8) X(10, 9) X(9, 10) X(8, 11) X(7, 12) X(6, 13) \
+    X(5, 14) X(4, 15) X(3, 16) X(2, 17) X(1, 18)
+#define CBC_CYCLES_L20(X) X(19, 1) X(18, 2) X(17, 3) X(16, 4) X(15, 5) \
+    X(14, 6) X(13, 7) X(12, 8) X(11, 9) X(10, 10) X(9, 11) X(8, 12) \
+    X(7, 13) X(6, 14) X(5, 15) X(4, 16) X(3, 17) X(2, 18) X(1, 19)
+#define CBC_CYCLES_L21(X) X(20, 1) X(19, 2) X(18, 3) X(17, 4) X(16, 5) \
+    X(15, 6) X(14, 7) X(13, 8) X(12, 9) X(11, 10) X(10, 11) X(9, 12) \
+    X(8, 13) X(7, 14) X(6, 15) X(5, 16) X(4, 17) X(3, 18) X(2, 19) X(1, 20)
+#define CBC_CYCLES_L22(X) X(21, 1) X(20, 2) X(19, 3) X(18, 4) X(17, 5) \
+    X(16, 6) X(15, 7) X(14, 8) X(13, 9) X(12, 10) X(11, 11) X(10, 12) \
+    X(9, 13) X(8, 14) X(7, 15) X(6, 16) X(5, 17) X(4, 18) X(3, 19) X(2, 20) \
+    X(1, 21)
+#define CBC_CYCLES_L23(X) X(22, 1) X(21, 2) X(20, 3) X(19, 4) X(18, 5) \
+    X(17, 6) X(16, 7) X(15, 8) X(14, 9) X(13, 10) X(12, 11) X(11, 12) \
+    X(10, 13) X(9, 14) X(8, 15) X(7, 16) X(6, 17) X(5, 18) X(4, 19) \
+    X(3, 20) X(2, 21) X(1, 22)
+#define CBC_CYCLES_L24(X) X(23, 1) X(22, 2) X(21, 3) X(20, 4) X(19, 5) \
+    X(18, 6) X(17, 7) X(16, 8) X(15, 9) X(14, 10) X(13, 11) X(12, 12) \
+    X(11, 13) X(10, 14) X(9, 15) X(8, 16) X(7, 17) X(6, 18) X(5, 19) \
+    X(4, 20) X(3, 21) X(2, 22) X(1, 23)
+
+#define CBC_CYCLE_LIST(X) \
+    CBC_CYCLES_L2(X) CBC_CYCLES_L3(X) CBC_CYCLES_L4(X) CBC_CYCLES_L5(X) \
+    CBC_CYCLES_L6(X) CBC_CYCLES_L7(X) CBC_CYCLES_L8(X) CBC_CYCLES_L9(X) \
+    CBC_CYCLES_L10(X) CBC_CYCLES_L11(X) CBC_CYCLES_L12(X) CBC_CYCLES_L13(X) \
+    CBC_CYCLES_L14(X) CBC_CYCLES_L15(X) CBC_CYCLES_L16(X) CBC_CYCLES_L17(X) \
+    CBC_CYCLES_L18(X) CBC_CYCLES_L19(X) CBC_CYCLES_L20(X) CBC_CYCLES_L21(X) \
+    CBC_CYCLES_L22(X) CBC_CYCLES_L23(X) CBC_CYCLES_L24(X)
+
+#define CBC_CYCLE_COUNT (MAX_CODE_LENGTH * (MAX_CODE_LENGTH - 1) / 2)
+
+// Closed-form rank of the cycle 0^m 1^j
+#define CBC_CYCLE_RANK(m, j) (((m) + (j) - 2) * ((m) + (j) - 1) / 2 + (j) - 1)
+
+// One cycle: its pair, length and bits 0^m 1^j right-aligned
+typedef struct {
+    uint32_t bits;
+    uint8_t m;
+    uint8_t j;
+    uint8_t len;
+} cbc_cycle;
+
+// rank -> cycle
+extern const cbc_cycle cbc_cycles[CBC_CYCLE_COUNT];
+// [m][j] -> rank + 1, 0 for pairs longer than MAX_CODE_LENGTH
+extern const uint16_t cbc_cycle_ranks[MAX_CODE_LENGTH][MAX_CODE_LENGTH];
+
+// ------------------------------------------------------------
+// Bit writers
+
+void bw_init(BitWriter *bw, int capacity);
+void bw_free(BitWriter *bw);
+int  bw_grow(BitWriter *bw);
+
+void bw64_init(BitWriter64 *bw, size_t capacity);
+void bw64_init_buffer(BitWriter64 *bw, unsigned char *buf, size_t capacity);
+void bw64_free(BitWriter64 *bw);
+int  bw64_grow(BitWriter64 *bw, size_t n);
+void bw64_finish(BitWriter64 *bw);
+
+// Ensure room for one more byte
+static inline int bw_reserve(BitWriter *bw) {
+    return bw->size < bw->capacity || bw_grow(bw);
+}
+
+static inline void bw_put_bit(BitWriter *bw, int bit) {
+    if (bw->size == 0 && bw->bit_pos == 0) {
+        // start a new byte
+        if (!bw_reserve(bw)) return;
+        bw->size = 1;
+        bw->data[0] = 0;
+    }
+
+    if (bw->bit_pos == 8) {
+        // need a new byte
+        if (!bw_reserve(bw)) return;
+        bw->data[bw->size] = 0;
+        bw->size++;
+        bw->bit_pos = 0;
+    }
+
+    if (bit) {
+        bw->data[bw->size - 1] |= (1 << (7 - bw->bit_pos));
+    }
+    bw->bit_pos++;
+}
+
+// Write the cycle 0^m 1^j
+static inline void bw_put_cycle(BitWriter *bw, int m, int j) {
+    for (int i = 0; i < m; i++) {
+        bw_put_bit(bw, 0);
+    }
+    for (int i = 0; i < j; i++) {
+        bw_put_bit(bw, 1);
+    }
+}
+
+// Ensure room for n more bytes
+static inline int bw64_reserve(BitWriter64 *bw, size_t n) {
+    return bw->size + n <= bw->capacity || bw64_grow(bw, n);
+}
+
+// Append the len (1..32) low bits of bits, most significant first
+static inline void bw64_put_bits(BitWriter64 *bw, uint32_t bits, int len) {
+    bw->acc = (bw->acc << len) | bits;
+    bw->acc_bits += len;
+    if (bw->acc_bits >= 32) {
+        bw->acc_bits -= 32;
+        uint32_t word = (uint32_t)(bw->acc >> bw->acc_bits);
+        if (!bw64_reserve(bw, 4)) return;
+        unsigned char *p = bw->data + bw->size;
+        p[0] = (unsigned char)(word >> 24);
+        p[1] = (unsigned char)(word >> 16);
+        p[2] = (unsigned char)(word >> 8);
+        p[3] = (unsigned char)word;
+        bw->size += 4;
+    }
+}
+
+// Write the cycle 0^m 1^j with a single shift-or
+static inline void bw64_put_cycle(BitWriter64 *bw, int m, int j) {
+    bw64_put_bits(bw, (uint32_t)((1ULL << j) - 1), m + j);
+}
+
+// Code word of a byte value
+static inline CodeWord cbc_code_word(const CodeWord *words, uint8_t symbol) {
+    return words[symbol];
+}
+
+// Write the code word of symbol: one load and one accumulator push
+static inline void bw64_put_symbol(BitWriter64 *bw, const CodeWord *words,
+                                   uint8_t symbol) {
+    const CodeWord w = cbc_code_word(words, symbol);
+    bw64_put_bits(bw, w.bits, w.len);
+}
+
+// ------------------------------------------------------------
+// Code tables
+
+void cbc_count_frequency(const uint8_t *in, size_t len, int *freq_table);
+void count_character_frequency(const char *text, int *freq_table);
+int  compare_codeentry(const void *a, const void *b);
+void rank_codes(CodeEntry *codes, int K);
+void generate_cycles_for_codes(CodeEntry *codes, int K);
+int  build_code_table(const int *freq_table, CodeEntry *codes);
+void build_code_words(const CodeEntry *codes, int K, CodeWord *words);
+
+// ------------------------------------------------------------
+// Compression
+
+size_t cbc_max_compressed_size(size_t len, int K);
+int cbc_compress_into(const uint8_t *in, size_t len,
+                      uint8_t *out, size_t out_cap, size_t *written);
+int cbc_compress(const uint8_t *in, size_t len,
+                 uint8_t **out_data, size_t *out_size);
+
+// Codes of at most max_len (2..MAX_CODE_LENGTH) bits, escapes for the
+// other bytes, raw store if smaller; output is at most len + 2 bytes
+size_t cbc_max_bounded_size(size_t len);
+int cbc_compress_bounded_into(const uint8_t *in, size_t len, int max_len,
+                              uint8_t *out, size_t out_cap, size_t *written);
+
+size_t cbc_max_framed_size(size_t len, int K);
+int cbc_compress_framed_into(const uint8_t *in, size_t len,
+                             uint8_t *out, size_t out_cap, size_t *written);
+
+size_t cbc_max_batch_size(const cbc_msg *msgs, size_t n);
+int cbc_compress_batch(const cbc_msg *msgs, size_t n,
+                       uint8_t *arena, size_t arena_cap, size_t *offsets);
+
+// Versioned container around the plain, bounded (max_len bits, 0 for
+// MAX_CODE_LENGTH), raw or dictionary encoding
+size_t cbc_max_container_size(size_t len);
+int cbc_compress_container_into(const uint8_t *in, size_t len, int max_len,
+                                uint8_t *out, size_t out_cap, size_t *written);
+size_t cbc_max_container_dict_size(const cbc_dict *dict, size_t len);
+int cbc_compress_container_dict_into(const cbc_dict *dict,
+                                     const uint8_t *in, size_t len,
+                                     uint8_t *out, size_t out_cap,
+                                     size_t *written);
+
+// Container whose table may also hold frequent byte pairs, one cycle per
+// pair; falls back to cbc_compress_container_into's frame when that is
+// not larger. Output fits in cbc_max_container_size(len).
+int cbc_compress_container_pairs_into(const uint8_t *in, size_t len, int max_len,
+                                      uint8_t *out, size_t out_cap,
+                                      size_t *written);
+
+// Container with a checkpoint (payload bit position, table) every
+// interval symbols for random access; one ranking per block_size symbols,
+// a multiple of interval
+size_t cbc_max_indexed_size(size_t len, size_t interval, size_t block_size);
+int cbc_compress_indexed_into(const uint8_t *in, size_t len,
+                              size_t interval, size_t block_size,
+                              uint8_t *out, size_t out_cap, size_t *written);
+
+int cbc_dict_train(cbc_dict *dict, uint8_t id,
+                   const uint8_t *const *samples, const size_t *lens, size_t n);
+int cbc_dict_load(cbc_dict *dict, uint8_t id, const uint8_t *symbols, int K);
+int cbc_compress_dict_into(const cbc_dict *dict, const uint8_t *in, size_t len,
+                           uint8_t *out, size_t out_cap, size_t *written);
+
+// Exact size the mode's encoder would write, from the histogram and
+// ranking alone: no bits emitted, nothing allocated. dict is only read
+// by the dictionary modes, max_len by the bounded and container ones.
+int cbc_estimate_size(const cbc_dict *dict, const uint8_t *in, size_t len,
+                      int mode, int max_len, size_t *size);
+
+// A block holding all 256 byte values has no table of K <= 255, so it
+// is stored raw; the stream goes on with the next block
+int  cbc_stream_init(cbc_stream *st, size_t block_size,
+                     cbc_write_fn write, void *user);
+// Buffers from alloc (NULL for malloc / free) instead
+int  cbc_stream_init_alloc(cbc_stream *st, size_t block_size,
+                           cbc_write_fn write, void *user,
+                           const cbc_allocator *alloc);
+int  cbc_stream_update(cbc_stream *st, const uint8_t *data, size_t len);
+int  cbc_stream_finish(cbc_stream *st);
+void cbc_stream_free(cbc_stream *st);
+
+void   cbc_session_init(cbc_session *s);
+size_t cbc_max_session_size(size_t len);
+int    cbc_session_compress(cbc_session *s, const uint8_t *in, size_t len,
+                            uint8_t *out, size_t out_cap, size_t *written);
+// Single pass with the cached table while it stays within s->drift
+int    cbc_session_compress_cached(cbc_session *s, const uint8_t *in, size_t len,
+                                   uint8_t *out, size_t out_cap, size_t *written);
+
+// ------------------------------------------------------------
+// Compression context
+//
+// The cbc_ctx_* encoders write the same frames as the functions above
+// but take their tables from ctx: a call uses a few hundred bytes of
+// stack (about 1.5 KB when a cached session re-ranks) and allocates
+// nothing while the message fits in max_msg bytes (only cbc_ctx_compress
+// and the pairs encoder need room per byte). A context is used by one
+// thread at a time.
+//
+// Encoders without a cbc_ctx_* version: the dictionary ones, which take
+// their code words from the dictionary (a size probe counts a 1 KB
+// histogram on the stack), cbc_compress and
+// compress_cycle_based, which malloc their result, the stream encoder,
+// which ranks each block on the stack, and the _mt batch engine below.
+
+// Bytes cbc_ctx_init_static needs, 0 if max_msg is too large
+size_t   cbc_ctx_size(size_t max_msg, int flags);
+// Context in the caller's memory, never allocating or freeing; NULL if
+// size is too small. Longer messages fail with CBC_ERR_NOMEM.
+cbc_ctx *cbc_ctx_init_static(void *mem, size_t size, size_t max_msg, int flags);
+// Context from alloc (NULL for malloc / free), which also replaces the
+// buffers when a message outgrows them
+cbc_ctx *cbc_ctx_create(const cbc_allocator *alloc, size_t max_msg, int flags);
+// Returns created contexts to their allocator; no-op for static ones
+void     cbc_ctx_free(cbc_ctx *ctx);
+
+int cbc_ctx_compress_into(cbc_ctx *ctx, const uint8_t *in, size_t len,
+                          uint8_t *out, size_t out_cap, size_t *written);
+int cbc_ctx_compress_framed_into(cbc_ctx *ctx, const uint8_t *in, size_t len,
+                                 uint8_t *out, size_t out_cap, size_t *written);
+int cbc_ctx_compress_bounded_into(cbc_ctx *ctx, const uint8_t *in, size_t len,
+                                  int max_len, uint8_t *out, size_t out_cap,
+                                  size_t *written);
+int cbc_ctx_compress_container_into(cbc_ctx *ctx, const uint8_t *in, size_t len,
+                                    int max_len, uint8_t *out, size_t out_cap,
+                                    size_t *written);
+int cbc_ctx_compress_container_pairs_into(cbc_ctx *ctx, const uint8_t *in,
+                                          size_t len, int max_len,
+                                          uint8_t *out, size_t out_cap,
+                                          size_t *written);
+int cbc_ctx_compress_indexed_into(cbc_ctx *ctx, const uint8_t *in, size_t len,
+                                  size_t interval, size_t block_size,
+                                  uint8_t *out, size_t out_cap, size_t *written);
+int cbc_ctx_compress_batch(cbc_ctx *ctx, const cbc_msg *msgs, size_t n,
+                           uint8_t *arena, size_t arena_cap, size_t *offsets);
+int cbc_ctx_session_compress(cbc_ctx *ctx, cbc_session *s,
+                             const uint8_t *in, size_t len,
+                             uint8_t *out, size_t out_cap, size_t *written);
+int cbc_ctx_session_compress_cached(cbc_ctx *ctx, cbc_session *s,
+                                    const uint8_t *in, size_t len,
+                                    uint8_t *out, size_t out_cap,
+                                    size_t *written);
+// Container frame of cbc_compress_container_into in ctx's output buffer;
+// *out stays valid until the next call on ctx
+int cbc_ctx_compress(cbc_ctx *ctx, const uint8_t *in, size_t len, int max_len,
+                     const uint8_t **out, size_t *out_size);
+
+// ------------------------------------------------------------
+// Decompression
+
+int cbc_decompress(const uint8_t *data, size_t size, size_t original_len,
+                   uint8_t *out, size_t *out_len);
+int cbc_framed_length(const uint8_t *data, size_t size, size_t *original_len);
+int cbc_decompress_framed(const uint8_t *data, size_t size,
+                          uint8_t *out, size_t out_cap, size_t *out_len);
+int cbc_container_parse(const uint8_t *data, size_t size, cbc_container *c);
+// dict may be NULL unless the frame has CBC_CF_DICT
+int cbc_decompress_container(const cbc_dict *dict,
+                             const uint8_t *data, size_t size,
+                             uint8_t *out, size_t out_cap, size_t *out_len);
+// Bytes [offset, offset + count) of a container frame; O(interval +
+// count) on indexed frames
+int cbc_decompress_range(const cbc_dict *dict, const uint8_t *data, size_t size,
+                         size_t offset, size_t count,
+                         uint8_t *out, size_t *out_len);
+int cbc_decompress_batch(const uint8_t *arena, const size_t *offsets, size_t n,
+                         uint8_t *out, size_t out_cap, size_t *out_offsets);
+int cbc_frame_dict_id(const uint8_t *data, size_t size);
+int cbc_decompress_dict(const cbc_dict *dict, const uint8_t *data, size_t size,
+                        size_t original_len, uint8_t *out, size_t *out_len);
+
+int  cbc_stream_decoder_init(cbc_stream_decoder *sd, size_t block_size,
+                             cbc_write_fn write, void *user);
+int  cbc_stream_decoder_init_alloc(cbc_stream_decoder *sd, size_t block_size,
+                                   cbc_write_fn write, void *user,
+                                   const cbc_allocator *alloc);
+int  cbc_stream_decoder_update(cbc_stream_decoder *sd, const uint8_t *data, size_t len);
+int  cbc_stream_decoder_finish(cbc_stream_decoder *sd);
+void cbc_stream_decoder_free(cbc_stream_decoder *sd);
+
+int cbc_session_decompress(cbc_session *s, const uint8_t *data, size_t size,
+                           size_t original_len, uint8_t *out, size_t *out_len);
+
+// Both start worker threads, each ranking on its own stack, and the
+// decoder takes n offsets of scratch from malloc
+#ifndef CBC_NO_THREADS
+int cbc_compress_batch_mt(const cbc_msg *msgs, size_t n,
+                          uint8_t *arena, size_t arena_cap, size_t *offsets,
+                          int threads);
+int cbc_decompress_batch_mt(const uint8_t *arena, const size_t *offsets, size_t n,
+                            uint8_t *out, size_t out_cap, size_t *out_offsets,
+                            int threads);
+#endif
+
+// ------------------------------------------------------------
+// Instrumentation (CBC_STATS builds; otherwise no-ops)
+
+// Sum of every thread's counters; take two snapshots and subtract them to
+// measure an interval
+void cbc_stats_collect(cbc_stats *out);
+// Called after every compressed message and decode error; set it before
+// other threads use the library, NULL to remove it
+void cbc_stats_set_trace(cbc_trace_fn fn, void *user);
+
+// ------------------------------------------------------------
+// String API
+
+int compress_cycle_based(const char *text,
+                         unsigned char **out_data,
+                         int *out_size,
+                         cbc_compress_info *info);
+int decompress_cycle_based(const unsigned char *comp_data,
+                           int comp_size,
+                           int original_len,
+                           char *out_text);
+int decompress_cycle_based_table(const unsigned char *comp_data,
+                                 int comp_size,
+                                 int original_len,
+                                 char *out_text);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // CBC_H
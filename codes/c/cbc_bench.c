@@ -0,0 +1,599 @@
+// Benchmark suite for the 32..512 byte message regime.
+//
+// Build: make bench
+// Usage: ./cbc_bench [--reps N] [--quick]
+//
+// Every corpus is generated from the same LCG as codes/python/bench.py
+// (x = x * 1103515245 + 12345 mod 2^31), so both benches time identical
+// messages. Each (corpus, size) cell compresses and decompresses
+// BENCH_MESSAGES slices of S bytes, once for warmup and then R times;
+// the table reports the median, min and standard deviation over the R
+// runs as MB/s of original bytes and ns per message.
+
+#define _POSIX_C_SOURCE 199309L
+
+// Built as one translation unit with the library so the component
+// section can time its internal kernels
+#include "cycle_based_compressor.c"
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_CORPUS_BYTES (64 * 1024)
+#define BENCH_MESSAGES 4096          // messages per (corpus, size) cell
+#define BENCH_DEFAULT_REPS 7
+#define BENCH_QUICK_REPS 3
+#define BENCH_COMPONENT_BYTES (32 * 1024 * 1024)  // component workload
+#define BENCH_BATCH_MESSAGES 1024
+#define BENCH_MT_MESSAGES 65536
+#define BENCH_HIST_BYTES (64 * 1024)
+
+static const char *bench_prose = "In wireless sensor networks, the energy cost of transmitting a single byte is often far higher than the cost of executing hundreds or even thousands of local instructions. As a consequence, lightweight compression techniques are essential for extending device lifetime and reducing network congestion. A deterministic low-overhead compressor allows embedded devices to reduce traffic without adding excessive computational complexity to firmware. Modern IoT systems often operate under strict limitations: restricted memory, low clock frequencies, intermittent connectivity, and energy budgets that must last months or years. Under these conditions, traditional compression algorithms may introduce too much overhead or require dynamic structures that are unsuitable for constrained nodes. A predictable, prefix-free, cycle-based scheme provides a promising alternative by minimizing header cost and avoiding the reconstruction of probability models during decoding.";
+
+static double wall_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// ------------------------------------------------------------
+// Corpora
+// ------------------------------------------------------------
+
+static uint32_t bench_lcg(uint32_t *x) {
+    *x = (*x * 1103515245u + 12345u) & 0x7fffffffu;
+    return *x;
+}
+
+// Appends s to buf without running past cap; returns the new length
+static size_t bench_append(uint8_t *buf, size_t len, size_t cap, const char *s) {
+    while (*s && len < cap) buf[len++] = (uint8_t)*s++;
+    return len;
+}
+
+// The paper text repeated end to end
+static void corpus_prose(uint8_t *buf, size_t cap) {
+    size_t n = strlen(bench_prose);
+    for (size_t i = 0; i < cap; i++) buf[i] = (uint8_t)bench_prose[i % n];
+}
+
+// Sensor telemetry records in JSON
+static void corpus_json(uint8_t *buf, size_t cap) {
+    uint32_t x = 1;
+    size_t len = 0;
+    for (unsigned id = 0; len < cap; id++) {
+        // One draw per field, in order, so bench.py sees the same stream
+        unsigned temp = 15u + bench_lcg(&x) % 20u;
+        unsigned frac = bench_lcg(&x) % 10u;
+        unsigned hum = 30u + bench_lcg(&x) % 60u;
+        int ok = bench_lcg(&x) % 8u != 0;
+        char rec[128];
+        snprintf(rec, sizeof(rec),
+                 "{\"id\":%u,\"ts\":%u,\"temp\":%u.%u,\"hum\":%u,\"ok\":%s}\n",
+                 id, 1700000000u + id * 30u, temp, frac, hum,
+                 ok ? "true" : "false");
+        len = bench_append(buf, len, cap, rec);
+    }
+}
+
+// Numeric CSV rows: sample index, signed reading, counter
+static void corpus_csv(uint8_t *buf, size_t cap) {
+    uint32_t x = 2;
+    size_t len = 0;
+    for (unsigned row = 0; len < cap; row++) {
+        int neg = bench_lcg(&x) % 2u != 0;
+        unsigned whole = bench_lcg(&x) % 100u;
+        unsigned cents = bench_lcg(&x) % 100u;
+        unsigned counter = bench_lcg(&x) % 65536u;
+        char rec[64];
+        snprintf(rec, sizeof(rec), "%u,%s%u.%02u,%u\n", row, neg ? "-" : "",
+                 whole, cents, counter);
+        len = bench_append(buf, len, cap, rec);
+    }
+}
+
+// Uniform bytes 1..255, so K stays within the 255-symbol header limit
+static void corpus_random(uint8_t *buf, size_t cap) {
+    uint32_t x = 3;
+    for (size_t i = 0; i < cap; i++) {
+        buf[i] = (uint8_t)(1 + (bench_lcg(&x) >> 16) % 255u);
+    }
+}
+
+typedef struct {
+    const char *name;
+    void (*fill)(uint8_t *buf, size_t cap);
+} bench_corpus;
+
+static const bench_corpus bench_corpora[] = {
+    {"prose", corpus_prose},
+    {"json", corpus_json},
+    {"csv", corpus_csv},
+    {"random", corpus_random},
+};
+
+// ------------------------------------------------------------
+// Timing
+// ------------------------------------------------------------
+
+typedef struct {
+    double median;
+    double min;
+    double stddev;
+} bench_stats;
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static bench_stats summarize(double *samples, int n) {
+    bench_stats st;
+    qsort(samples, n, sizeof(double), compare_double);
+    st.median = n % 2 ? samples[n / 2]
+                      : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    st.min = samples[0];
+    double mean = 0, var = 0;
+    for (int i = 0; i < n; i++) mean += samples[i];
+    mean /= n;
+    for (int i = 0; i < n; i++) var += (samples[i] - mean) * (samples[i] - mean);
+    st.stddev = n > 1 ? sqrt(var / (n - 1)) : 0;
+    return st;
+}
+
+// Messages of one (corpus, size) cell and their compressed slots
+typedef struct {
+    const uint8_t *msgs[BENCH_MESSAGES];
+    int S;
+    size_t slot;                  // bytes reserved per compressed message
+    uint8_t *comp;
+    size_t comp_len[BENCH_MESSAGES];
+    size_t est_len[BENCH_MESSAGES];
+    uint8_t *out;
+} bench_cell;
+
+typedef void (*bench_op)(bench_cell *cell);
+
+static void op_compress(bench_cell *c) {
+    for (int i = 0; i < BENCH_MESSAGES; i++) {
+        cbc_compress_into(c->msgs[i], c->S, c->comp + (size_t)i * c->slot,
+                          c->slot, &c->comp_len[i]);
+    }
+}
+
+static void op_decompress(bench_cell *c) {
+    for (int i = 0; i < BENCH_MESSAGES; i++) {
+        size_t n;
+        cbc_decompress(c->comp + (size_t)i * c->slot, c->comp_len[i], c->S,
+                       c->out + (size_t)i * c->S, &n);
+    }
+}
+
+// cbc_estimate_size of what op_compress writes
+static void op_estimate(bench_cell *c) {
+    for (int i = 0; i < BENCH_MESSAGES; i++) {
+        cbc_estimate_size(NULL, c->msgs[i], c->S, CBC_EST_PLAIN, 0, &c->est_len[i]);
+    }
+}
+
+static void op_reference(bench_cell *c) {
+    char text[MAX_SIZE_MESSAGE + 1];
+    for (int i = 0; i < BENCH_MESSAGES; i++) {
+        decompress_cycle_based(c->comp + (size_t)i * c->slot,
+                               (int)c->comp_len[i], c->S, text);
+        c->out[(size_t)i * c->S] = (uint8_t)text[0];
+    }
+}
+
+static void run_op(const char *corpus, const char *op_name, bench_op op,
+                   bench_cell *cell, int reps, double *samples) {
+    op(cell);  // warmup
+    for (int r = 0; r < reps; r++) {
+        double t0 = wall_seconds();
+        op(cell);
+        samples[r] = wall_seconds() - t0;
+    }
+    bench_stats st = summarize(samples, reps);
+    double mb = (double)BENCH_MESSAGES * cell->S / 1e6;
+    printf("%-7s %4d  %-10s %9.1f %9.1f %8.1f %10.1f\n", corpus, cell->S,
+           op_name, mb / st.median, mb / st.min,
+           st.stddev / st.median * 100.0,
+           st.median * 1e9 / BENCH_MESSAGES);
+}
+
+static void bench_corpus_sizes(const bench_corpus *corpus, const uint8_t *buf,
+                               int reps, double *samples) {
+    static const int sizes[] = {32, 64, 128, 256, 512};
+    static bench_cell cell;
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int S = sizes[s];
+        uint32_t x = 7;
+        for (int i = 0; i < BENCH_MESSAGES; i++) {
+            cell.msgs[i] = buf + bench_lcg(&x) % (BENCH_CORPUS_BYTES - S + 1);
+        }
+        cell.S = S;
+        cell.slot = cbc_max_compressed_size(S, 255);
+        cell.comp = (uint8_t *)malloc(cell.slot * BENCH_MESSAGES);
+        cell.out = (uint8_t *)malloc((size_t)S * BENCH_MESSAGES);
+        if (!cell.comp || !cell.out) {
+            free(cell.comp);
+            free(cell.out);
+            return;
+        }
+
+        run_op(corpus->name, "compress", op_compress, &cell, reps, samples);
+        run_op(corpus->name, "estimate", op_estimate, &cell, reps, samples);
+        run_op(corpus->name, "decompress", op_decompress, &cell, reps, samples);
+        int ok = memcmp(cell.est_len, cell.comp_len, sizeof(cell.est_len)) == 0;
+        for (int i = 0; i < BENCH_MESSAGES && ok; i++) {
+            ok = memcmp(cell.out + (size_t)i * S, cell.msgs[i], S) == 0;
+        }
+        run_op(corpus->name, "reference", op_reference, &cell, reps, samples);
+
+        size_t comp_total = 0;
+        for (int i = 0; i < BENCH_MESSAGES; i++) comp_total += cell.comp_len[i];
+        printf("%-7s %4d  ratio %.3f%s\n", corpus->name, S,
+               (double)comp_total / ((double)S * BENCH_MESSAGES),
+               ok ? "" : " MISMATCH");
+
+        free(cell.comp);
+        free(cell.out);
+    }
+}
+
+// ------------------------------------------------------------
+// Components
+// ------------------------------------------------------------
+
+// Payload encoding throughput of BitWriter (one call per bit) vs
+// BitWriter64 fed from the per-symbol code words, on the first S bytes
+// of text with their own code table
+static void report_writer_throughput(const char *text, int S) {
+    int freq_table[ALPHABET_SIZE] = {0};
+    cbc_count_frequency((const uint8_t *)text, (size_t)S, freq_table);
+    CodeEntry codes[ALPHABET_SIZE];
+    int K = build_code_table(freq_table, codes);
+    int lut[ALPHABET_SIZE] = {0};
+    for (int i = 0; i < K; i++) lut[codes[i].symbol] = i;
+    CodeWord words[ALPHABET_SIZE];
+    build_code_words(codes, K, words);
+
+    int reps = BENCH_COMPONENT_BYTES / S;
+    int same = 1;
+    clock_t t0 = clock();
+    for (int r = 0; r < reps; r++) {
+        BitWriter bw;
+        bw_init(&bw, 64);
+        for (int i = 0; i < S; i++) {
+            const CodeEntry *e = &codes[lut[(unsigned char)text[i]]];
+            bw_put_cycle(&bw, e->m, e->j);
+        }
+        bw_free(&bw);
+    }
+    clock_t t1 = clock();
+    for (int r = 0; r < reps; r++) {
+        BitWriter64 bw;
+        bw64_init(&bw, 64);
+        for (int i = 0; i < S; i++) {
+            const CodeWord w = words[(unsigned char)text[i]];
+            bw64_put_bits(&bw, w.bits, w.len);
+        }
+        bw64_finish(&bw);
+        if (r == 0) {
+            BitWriter ref;
+            bw_init(&ref, 64);
+            for (int i = 0; i < S; i++) {
+                const CodeEntry *e = &codes[lut[(unsigned char)text[i]]];
+                bw_put_cycle(&ref, e->m, e->j);
+            }
+            same = ref.size == (int)bw.size &&
+                   memcmp(ref.data, bw.data, bw.size) == 0;
+            bw_free(&ref);
+        }
+        bw64_free(&bw);
+    }
+    clock_t t2 = clock();
+
+    double mb = (double)reps * S / 1e6;
+    double bit_s = (double)(t1 - t0) / CLOCKS_PER_SEC;
+    double acc_s = (double)(t2 - t1) / CLOCKS_PER_SEC;
+    printf("Encode: bit writer %.1f MB/s, 64-bit writer %.1f MB/s (x%.2f)%s\n",
+           mb / bit_s, mb / acc_s, bit_s / acc_s, same ? "" : " MISMATCH");
+}
+
+// Ranking cost per message: qsort with compare_codeentry vs rank_codes,
+// on the histogram of the first S bytes of text
+static void report_ranking_throughput(const char *text, int S) {
+    int freq_table[ALPHABET_SIZE] = {0};
+    cbc_count_frequency((const uint8_t *)text, (size_t)S, freq_table);
+    CodeEntry base[ALPHABET_SIZE];
+    int K = 0;
+    for (int c = 0; c < ALPHABET_SIZE; c++) {
+        if (freq_table[c] > 0) {
+            base[K].symbol = (unsigned char)c;
+            base[K].freq = freq_table[c];
+            K++;
+        }
+    }
+
+    CodeEntry a[ALPHABET_SIZE];
+    CodeEntry b[ALPHABET_SIZE];
+    int reps = BENCH_COMPONENT_BYTES / S;
+    int same = 1;
+    clock_t t0 = clock();
+    for (int r = 0; r < reps; r++) {
+        memcpy(a, base, (size_t)K * sizeof(CodeEntry));
+        qsort(a, K, sizeof(CodeEntry), compare_codeentry);
+    }
+    clock_t t1 = clock();
+    for (int r = 0; r < reps; r++) {
+        memcpy(b, base, (size_t)K * sizeof(CodeEntry));
+        rank_codes(b, K);
+    }
+    clock_t t2 = clock();
+    for (int i = 0; i < K; i++) same &= a[i].symbol == b[i].symbol;
+
+    printf("Ranking: qsort %.0f ns, radix %.0f ns per message%s\n",
+           1e9 * (double)(t1 - t0) / CLOCKS_PER_SEC / reps,
+           1e9 * (double)(t2 - t1) / CLOCKS_PER_SEC / reps,
+           same ? "" : " MISMATCH");
+}
+
+// Per-message setup cost: one cbc_compress_framed_into call per record vs
+// one cbc_compress_batch call over BENCH_BATCH_MESSAGES records of S bytes
+static void report_batch_throughput(const char *text, size_t text_len, int S) {
+    static cbc_msg msgs[BENCH_BATCH_MESSAGES];
+    for (int i = 0; i < BENCH_BATCH_MESSAGES; i++) {
+        msgs[i].data = (const uint8_t *)text + (size_t)i % (text_len - S + 1);
+        msgs[i].len = (size_t)S;
+    }
+    size_t cap = cbc_max_batch_size(msgs, BENCH_BATCH_MESSAGES);
+    uint8_t *arena = (uint8_t *)malloc(cap);
+    size_t *offsets = (size_t *)malloc((BENCH_BATCH_MESSAGES + 1) * sizeof(size_t));
+    if (!arena || !offsets) {
+        free(arena);
+        free(offsets);
+        return;
+    }
+
+    int reps = BENCH_COMPONENT_BYTES / (S * BENCH_BATCH_MESSAGES) + 1;
+    clock_t t0 = clock();
+    for (int r = 0; r < reps; r++) {
+        size_t pos = 0;
+        for (int i = 0; i < BENCH_BATCH_MESSAGES; i++) {
+            size_t written = 0;
+            cbc_compress_framed_into(msgs[i].data, msgs[i].len,
+                                     arena + pos, cap - pos, &written);
+            pos += written;
+        }
+    }
+    clock_t t1 = clock();
+    for (int r = 0; r < reps; r++) {
+        cbc_compress_batch(msgs, BENCH_BATCH_MESSAGES, arena, cap, offsets);
+    }
+    clock_t t2 = clock();
+
+    double n = (double)reps * BENCH_BATCH_MESSAGES;
+    printf("Compress: per call %.0f ns/msg, batch %.0f ns/msg\n",
+           1e9 * (double)(t1 - t0) / CLOCKS_PER_SEC / n,
+           1e9 * (double)(t2 - t1) / CLOCKS_PER_SEC / n);
+    free(arena);
+    free(offsets);
+}
+
+// Stateless vs cbc_ctx encoders on the same records: the byte-pair
+// container (plan and sort buffer malloc'ed per call vs held by the
+// context) and an allocated frame (cbc_compress vs cbc_ctx_compress)
+static void report_ctx_throughput(const char *text, size_t text_len, int S) {
+    cbc_ctx *ctx = cbc_ctx_create(NULL, (size_t)S, CBC_CTX_PAIRS);
+    size_t cap = cbc_max_container_size((size_t)S);
+    uint8_t *frame = (uint8_t *)malloc(cap);
+    if (!ctx || !frame) {
+        cbc_ctx_free(ctx);
+        free(frame);
+        return;
+    }
+
+    int n = BENCH_COMPONENT_BYTES / S + 1;
+    size_t written = 0;
+    clock_t t0 = clock();
+    for (int i = 0; i < n; i++) {
+        const uint8_t *msg = (const uint8_t *)text + (size_t)i % (text_len - S + 1);
+        cbc_compress_container_pairs_into(msg, (size_t)S, 0, frame, cap, &written);
+    }
+    clock_t t1 = clock();
+    for (int i = 0; i < n; i++) {
+        const uint8_t *msg = (const uint8_t *)text + (size_t)i % (text_len - S + 1);
+        cbc_ctx_compress_container_pairs_into(ctx, msg, (size_t)S, 0, frame, cap, &written);
+    }
+    clock_t t2 = clock();
+    for (int i = 0; i < n; i++) {
+        const uint8_t *msg = (const uint8_t *)text + (size_t)i % (text_len - S + 1);
+        uint8_t *out = NULL;
+        cbc_compress(msg, (size_t)S, &out, &written);
+        free(out);
+    }
+    clock_t t3 = clock();
+    for (int i = 0; i < n; i++) {
+        const uint8_t *msg = (const uint8_t *)text + (size_t)i % (text_len - S + 1);
+        const uint8_t *out = NULL;
+        cbc_ctx_compress(ctx, msg, (size_t)S, 0, &out, &written);
+    }
+    clock_t t4 = clock();
+
+    double ns = 1e9 / CLOCKS_PER_SEC / n;
+    printf("Context: pairs %.0f -> %.0f ns/msg, allocating %.0f -> %.0f ns/msg\n",
+           ns * (double)(t1 - t0), ns * (double)(t2 - t1),
+           ns * (double)(t3 - t2), ns * (double)(t4 - t3));
+    cbc_ctx_free(ctx);
+    free(frame);
+}
+
+// Histogram throughput on BENCH_HIST_BYTES of text with zero padding runs
+// (a typical padded sensor frame): plain loop vs cbc_count_frequency
+static void report_histogram_throughput(const char *text, size_t text_len) {
+    uint8_t *frame = (uint8_t *)malloc(BENCH_HIST_BYTES);
+    if (!frame) return;
+    for (size_t i = 0; i < BENCH_HIST_BYTES; i++) {
+        frame[i] = (i / 256) % 2 ? 0 : (uint8_t)text[i % text_len];
+    }
+
+    int ref[ALPHABET_SIZE] = {0};
+    int got[ALPHABET_SIZE] = {0};
+    int reps = BENCH_COMPONENT_BYTES / BENCH_HIST_BYTES * 4;
+    clock_t t0 = clock();
+    for (int r = 0; r < reps; r++) {
+        count_frequency_scalar(frame, BENCH_HIST_BYTES, ref);
+    }
+    clock_t t1 = clock();
+    for (int r = 0; r < reps; r++) {
+        cbc_count_frequency(frame, BENCH_HIST_BYTES, got);
+    }
+    clock_t t2 = clock();
+
+    double mb = (double)reps * BENCH_HIST_BYTES / 1e6;
+    double plain_s = (double)(t1 - t0) / CLOCKS_PER_SEC;
+    double kernel_s = (double)(t2 - t1) / CLOCKS_PER_SEC;
+    printf("Histogram: plain %.0f MB/s, kernel %.0f MB/s (x%.2f)%s\n\n",
+           mb / plain_s, mb / kernel_s, plain_s / kernel_s,
+           memcmp(ref, got, sizeof(ref)) == 0 ? "" : " MISMATCH");
+    free(frame);
+}
+
+#ifndef CBC_NO_THREADS
+// Scaling of the multithreaded batch engine from 1 to 32 threads on
+// BENCH_MT_MESSAGES records of 32..512 bytes (mixed sizes)
+static void report_mt_scaling(const char *text, size_t text_len) {
+    static cbc_msg msgs[BENCH_MT_MESSAGES];
+    size_t total = 0;
+    for (int i = 0; i < BENCH_MT_MESSAGES; i++) {
+        size_t len = (size_t)32 << (i % 5);
+        msgs[i].data = (const uint8_t *)text + (size_t)i % (text_len - len + 1);
+        msgs[i].len = len;
+        total += len;
+    }
+    size_t cap = cbc_max_batch_size(msgs, BENCH_MT_MESSAGES);
+    uint8_t *arena = (uint8_t *)malloc(cap);
+    uint8_t *out = (uint8_t *)malloc(total);
+    size_t *offsets = (size_t *)malloc((BENCH_MT_MESSAGES + 1) * sizeof(size_t));
+    size_t *out_offsets = (size_t *)malloc((BENCH_MT_MESSAGES + 1) * sizeof(size_t));
+    if (!arena || !out || !offsets || !out_offsets) {
+        free(arena);
+        free(out);
+        free(offsets);
+        free(out_offsets);
+        return;
+    }
+
+    printf("=== Multithreaded batch (%d records, %zu bytes) ===\n",
+           BENCH_MT_MESSAGES, total);
+    for (int threads = 1; threads <= 32; threads *= 2) {
+        double t0 = wall_seconds();
+        cbc_compress_batch_mt(msgs, BENCH_MT_MESSAGES, arena, cap, offsets, threads);
+        double t1 = wall_seconds();
+        cbc_decompress_batch_mt(arena, offsets, BENCH_MT_MESSAGES, out, total,
+                                out_offsets, threads);
+        double t2 = wall_seconds();
+        printf("%2d threads: compress %.1f MB/s, decompress %.1f MB/s\n",
+               threads, total / 1e6 / (t1 - t0), total / 1e6 / (t2 - t1));
+    }
+    printf("\n");
+
+    free(arena);
+    free(out);
+    free(offsets);
+    free(out_offsets);
+}
+#endif
+
+#ifdef CBC_STATS
+// Library counters over the corpus cells (STATS=1 builds)
+static void report_stats(void) {
+    static const char *stage_names[CBC_STAGES] = {
+        "count", "rank", "encode", "copy", "decode"};
+    cbc_stats s;
+    cbc_stats_collect(&s);
+
+    printf("\n=== Stats ===\n");
+    printf("%llu messages, %llu -> %llu bytes (%llu header), %llu decoded\n",
+           (unsigned long long)s.messages, (unsigned long long)s.in_bytes,
+           (unsigned long long)s.out_bytes, (unsigned long long)s.header_bytes,
+           (unsigned long long)s.decoded_bytes);
+    uint64_t ticks = 0;
+    for (int i = 0; i < CBC_STAGES; i++) ticks += s.stage_ticks[i];
+    for (int i = 0; i < CBC_STAGES; i++) {
+        printf("%-7s %5.1f%% of ticks\n", stage_names[i],
+               ticks ? 100.0 * s.stage_ticks[i] / ticks : 0.0);
+    }
+    printf("code lengths:");
+    for (int len = 1; len <= CBC_STATS_MAX_CODE; len++) {
+        if (s.code_lengths[len]) printf(" %d:%llu", len, (unsigned long long)s.code_lengths[len]);
+    }
+    printf("\n");
+}
+#endif
+
+int main(int argc, char **argv) {
+    int reps = BENCH_DEFAULT_REPS;
+    int quick = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            quick = 1;
+            reps = BENCH_QUICK_REPS;
+        } else {
+            fprintf(stderr, "usage: %s [--reps N] [--quick]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (reps < 1) reps = 1;
+
+    double *samples = (double *)malloc(reps * sizeof(double));
+    uint8_t *buf = (uint8_t *)malloc(BENCH_CORPUS_BYTES);
+    if (!samples || !buf) {
+        free(samples);
+        free(buf);
+        return 1;
+    }
+
+#ifdef CBC_DECODER_TABLE
+    const char *backend = "table";
+#else
+    const char *backend = "clz";
+#endif
+    printf("%d messages per cell, %d reps (MB/s of original bytes), "
+           "%s decoder\n\n", BENCH_MESSAGES, reps, backend);
+    printf("%-7s %4s  %-10s %9s %9s %8s %10s\n", "corpus", "size", "op",
+           "median", "best", "stddev%", "ns/msg");
+    for (size_t c = 0; c < sizeof(bench_corpora) / sizeof(bench_corpora[0]); c++) {
+        bench_corpora[c].fill(buf, BENCH_CORPUS_BYTES);
+        bench_corpus_sizes(&bench_corpora[c], buf, reps, samples);
+    }
+    free(samples);
+    free(buf);
+#ifdef CBC_STATS
+    report_stats();
+#endif
+
+    if (quick) return 0;
+
+    printf("\n=== Components (prose) ===\n");
+    size_t prose_len = strlen(bench_prose);
+    for (int S = 32; S <= 512; S *= 2) {
+        printf("-- %d bytes --\n", S);
+        report_writer_throughput(bench_prose, S);
+        report_ranking_throughput(bench_prose, S);
+        report_batch_throughput(bench_prose, prose_len, S);
+        report_ctx_throughput(bench_prose, prose_len, S);
+    }
+    printf("\n");
+    report_histogram_throughput(bench_prose, prose_len);
+#ifndef CBC_NO_THREADS
+    report_mt_scaling(bench_prose, prose_len);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,570 @@
+// Cycle-Based Compressor - file archiver
+//
+//   cbc c [-b block_size] [-l max_len | -i interval] [-t threads] <input> <output>
+//   cbc d [-t threads] <archive> <output>
+//   cbc x <archive> <offset> <count>
+//   cbc l <archive>
+//
+// The input is mmap-ed and cut into blocks, each compressed as a
+// versioned container frame with its own code table. A first parallel
+// pass sizes every frame exactly (cbc_compress_container_into with no
+// output), so the archive is laid out before any byte is encoded and
+// workers write their frames straight into the mmap-ed output. Decoding
+// maps the archive and writes each block at its final offset of the
+// mapped output file. Nothing is staged in intermediate buffers.
+//
+// Archive format (integers little-endian):
+//   [4 bytes: "CBCA"] [1 byte: version] [3 bytes: 0]
+//   [u64: block size] [u64: original size] [u64: block count n]
+//   [(n + 1) x u64: frame offsets from the start of the file]
+//   [n container frames]
+//
+// Frame i spans offsets[i] .. offsets[i + 1] and decodes to block i,
+// which starts at i * block_size of the original file. With -i, frames
+// are indexed containers with a checkpoint every interval bytes, and
+// `cbc x` extracts a byte range by decoding only the segments it covers.
+// Indexed frames always use full-length codes, so -l and -i exclude each
+// other.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef CBC_NO_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
+
+#include "cbc.h"
+
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER 32
+#define DEFAULT_BLOCK (1u << 20)
+#define MAX_THREADS 64
+
+// ------------------------------------------------------------
+// Helpers
+
+static const char *status_name(int status) {
+    switch (status) {
+    case CBC_OK:            return "ok";
+    case CBC_ERR_OVERFLOW:  return "output buffer too small";
+    case CBC_ERR_SYMBOLS:   return "too many symbols";
+    case CBC_ERR_INPUT:     return "invalid arguments";
+    case CBC_ERR_CORRUPT:   return "corrupt frame";
+    case CBC_ERR_TRUNCATED: return "truncated frame";
+    case CBC_ERR_NOMEM:     return "out of memory";
+    case CBC_ERR_IO:        return "I/O error";
+    default:                return "unknown error";
+    }
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+// Size with an optional K / M / G suffix; 0 on a malformed value
+static size_t parse_size(const char *s) {
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    switch (*end) {
+    case 'k': case 'K': v <<= 10; end++; break;
+    case 'm': case 'M': v <<= 20; end++; break;
+    case 'g': case 'G': v <<= 30; end++; break;
+    default: break;
+    }
+    return *end == '\0' ? (size_t)v : 0;
+}
+
+// Read-only mapping of a whole file; *data is NULL for an empty file
+static int map_input(const char *path, const uint8_t **data, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "cbc: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "cbc: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    *size = (size_t)st.st_size;
+    *data = NULL;
+    if (*size > 0) {
+        void *p = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            fprintf(stderr, "cbc: mmap %s: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        madvise(p, *size, MADV_SEQUENTIAL);
+        *data = p;
+    }
+    close(fd);
+    return 0;
+}
+
+// Creates path with exactly size bytes and maps it writable
+static int map_output(const char *path, size_t size, uint8_t **data) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "cbc: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)size) != 0) {
+        fprintf(stderr, "cbc: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    *data = NULL;
+    if (size > 0) {
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            fprintf(stderr, "cbc: mmap %s: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        *data = p;
+    }
+    close(fd);
+    return 0;
+}
+
+static void unmap(const void *data, size_t size) {
+    if (data) munmap((void *)data, size);
+}
+
+// ------------------------------------------------------------
+// Parallel block loop
+//
+// Workers claim blocks from a shared counter, so a slow block never
+// holds up the others. The first failing status stops the run.
+
+typedef int (*block_fn)(void *job, size_t i);
+
+typedef struct {
+    block_fn fn;
+    void *job;
+    size_t n;
+#ifndef CBC_NO_THREADS
+    atomic_size_t next;
+    atomic_int status;
+#else
+    size_t next;
+    int status;
+#endif
+} block_loop;
+
+static void *block_worker(void *arg) {
+    block_loop *loop = arg;
+    for (;;) {
+#ifndef CBC_NO_THREADS
+        size_t i = atomic_fetch_add(&loop->next, 1);
+        if (i >= loop->n || atomic_load(&loop->status) != CBC_OK) break;
+        int status = loop->fn(loop->job, i);
+        if (status != CBC_OK) {
+            int expected = CBC_OK;
+            atomic_compare_exchange_strong(&loop->status, &expected, status);
+        }
+#else
+        size_t i = loop->next++;
+        if (i >= loop->n || loop->status != CBC_OK) break;
+        loop->status = loop->fn(loop->job, i);
+#endif
+    }
+    return NULL;
+}
+
+static int run_blocks(size_t n, int threads, block_fn fn, void *job) {
+    block_loop loop;
+    loop.fn = fn;
+    loop.job = job;
+    loop.n = n;
+#ifndef CBC_NO_THREADS
+    atomic_init(&loop.next, 0);
+    atomic_init(&loop.status, CBC_OK);
+
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if ((size_t)threads > n) threads = (int)n;
+
+    pthread_t tid[MAX_THREADS];
+    int started = 0;
+    for (int t = 1; t < threads; t++) {
+        if (pthread_create(&tid[started], NULL, block_worker, &loop) != 0) break;
+        started++;
+    }
+    block_worker(&loop);  // the calling thread works too
+    for (int t = 0; t < started; t++) pthread_join(tid[t], NULL);
+    return atomic_load(&loop.status);
+#else
+    (void)threads;
+    loop.next = 0;
+    loop.status = CBC_OK;
+    block_worker(&loop);
+    return loop.status;
+#endif
+}
+
+// ------------------------------------------------------------
+// Compression
+
+typedef struct {
+    const uint8_t *in;
+    size_t in_size;
+    size_t block_size;
+    int max_len;
+    size_t interval;   // 0 for plain / bounded / raw frames
+    uint8_t *out;
+    size_t *offsets;   // frame sizes in pass 1, then offsets (n + 1 entries)
+} compress_job;
+
+static size_t block_len(size_t total, size_t block_size, size_t i) {
+    size_t start = i * block_size;
+    return total - start < block_size ? total - start : block_size;
+}
+
+// One container frame for block i; out NULL only sizes it
+static int encode_block(const compress_job *job, size_t i, uint8_t *out,
+                        size_t cap, size_t *written) {
+    const uint8_t *in = job->in + i * job->block_size;
+    size_t len = block_len(job->in_size, job->block_size, i);
+    if (job->interval == 0) {
+        return cbc_compress_container_into(in, len, job->max_len, out, cap, written);
+    }
+    // One ranking for the whole block
+    size_t table_span = (len + job->interval - 1) / job->interval * job->interval;
+    return cbc_compress_indexed_into(in, len, job->interval, table_span,
+                                     out, cap, written);
+}
+
+static int size_block(void *arg, size_t i) {
+    compress_job *job = arg;
+    size_t written = 0;
+    int status = encode_block(job, i, NULL, 0, &written);
+    if (status != CBC_ERR_OVERFLOW) return status == CBC_OK ? CBC_ERR_INPUT : status;
+    job->offsets[i + 1] = written;
+    return CBC_OK;
+}
+
+static int compress_block(void *arg, size_t i) {
+    compress_job *job = arg;
+    size_t cap = job->offsets[i + 1] - job->offsets[i];
+    size_t written = 0;
+    int status = encode_block(job, i, job->out + job->offsets[i], cap, &written);
+    if (status == CBC_OK && written != cap) status = CBC_ERR_CORRUPT;
+    return status;
+}
+
+static int cmd_compress(const char *in_path, const char *out_path,
+                        size_t block_size, int max_len, size_t interval,
+                        int threads) {
+    compress_job job = {0};
+    job.block_size = block_size;
+    job.max_len = max_len;
+    job.interval = interval;
+    if (map_input(in_path, &job.in, &job.in_size) != 0) return 1;
+
+    size_t n = (job.in_size + block_size - 1) / block_size;
+    job.offsets = calloc(n + 1, sizeof(size_t));
+    if (!job.offsets) {
+        fprintf(stderr, "cbc: out of memory\n");
+        unmap(job.in, job.in_size);
+        return 1;
+    }
+
+    // Pass 1: exact frame sizes, then offsets by prefix sum
+    int status = run_blocks(n, threads, size_block, &job);
+    if (status != CBC_OK) {
+        fprintf(stderr, "cbc: %s: %s\n", in_path, status_name(status));
+        free(job.offsets);
+        unmap(job.in, job.in_size);
+        return 1;
+    }
+    job.offsets[0] = ARCHIVE_HEADER + 8 * (n + 1);
+    for (size_t i = 0; i < n; i++) job.offsets[i + 1] += job.offsets[i];
+    size_t total = job.offsets[n];
+
+    if (map_output(out_path, total, &job.out) != 0) {
+        free(job.offsets);
+        unmap(job.in, job.in_size);
+        return 1;
+    }
+    memcpy(job.out, "CBCA", 4);
+    job.out[4] = ARCHIVE_VERSION;
+    memset(job.out + 5, 0, 3);
+    put_u64(job.out + 8, block_size);
+    put_u64(job.out + 16, job.in_size);
+    put_u64(job.out + 24, n);
+    for (size_t i = 0; i <= n; i++) {
+        put_u64(job.out + ARCHIVE_HEADER + 8 * i, job.offsets[i]);
+    }
+
+    // Pass 2: every frame straight into its place in the archive
+    status = run_blocks(n, threads, compress_block, &job);
+    if (status != CBC_OK) {
+        fprintf(stderr, "cbc: %s: %s\n", in_path, status_name(status));
+    }
+
+    unmap(job.out, total);
+    unmap(job.in, job.in_size);
+    free(job.offsets);
+    if (status != CBC_OK) {
+        unlink(out_path);
+        return 1;
+    }
+    fprintf(stderr, "%s: %zu -> %zu bytes (%.3f), %zu blocks\n", out_path,
+            job.in_size, total,
+            job.in_size ? (double)total / (double)job.in_size : 0.0, n);
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Decompression
+
+typedef struct {
+    const uint8_t *arc;
+    size_t arc_size;
+    size_t block_size;
+    size_t original_size;
+    size_t n;
+    const uint8_t *index;
+    uint8_t *out;
+} archive;
+
+// Checks the archive header and that the index is monotonic and in bounds
+static int open_archive(const char *path, archive *a) {
+    memset(a, 0, sizeof(*a));
+    if (map_input(path, &a->arc, &a->arc_size) != 0) return -1;
+
+    const uint8_t *p = a->arc;
+    if (a->arc_size < ARCHIVE_HEADER || memcmp(p, "CBCA", 4) != 0 ||
+        p[4] != ARCHIVE_VERSION) {
+        fprintf(stderr, "cbc: %s: not a cbc archive\n", path);
+        unmap(a->arc, a->arc_size);
+        return -1;
+    }
+    uint64_t block_size = get_u64(p + 8);
+    uint64_t original_size = get_u64(p + 16);
+    uint64_t n = get_u64(p + 24);
+    int ok = block_size > 0 && block_size <= INT32_MAX &&
+             original_size <= SIZE_MAX - block_size &&
+             n == (original_size + block_size - 1) / block_size &&
+             n < (a->arc_size - ARCHIVE_HEADER) / 8;
+    a->index = p + ARCHIVE_HEADER;
+    for (uint64_t i = 0; ok && i <= n; i++) {
+        uint64_t off = get_u64(a->index + 8 * i);
+        uint64_t prev = i ? get_u64(a->index + 8 * (i - 1)) : ARCHIVE_HEADER + 8 * (n + 1);
+        ok = off >= prev && off <= a->arc_size && (i < n || off == a->arc_size);
+    }
+    if (!ok) {
+        fprintf(stderr, "cbc: %s: corrupt archive index\n", path);
+        unmap(a->arc, a->arc_size);
+        return -1;
+    }
+    a->block_size = (size_t)block_size;
+    a->original_size = (size_t)original_size;
+    a->n = (size_t)n;
+    return 0;
+}
+
+static int decompress_block(void *arg, size_t i) {
+    archive *a = arg;
+    size_t start = (size_t)get_u64(a->index + 8 * i);
+    size_t end = (size_t)get_u64(a->index + 8 * (i + 1));
+    size_t len = block_len(a->original_size, a->block_size, i);
+
+    cbc_container c;
+    int status = cbc_container_parse(a->arc + start, end - start, &c);
+    if (status != CBC_OK) return status;
+    if (c.original_len != len) return CBC_ERR_CORRUPT;
+
+    size_t out_len = 0;
+    return cbc_decompress_container(NULL, a->arc + start, end - start,
+                                    a->out + i * a->block_size, len, &out_len);
+}
+
+static int cmd_decompress(const char *in_path, const char *out_path, int threads) {
+    archive a;
+    if (open_archive(in_path, &a) != 0) return 1;
+    if (map_output(out_path, a.original_size, &a.out) != 0) {
+        unmap(a.arc, a.arc_size);
+        return 1;
+    }
+
+    int status = run_blocks(a.n, threads, decompress_block, &a);
+    if (status != CBC_OK) {
+        fprintf(stderr, "cbc: %s: %s\n", in_path, status_name(status));
+    }
+    unmap(a.out, a.original_size);
+    unmap(a.arc, a.arc_size);
+    if (status != CBC_OK) {
+        unlink(out_path);
+        return 1;
+    }
+    return 0;
+}
+
+// Writes bytes [offset, offset + count) of the original file to stdout,
+// decoding only the blocks, and within indexed frames the segments, that
+// hold them
+static int cmd_extract(const char *path, size_t offset, size_t count) {
+    archive a;
+    if (open_archive(path, &a) != 0) return 1;
+    if (offset > a.original_size || count > a.original_size - offset) {
+        fprintf(stderr, "cbc: %s: range past the end (%zu bytes)\n", path, a.original_size);
+        unmap(a.arc, a.arc_size);
+        return 1;
+    }
+
+    size_t chunk = count < a.block_size ? count : a.block_size;
+    uint8_t *buf = malloc(chunk ? chunk : 1);
+    int status = buf ? CBC_OK : CBC_ERR_NOMEM;
+    while (status == CBC_OK && count > 0) {
+        size_t b = offset / a.block_size;
+        size_t start = (size_t)get_u64(a.index + 8 * b);
+        size_t end = (size_t)get_u64(a.index + 8 * (b + 1));
+        size_t skip = offset - b * a.block_size;
+        size_t len = block_len(a.original_size, a.block_size, b) - skip;
+        if (len > count) len = count;
+
+        size_t got = 0;
+        status = cbc_decompress_range(NULL, a.arc + start, end - start,
+                                      skip, len, buf, &got);
+        if (status == CBC_OK && fwrite(buf, 1, got, stdout) != got) status = CBC_ERR_IO;
+        offset += len;
+        count -= len;
+    }
+    if (status != CBC_OK) fprintf(stderr, "cbc: %s: %s\n", path, status_name(status));
+    free(buf);
+    unmap(a.arc, a.arc_size);
+    return status == CBC_OK ? 0 : 1;
+}
+
+static int cmd_list(const char *path) {
+    archive a;
+    if (open_archive(path, &a) != 0) return 1;
+
+    printf("%zu bytes in %zu blocks of %zu, archive %zu bytes\n",
+           a.original_size, a.n, a.block_size, a.arc_size);
+    printf("%8s %12s %10s %10s %6s  %s\n",
+           "block", "offset", "bytes", "frame", "ratio", "layout");
+    int status = 0;
+    for (size_t i = 0; i < a.n; i++) {
+        size_t start = (size_t)get_u64(a.index + 8 * i);
+        size_t end = (size_t)get_u64(a.index + 8 * (i + 1));
+        cbc_container c;
+        if (cbc_container_parse(a.arc + start, end - start, &c) != CBC_OK) {
+            printf("%8zu %12zu  corrupt frame\n", i, start);
+            status = 1;
+            continue;
+        }
+        const char *layout = c.flags == 0 ? "plain"
+                           : c.flags == CBC_CF_RAW ? "raw"
+                           : c.flags == CBC_CF_BOUNDED ? "bounded"
+                           : c.flags == CBC_CF_DICT ? "dict"
+                           : c.flags == CBC_CF_INDEXED ? "indexed" : NULL;
+        printf("%8zu %12zu %10zu %10zu %6.3f  %s", i, start, c.original_len,
+               end - start,
+               c.original_len ? (double)(end - start) / (double)c.original_len : 0.0,
+               layout ? layout : "unknown");
+        if (c.flags == 0 && c.header_size >= 1) printf(" K=%d", c.header[0]);
+        if (c.flags == CBC_CF_BOUNDED && c.header_size >= 2) {
+            printf(" N=%d K=%d%s", c.header[0] & ~CBC_BOUNDED_PAIRS, c.header[1],
+                   c.header[0] & CBC_BOUNDED_PAIRS ? " pairs" : "");
+        }
+        if (!layout) printf(" flags=0x%x", c.flags);
+        printf("\n");
+    }
+    unmap(a.arc, a.arc_size);
+    return status;
+}
+
+// ------------------------------------------------------------
+
+static int usage(void) {
+    fprintf(stderr,
+            "usage: cbc c [-b block_size] [-l max_len | -i interval] [-t threads] <input> <output>\n"
+            "       cbc d [-t threads] <archive> <output>\n"
+            "       cbc x <archive> <offset> <count>\n"
+            "       cbc l <archive>\n"
+            "\n"
+            "  -b  block size, K/M/G suffixes allowed (default 1M)\n"
+            "  -l  longest code in bits, 2..%d; longer ones become escapes\n"
+            "      (default %d)\n"
+            "  -i  random-access checkpoint every interval bytes (K/M/G);\n"
+            "      cbc x then decodes only the segments a range covers.\n"
+            "      Indexed frames use full-length codes, so not with -l\n"
+            "  -t  worker threads (default: every online CPU)\n",
+            MAX_CODE_LENGTH, MAX_CODE_LENGTH);
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || strlen(argv[1]) != 1) return usage();
+    char cmd = argv[1][0];
+
+    size_t block_size = DEFAULT_BLOCK;
+    int max_len = MAX_CODE_LENGTH;
+    int limited = 0;   // -l given
+    size_t interval = 0;
+    int threads = 0;
+    int arg = 2;
+    for (; arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0'; arg += 2) {
+        if (arg + 1 >= argc || argv[arg][2] != '\0') return usage();
+        const char *value = argv[arg + 1];
+        switch (argv[arg][1]) {
+        case 'b':
+            block_size = parse_size(value);
+            if (block_size == 0 || block_size > INT32_MAX) return usage();
+            break;
+        case 'l':
+            max_len = atoi(value);
+            if (max_len < 2 || max_len > MAX_CODE_LENGTH) return usage();
+            limited = 1;
+            break;
+        case 'i':
+            interval = parse_size(value);
+            if (interval == 0) return usage();
+            break;
+        case 't':
+            threads = atoi(value);
+            break;
+        default:
+            return usage();
+        }
+    }
+
+    if (limited && interval != 0) {
+        fprintf(stderr, "cbc: -l and -i cannot be combined\n");
+        return 2;
+    }
+
+    int files = argc - arg;
+    if (cmd == 'c' && files == 2) {
+        return cmd_compress(argv[arg], argv[arg + 1], block_size, max_len,
+                            interval, threads);
+    }
+    if (cmd == 'x' && files == 3) {
+        char *end1, *end2;
+        unsigned long long offset = strtoull(argv[arg + 1], &end1, 10);
+        unsigned long long count = strtoull(argv[arg + 2], &end2, 10);
+        if (*end1 != '\0' || *end2 != '\0') return usage();
+        return cmd_extract(argv[arg], (size_t)offset, (size_t)count);
+    }
+    if (cmd == 'd' && files == 2) return cmd_decompress(argv[arg], argv[arg + 1], threads);
+    if (cmd == 'l' && files == 1) return cmd_list(argv[arg]);
+    return usage();
+}
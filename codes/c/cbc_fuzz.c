@@ -0,0 +1,1008 @@
+// Differential fuzz target for the codec.
+//
+// Build: make fuzz            standalone driver (add SANITIZE=address,undefined)
+//        make fuzz-libfuzzer  the same target under clang's libFuzzer
+// Usage: ./cbc_fuzz [--seconds S] [--seed N] [--max-len N]
+//        ./cbc_fuzz FILE...   replay inputs, e.g. a libFuzzer crash
+//
+// An input is a parameter byte followed by a message. The message goes
+// through every encoder and must come back from every decoder of the
+// format, and the fast kernels must match their reference versions:
+//   - histogram kernels against the scalar count, radix ranking against
+//     qsort(compare_codeentry)
+//   - cbc_decompress, the clz window decoder and decompress_cycle_based
+//     against a bit-at-a-time reference decoder
+//   - compress_cycle_based / decompress_cycle_based against the binary API
+//   - framed, bounded, container, byte-pair, indexed, range, dictionary
+//     and session frames against the message
+//   - every cbc_ctx encoder against its stateless version, on contexts
+//     reused across inputs
+//   - stream encoder and decoder, fed in pieces, against the message
+// Each plain frame is also truncated, given an all-zero tail and
+// bit-flipped, and every plain decoder must agree with the reference on
+// the status, the count and the bytes of what it decodes. Finally the
+// input itself is fed to every decoder as a frame. A failed check prints
+// the input and aborts, which libFuzzer and the sanitizers turn into a
+// reproducer. Frames from past bugs are replayed once before the first
+// input.
+//
+// The standalone driver generates random and adversarial messages (K =
+// 255 and 256, one symbol, empty, skewed, text, damaged frames) until the
+// time runs out and reports cases/s and MB/s of message bytes.
+// codes/python/fuzz.py replays the same kinds of cases against the
+// Python implementation through cbc_native.
+
+#define _POSIX_C_SOURCE 199309L
+
+// Built as one translation unit with the library so the sanitizers and
+// coverage instrumentation see its internals
+#include "cycle_based_compressor.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define FUZZ_DEFAULT_SECONDS 10
+#define FUZZ_DEFAULT_MAX_LEN 4096
+
+static const uint8_t *fuzz_input;
+static size_t fuzz_input_size;
+static unsigned long long fuzz_checks;
+
+#define FUZZ_CRASH_FILE "cbc_fuzz.crash"
+
+// Reports the failed check, saves the input for replay, then aborts
+static void fuzz_fail(const char *what, int line) {
+    fprintf(stderr, "cbc_fuzz: line %d: %s (%zu-byte input", line, what,
+            fuzz_input_size);
+#ifndef CBC_LIBFUZZER
+    FILE *f = fopen(FUZZ_CRASH_FILE, "wb");
+    if (f && fwrite(fuzz_input, 1, fuzz_input_size, f) == fuzz_input_size) {
+        fprintf(stderr, " saved to " FUZZ_CRASH_FILE);
+    }
+    if (f) fclose(f);
+#endif
+    fprintf(stderr, ")\n");
+    abort();
+}
+
+#define fuzz_check(cond, what) \
+    do { \
+        fuzz_checks++; \
+        if (!(cond)) fuzz_fail(what, __LINE__); \
+    } while (0)
+
+// Exact-size buffers, so ASan flags the first byte past a bound, filled
+// with a pattern so output that relies on zeroed memory shows up
+static uint8_t *fuzz_alloc(size_t n) {
+    uint8_t *p = (uint8_t *)malloc(n ? n : 1);
+    if (!p) {
+        fprintf(stderr, "cbc_fuzz: out of memory\n");
+        abort();
+    }
+    memset(p, 0xA5, n);
+    return p;
+}
+
+static int same_bytes(const uint8_t *a, const uint8_t *b, size_t n) {
+    return n == 0 || memcmp(a, b, n) == 0;
+}
+
+// ------------------------------------------------------------
+// Kernels against their references
+// ------------------------------------------------------------
+
+static void check_kernels(const uint8_t *msg, size_t len) {
+    int freq[ALPHABET_SIZE] = {0};
+    int ref[ALPHABET_SIZE] = {0};
+    cbc_count_frequency(msg, len, freq);
+    for (size_t i = 0; i < len; i++) ref[msg[i]]++;
+    fuzz_check(memcmp(freq, ref, sizeof(freq)) == 0, "histogram kernel");
+
+    // Each kernel, not only the one picked for this CPU
+    uint32_t sub[4][ALPHABET_SIZE];
+    memset(freq, 0, sizeof(freq));
+    count_frequency_multi(msg, len, freq, sub);
+    fuzz_check(memcmp(freq, ref, sizeof(freq)) == 0, "count_frequency_multi");
+#ifdef CBC_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        memset(freq, 0, sizeof(freq));
+        count_frequency_runs_avx2(msg, len, freq, sub);
+        fuzz_check(memcmp(freq, ref, sizeof(freq)) == 0, "count_frequency_runs_avx2");
+    }
+#endif
+#ifdef CBC_HAVE_NEON
+    memset(freq, 0, sizeof(freq));
+    count_frequency_runs_neon(msg, len, freq, sub);
+    fuzz_check(memcmp(freq, ref, sizeof(freq)) == 0, "count_frequency_runs_neon");
+#endif
+
+    CodeEntry codes[ALPHABET_SIZE], sorted[ALPHABET_SIZE];
+    int K = 0;
+    for (int c = 0; c < ALPHABET_SIZE; c++) {
+        if (freq[c]) {
+            codes[K].symbol = (uint8_t)c;
+            codes[K].freq = freq[c];
+            K++;
+        }
+    }
+    memcpy(sorted, codes, sizeof(CodeEntry) * (size_t)K);
+    rank_codes(codes, K);
+    qsort(sorted, (size_t)K, sizeof(CodeEntry), compare_codeentry);
+    for (int i = 0; i < K; i++) {
+        fuzz_check(codes[i].symbol == sorted[i].symbol, "radix ranking");
+    }
+}
+
+// ------------------------------------------------------------
+// Plain-payload backends
+// ------------------------------------------------------------
+
+// The baseline decoder: one bit at a time, then (m, j) -> cycle_rank.
+// Same statuses as the library: a (m, j) outside the K codes is
+// CBC_ERR_CORRUPT, running out of payload before n symbols is
+// CBC_ERR_TRUNCATED.
+static int reference_plain(const uint8_t *frame, size_t size, size_t n,
+                           uint8_t *out, size_t *out_len) {
+    *out_len = 0;
+    if (size == 0) return n == 0 ? CBC_OK : CBC_ERR_TRUNCATED;
+    int K = frame[0];
+    if (K == 0 || size < 1 + (size_t)K) return CBC_ERR_CORRUPT;
+    const uint8_t *symbols = frame + 1;
+    const uint8_t *payload = frame + 1 + K;
+    size_t bits = (size - (1 + (size_t)K)) * 8;
+    size_t bit = 0;
+
+    while (*out_len < n) {
+        int m = 0, j = 0;
+        while (bit < bits && !((payload[bit / 8] >> (7 - bit % 8)) & 1)) {
+            if (m <= MAX_CODE_LENGTH) m++;
+            bit++;
+        }
+        if (bit == bits) return CBC_ERR_TRUNCATED;
+        while (bit < bits && ((payload[bit / 8] >> (7 - bit % 8)) & 1)) {
+            if (j <= MAX_CODE_LENGTH) j++;
+            bit++;
+        }
+        int rank = cycle_rank(m, j);
+        if (rank < 0 || rank >= K) return CBC_ERR_CORRUPT;
+        out[(*out_len)++] = symbols[rank];
+    }
+    return CBC_OK;
+}
+
+// n symbols of a plain frame through cbc_decompress (the build's backend),
+// the clz window decoder and decompress_cycle_based; each must return the
+// status, count and bytes of reference_plain, and a complete decode must
+// be msg when it is given
+static void diff_plain(const uint8_t *frame, size_t size, size_t n,
+                       const uint8_t *msg) {
+    uint8_t *ref = fuzz_alloc(n);
+    uint8_t *a = fuzz_alloc(n);
+    size_t ref_len = 0, a_len = 0;
+    int a_status = cbc_decompress(frame, size, n, a, &a_len);
+    fuzz_check(a_len <= n, "cbc_decompress past original_len");
+
+    // First byte 0 is the raw / bounded extension, not a plain table
+    if (size > 0 && frame[0] != 0) {
+        int K = frame[0];
+        int ref_status = reference_plain(frame, size, n, ref, &ref_len);
+        fuzz_check(a_status == ref_status, "cbc_decompress and reference: status");
+        fuzz_check(a_len == ref_len, "cbc_decompress and reference: count");
+        fuzz_check(same_bytes(a, ref, a_len), "cbc_decompress and reference: bytes");
+
+        size_t b_len = 0;
+        int b_status = CBC_ERR_CORRUPT;
+        if (size >= 1 + (size_t)K) {
+            b_status = decode_window(frame + 1, K, MAX_CODE_LENGTH, 0,
+                                     frame + 1 + K, size - (1 + (size_t)K),
+                                     0, 0, n, a, &b_len);
+        }
+        fuzz_check(b_status == ref_status, "clz backend and reference: status");
+        fuzz_check(b_len == ref_len, "clz backend and reference: count");
+        fuzz_check(same_bytes(a, ref, b_len), "clz backend and reference: bytes");
+
+        if (size <= INT_MAX && n < INT_MAX) {
+            char *text = (char *)fuzz_alloc(n + 1);
+            int c_status = decompress_cycle_based(frame, (int)size, (int)n, text);
+            fuzz_check(c_status == ref_status, "decompress_cycle_based and reference: status");
+            // The NUL after what it decoded stands for the count
+            fuzz_check(same_bytes((const uint8_t *)text, ref, ref_len) && text[ref_len] == '\0',
+                       "decompress_cycle_based and reference: count or bytes");
+            free(text);
+        }
+    }
+    if (a_status == CBC_OK) {
+        fuzz_check(a_len == n, "CBC_OK short of original_len");
+        if (msg) fuzz_check(same_bytes(a, msg, n), "plain frame decodes to other bytes");
+    }
+    free(ref);
+    free(a);
+}
+
+// The frame cut short, with an all-zero tail and with one bit flipped
+static void diff_damaged(const uint8_t *frame, size_t size, size_t n,
+                         uint32_t r) {
+    if (size < 2) return;
+    uint8_t *copy = fuzz_alloc(size);
+
+    diff_plain(frame, 1 + r % (size - 1), n, NULL);
+    diff_plain(frame, size - 1, n, NULL);
+
+    size_t zero_from = 1 + (r >> 8) % (size - 1);
+    memcpy(copy, frame, size);
+    memset(copy + zero_from, 0, size - zero_from);
+    diff_plain(copy, size, n, NULL);
+
+    size_t bit = (r >> 12) % (size * 8);
+    memcpy(copy, frame, size);
+    copy[bit / 8] ^= (uint8_t)(0x80 >> (bit % 8));
+    diff_plain(copy, size, n, NULL);
+
+    // More symbols asked for than the payload holds
+    diff_plain(frame, size, n + 1 + (r & 7), NULL);
+    free(copy);
+}
+
+// ------------------------------------------------------------
+// Round trips
+// ------------------------------------------------------------
+
+static void check_plain(const uint8_t *msg, size_t len, uint32_t r) {
+    size_t cap = cbc_max_compressed_size(len, ALPHABET_SIZE);
+    uint8_t *frame = fuzz_alloc(cap);
+    size_t written = 0;
+    int status = cbc_compress_into(msg, len, frame, cap, &written);
+
+    size_t estimate = 0;
+    int est_status = cbc_estimate_size(NULL, msg, len, CBC_EST_PLAIN, 0, &estimate);
+    fuzz_check(est_status == status, "estimate status (plain)");
+
+    int distinct = 0;
+    int seen[ALPHABET_SIZE] = {0};
+    for (size_t i = 0; i < len; i++) distinct += !seen[msg[i]]++;
+    if (distinct == ALPHABET_SIZE) {
+        fuzz_check(status == CBC_ERR_SYMBOLS, "256 symbols in a plain frame");
+        free(frame);
+        return;
+    }
+    fuzz_check(status == CBC_OK, "cbc_compress_into");
+    fuzz_check(estimate == written, "estimate size (plain)");
+
+    uint8_t *heap = NULL;
+    size_t heap_size = 0;
+    fuzz_check(cbc_compress(msg, len, &heap, &heap_size) == CBC_OK, "cbc_compress");
+    fuzz_check(heap_size == written && same_bytes(heap, frame, written),
+               "cbc_compress and cbc_compress_into differ");
+    free(heap);
+
+    diff_plain(frame, written, len, msg);
+    diff_damaged(frame, written, len, r);
+    free(frame);
+}
+
+// The string API on the message up to its first NUL
+static void check_string_api(const uint8_t *msg, size_t len) {
+    const uint8_t *nul = (const uint8_t *)memchr(msg, 0, len);
+    size_t n = nul ? (size_t)(nul - msg) : len;
+    if (n > INT_MAX / 2) return;
+    char *text = (char *)fuzz_alloc(n + 1);
+    memcpy(text, msg, n);
+    text[n] = '\0';
+
+    unsigned char *comp = NULL;
+    int comp_size = 0;
+    cbc_compress_info info;
+    fuzz_check(compress_cycle_based(text, &comp, &comp_size, &info) == CBC_OK,
+               "compress_cycle_based");
+    fuzz_check(info.total_bytes == (size_t)comp_size, "cbc_compress_info size");
+
+    size_t cap = cbc_max_compressed_size(n, ALPHABET_SIZE);
+    uint8_t *frame = fuzz_alloc(cap);
+    size_t written = 0;
+    fuzz_check(cbc_compress_into((const uint8_t *)text, n, frame, cap, &written) == CBC_OK,
+               "cbc_compress_into (text)");
+    fuzz_check(written == (size_t)comp_size && same_bytes(frame, comp, written),
+               "compress_cycle_based and cbc_compress_into differ");
+
+    char *out = (char *)fuzz_alloc(n + 1);
+    fuzz_check(decompress_cycle_based(comp, comp_size, (int)n, out) == CBC_OK &&
+               strcmp(out, text) == 0, "decompress_cycle_based round trip");
+    fuzz_check(decompress_cycle_based_table(comp, comp_size, (int)n, out) == CBC_OK &&
+               strcmp(out, text) == 0, "decompress_cycle_based_table round trip");
+
+    free(out);
+    free(frame);
+    free(comp);
+    free(text);
+}
+
+static void check_framed(const uint8_t *msg, size_t len) {
+    size_t cap = cbc_max_framed_size(len, ALPHABET_SIZE);
+    uint8_t *frame = fuzz_alloc(cap);
+    size_t written = 0, estimate = 0;
+    int status = cbc_compress_framed_into(msg, len, frame, cap, &written);
+    fuzz_check(cbc_estimate_size(NULL, msg, len, CBC_EST_FRAMED, 0, &estimate) == status,
+               "estimate status (framed)");
+    if (status == CBC_OK) {
+        fuzz_check(estimate == written, "estimate size (framed)");
+        size_t n = 0, out_len = 0;
+        fuzz_check(cbc_framed_length(frame, written, &n) == CBC_OK && n == len,
+                   "cbc_framed_length");
+        uint8_t *out = fuzz_alloc(len);
+        fuzz_check(cbc_decompress_framed(frame, written, out, len, &out_len) == CBC_OK &&
+                   out_len == len && same_bytes(out, msg, len), "framed round trip");
+        free(out);
+    }
+    free(frame);
+}
+
+static void check_bounded(const uint8_t *msg, size_t len, int max_len) {
+    size_t cap = cbc_max_bounded_size(len);
+    uint8_t *frame = fuzz_alloc(cap);
+    size_t written = 0, estimate = 0, out_len = 0;
+    fuzz_check(cbc_compress_bounded_into(msg, len, max_len, frame, cap, &written) == CBC_OK,
+               "cbc_compress_bounded_into");
+    fuzz_check(written <= len + 2, "bounded frame over len + 2");
+    fuzz_check(cbc_estimate_size(NULL, msg, len, CBC_EST_BOUNDED, max_len, &estimate) ==
+               CBC_OK && estimate == written, "estimate (bounded)");
+    uint8_t *out = fuzz_alloc(len);
+    fuzz_check(cbc_decompress(frame, written, len, out, &out_len) == CBC_OK &&
+               out_len == len && same_bytes(out, msg, len), "bounded round trip");
+    free(out);
+    free(frame);
+}
+
+// A container frame against the message, whole and one range of it
+static void check_container_frame(const uint8_t *frame, size_t size,
+                                  const uint8_t *msg, size_t len, uint32_t r,
+                                  const char *what) {
+    uint8_t *out = fuzz_alloc(len);
+    size_t out_len = 0;
+    int status = cbc_decompress_container(NULL, frame, size, out, len, &out_len);
+    if (status != CBC_OK || out_len != len || !same_bytes(out, msg, len)) {
+        fuzz_fail(what, __LINE__);
+    }
+    fuzz_checks++;
+
+    size_t offset = len ? r % (len + 1) : 0;
+    size_t count = (r >> 16) % (len - offset + 1);
+    status = cbc_decompress_range(NULL, frame, size, offset, count, out, &out_len);
+    if (status != CBC_OK || out_len != count || !same_bytes(out, msg + offset, count)) {
+        fuzz_fail(what, __LINE__);
+    }
+    fuzz_checks++;
+    free(out);
+}
+
+static void check_containers(const uint8_t *msg, size_t len, int max_len,
+                             uint32_t r) {
+    size_t cap = cbc_max_container_size(len);
+    uint8_t *frame = fuzz_alloc(cap);
+    size_t written = 0, estimate = 0;
+
+    fuzz_check(cbc_compress_container_into(msg, len, max_len, frame, cap, &written) ==
+               CBC_OK, "cbc_compress_container_into");
+    fuzz_check(cbc_estimate_size(NULL, msg, len, CBC_EST_CONTAINER, max_len, &estimate) ==
+               CBC_OK && estimate == written, "estimate (container)");
+    check_container_frame(frame, written, msg, len, r, "container round trip");
+    size_t plain_size = written;
+
+    fuzz_check(cbc_compress_container_pairs_into(msg, len, max_len, frame, cap, &written) ==
+               CBC_OK, "cbc_compress_container_pairs_into");
+    fuzz_check(written <= plain_size, "byte-pair frame larger than the container");
+    check_container_frame(frame, written, msg, len, r, "byte-pair round trip");
+    free(frame);
+
+    size_t interval = 1 + r % 64;
+    size_t block = interval * (1 + (r >> 6) % 8);
+    cap = cbc_max_indexed_size(len, interval, block);
+    frame = fuzz_alloc(cap);
+    fuzz_check(cbc_compress_indexed_into(msg, len, interval, block, frame, cap, &written) ==
+               CBC_OK, "cbc_compress_indexed_into");
+    check_container_frame(frame, written, msg, len, r >> 3, "indexed round trip");
+    free(frame);
+}
+
+// A dictionary trained on the message, cut to K symbols so that some
+// bytes may have no code. The plain and container dictionary frames:
+// a size probe, cbc_estimate_size and a buffer one byte short must all
+// report the size of the frame.
+static void check_dict(const uint8_t *msg, size_t len, uint32_t r) {
+    static cbc_dict trained, dict;
+    fuzz_check(cbc_dict_train(&trained, 7, &msg, &len, 1) == CBC_OK, "cbc_dict_train");
+    int K = r & 1 ? ALPHABET_SIZE : 1 + (int)((r >> 1) % ALPHABET_SIZE);
+    fuzz_check(cbc_dict_load(&dict, 7, trained.symbols, K) == CBC_OK, "cbc_dict_load");
+
+    size_t cap = cbc_max_container_dict_size(&dict, len);
+    uint8_t *frame = fuzz_alloc(cap);
+    uint8_t *out = fuzz_alloc(len);
+    for (int container = 0; container < 2; container++) {
+        int (*encode)(const cbc_dict *, const uint8_t *, size_t, uint8_t *, size_t,
+                      size_t *) = container ? cbc_compress_container_dict_into
+                                            : cbc_compress_dict_into;
+        size_t written = 0, probe = 0, estimate = 0, out_len = 0;
+        int status = encode(&dict, msg, len, frame, cap, &written);
+        int probe_status = encode(&dict, msg, len, NULL, 0, &probe);
+        int est_status = cbc_estimate_size(&dict, msg, len,
+                                           container ? CBC_EST_CONTAINER_DICT : CBC_EST_DICT,
+                                           0, &estimate);
+        if (status != CBC_OK) {
+            fuzz_check(status == CBC_ERR_SYMBOLS && probe_status == status &&
+                       est_status == status, "dictionary status");
+            continue;
+        }
+        fuzz_check(written <= cap, "dictionary frame past its bound");
+        fuzz_check(probe_status == (written ? CBC_ERR_OVERFLOW : CBC_OK) && probe == written,
+                   "dictionary size probe");
+        fuzz_check(est_status == CBC_OK && estimate == written, "estimate (dictionary)");
+        if (written > 0) {
+            size_t short_size = 0;
+            fuzz_check(encode(&dict, msg, len, frame, written - 1, &short_size) ==
+                       CBC_ERR_OVERFLOW && short_size == written,
+                       "dictionary size on overflow");
+            encode(&dict, msg, len, frame, cap, &written);
+        }
+        status = container
+            ? cbc_decompress_container(&dict, frame, written, out, len, &out_len)
+            : cbc_decompress_dict(&dict, frame, written, len, out, &out_len);
+        fuzz_check(status == CBC_OK && out_len == len && same_bytes(out, msg, len),
+                   "dictionary round trip");
+    }
+    free(out);
+    free(frame);
+}
+
+// Encoder and decoder sessions live across inputs, like two ends of a link
+static cbc_session fuzz_enc_session, fuzz_dec_session;
+
+static void check_session(const uint8_t *msg, size_t len, int cached) {
+    size_t cap = cbc_max_session_size(len);
+    uint8_t *frame = fuzz_alloc(cap);
+    uint8_t *out = fuzz_alloc(len);
+    size_t written = 0, out_len = 0;
+    int status = cached
+        ? cbc_session_compress_cached(&fuzz_enc_session, msg, len, frame, cap, &written)
+        : cbc_session_compress(&fuzz_enc_session, msg, len, frame, cap, &written);
+    if (status == CBC_OK) {
+        status = cbc_session_decompress(&fuzz_dec_session, frame, written, len, out, &out_len);
+        fuzz_check(status == CBC_OK && out_len == len && same_bytes(out, msg, len),
+                   "session round trip");
+    } else {
+        // 256 symbols; both ends start over, as after a lost frame
+        cbc_session_init(&fuzz_enc_session);
+        cbc_session_init(&fuzz_dec_session);
+    }
+    free(out);
+    free(frame);
+}
+
+// Growing buffer behind a stream's sink
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} fuzz_sink;
+
+static int fuzz_sink_write(void *user, const uint8_t *data, size_t len) {
+    fuzz_sink *k = (fuzz_sink *)user;
+    if (k->cap - k->len < len) {
+        size_t cap = k->cap * 2 > k->len + len ? k->cap * 2 : k->len + len;
+        uint8_t *grown = (uint8_t *)realloc(k->data, cap ? cap : 1);
+        if (!grown) abort();
+        k->data = grown;
+        k->cap = cap;
+    }
+    memcpy(k->data + k->len, data, len);
+    k->len += len;
+    return 0;
+}
+
+// The message through a stream encoder and decoder, both fed in pieces of
+// up to step bytes
+static void check_stream(const uint8_t *msg, size_t len, size_t block_size,
+                         size_t step) {
+    fuzz_sink enc = {NULL, 0, 0}, dec = {NULL, 0, 0};
+    cbc_stream st;
+    int status = cbc_stream_init(&st, block_size, fuzz_sink_write, &enc);
+    fuzz_check(status == CBC_OK, "cbc_stream_init");
+    for (size_t i = 0; i < len && status == CBC_OK; i += step) {
+        status = cbc_stream_update(&st, msg + i, len - i < step ? len - i : step);
+    }
+    if (status == CBC_OK) status = cbc_stream_finish(&st);
+    cbc_stream_free(&st);
+    fuzz_check(status == CBC_OK, "stream encode");
+
+    cbc_stream_decoder sd;
+    status = cbc_stream_decoder_init(&sd, block_size, fuzz_sink_write, &dec);
+    fuzz_check(status == CBC_OK, "cbc_stream_decoder_init");
+    for (size_t i = 0; i < enc.len && status == CBC_OK; i += step) {
+        status = cbc_stream_decoder_update(&sd, enc.data + i,
+                                           enc.len - i < step ? enc.len - i : step);
+    }
+    if (status == CBC_OK) status = cbc_stream_decoder_finish(&sd);
+    cbc_stream_decoder_free(&sd);
+    fuzz_check(status == CBC_OK && dec.len == len && same_bytes(dec.data, msg, len),
+               "stream round trip");
+    free(enc.data);
+    free(dec.data);
+}
+
+// Contexts also live across inputs, so every check runs on tables left
+// behind by the previous message: one grown from a counting allocator,
+// one static in an arena sized for FUZZ_CTX_STATIC_MSG bytes
+#define FUZZ_CTX_STATIC_MSG 256
+
+static cbc_ctx *fuzz_heap_ctx, *fuzz_static_ctx;
+static unsigned long fuzz_ctx_allocs;
+
+static void *fuzz_ctx_alloc(void *user, size_t size) {
+    (void)user;
+    fuzz_ctx_allocs++;
+    return malloc(size);
+}
+
+static void fuzz_ctx_free(void *user, void *ptr) {
+    (void)user;
+    free(ptr);
+}
+
+// The context's frame of each encoder must equal the stateless one
+static void check_ctx_encoders(cbc_ctx *ctx, const uint8_t *msg, size_t len,
+                               int max_len, int fits) {
+    size_t cap = cbc_max_container_size(len) + cbc_max_compressed_size(len, 255) +
+                 cbc_max_framed_size(len, 255);
+    uint8_t *want = fuzz_alloc(cap);
+    uint8_t *got = fuzz_alloc(cap);
+    size_t want_size = 0, got_size = 0;
+    int want_status, status;
+
+#define FUZZ_CTX_SAME(call, ctx_call, what)                                  \
+    do {                                                                     \
+        want_status = call;                                                  \
+        status = ctx_call;                                                   \
+        fuzz_check(status == want_status && got_size == want_size &&         \
+                   (status != CBC_OK || same_bytes(got, want, got_size)), what); \
+    } while (0)
+
+    FUZZ_CTX_SAME(cbc_compress_into(msg, len, want, cap, &want_size),
+                  cbc_ctx_compress_into(ctx, msg, len, got, cap, &got_size),
+                  "cbc_ctx_compress_into");
+    FUZZ_CTX_SAME(cbc_compress_framed_into(msg, len, want, cap, &want_size),
+                  cbc_ctx_compress_framed_into(ctx, msg, len, got, cap, &got_size),
+                  "cbc_ctx_compress_framed_into");
+    FUZZ_CTX_SAME(cbc_compress_bounded_into(msg, len, max_len, want, cap, &want_size),
+                  cbc_ctx_compress_bounded_into(ctx, msg, len, max_len, got, cap,
+                                                &got_size),
+                  "cbc_ctx_compress_bounded_into");
+    FUZZ_CTX_SAME(cbc_compress_container_into(msg, len, max_len, want, cap, &want_size),
+                  cbc_ctx_compress_container_into(ctx, msg, len, max_len, got, cap,
+                                                  &got_size),
+                  "cbc_ctx_compress_container_into");
+    size_t container_size = want_size;
+
+    want_status = cbc_compress_container_pairs_into(msg, len, max_len, want, cap,
+                                                    &want_size);
+    status = cbc_ctx_compress_container_pairs_into(ctx, msg, len, max_len, got, cap,
+                                                   &got_size);
+    if (fits || len < 2 * CBC_PAIRS_MIN_COUNT) {
+        fuzz_check(status == want_status && got_size == want_size &&
+                   same_bytes(got, want, got_size), "cbc_ctx_compress_container_pairs_into");
+    } else {
+        fuzz_check(status == CBC_ERR_NOMEM, "static context pairs past max_msg");
+    }
+
+    // Sessions start from the shared encoder's state and must stay equal
+    cbc_session want_s = fuzz_enc_session, got_s = fuzz_enc_session;
+    FUZZ_CTX_SAME(cbc_session_compress(&want_s, msg, len, want, cap, &want_size),
+                  cbc_ctx_session_compress(ctx, &got_s, msg, len, got, cap, &got_size),
+                  "cbc_ctx_session_compress");
+    fuzz_check(memcmp(&want_s, &got_s, sizeof(want_s)) == 0, "cbc_ctx_session_compress state");
+    FUZZ_CTX_SAME(cbc_session_compress_cached(&want_s, msg, len, want, cap, &want_size),
+                  cbc_ctx_session_compress_cached(ctx, &got_s, msg, len, got, cap,
+                                                  &got_size),
+                  "cbc_ctx_session_compress_cached");
+    fuzz_check(memcmp(&want_s, &got_s, sizeof(want_s)) == 0,
+               "cbc_ctx_session_compress_cached state");
+
+    // The message as up to four batch records
+    cbc_msg msgs[4];
+    size_t n = len < 4 ? len : 4;
+    for (size_t i = 0, at = 0; i < n; i++) {
+        msgs[i].data = msg + at;
+        msgs[i].len = i + 1 < n ? len / n : len - at;
+        at += msgs[i].len;
+    }
+    size_t want_offsets[5], got_offsets[5];
+    size_t arena_cap = cbc_max_batch_size(msgs, n);
+    uint8_t *want_arena = fuzz_alloc(arena_cap);
+    uint8_t *got_arena = fuzz_alloc(arena_cap);
+    want_status = cbc_compress_batch(msgs, n, want_arena, arena_cap, want_offsets);
+    status = cbc_ctx_compress_batch(ctx, msgs, n, got_arena, arena_cap, got_offsets);
+    fuzz_check(status == want_status, "cbc_ctx_compress_batch status");
+    if (status == CBC_OK) {
+        fuzz_check(memcmp(got_offsets, want_offsets, (n + 1) * sizeof(size_t)) == 0 &&
+                   same_bytes(got_arena, want_arena, got_offsets[n]),
+                   "cbc_ctx_compress_batch");
+    }
+    free(got_arena);
+    free(want_arena);
+#undef FUZZ_CTX_SAME
+
+    size_t interval = 1 + len % 64;
+    size_t block = interval * (1 + len % 5);
+    size_t index_cap = cbc_max_indexed_size(len, interval, block);
+    uint8_t *want_index = fuzz_alloc(index_cap);
+    uint8_t *got_index = fuzz_alloc(index_cap);
+    want_status = cbc_compress_indexed_into(msg, len, interval, block, want_index,
+                                            index_cap, &want_size);
+    status = cbc_ctx_compress_indexed_into(ctx, msg, len, interval, block, got_index,
+                                           index_cap, &got_size);
+    fuzz_check(status == want_status && got_size == want_size &&
+               same_bytes(got_index, want_index, got_size), "cbc_ctx_compress_indexed_into");
+    free(got_index);
+    free(want_index);
+
+    // Same container frame, in the context's buffer
+    const uint8_t *frame = NULL;
+    size_t size = 0;
+    status = cbc_ctx_compress(ctx, msg, len, max_len, &frame, &size);
+    if (fits) {
+        cbc_compress_container_into(msg, len, max_len, want, cap, &want_size);
+        fuzz_check(status == CBC_OK && size == container_size &&
+                   same_bytes(frame, want, size), "cbc_ctx_compress");
+    } else {
+        fuzz_check(status == CBC_ERR_NOMEM && !frame, "static context past max_msg");
+    }
+    free(got);
+    free(want);
+}
+
+static void check_ctx(const uint8_t *msg, size_t len, int max_len) {
+    if (!fuzz_heap_ctx) {
+        static const cbc_allocator counting = {fuzz_ctx_alloc, fuzz_ctx_free, NULL};
+        static uint8_t arena[128 * 1024];
+        fuzz_heap_ctx = cbc_ctx_create(&counting, 16, 0);
+        fuzz_static_ctx = cbc_ctx_init_static(arena + 1, sizeof(arena) - 1,
+                                              FUZZ_CTX_STATIC_MSG, CBC_CTX_PAIRS);
+        fuzz_check(fuzz_heap_ctx && fuzz_static_ctx, "context setup");
+        fuzz_check(cbc_ctx_size(FUZZ_CTX_STATIC_MSG, CBC_CTX_PAIRS) <= sizeof(arena) - 1,
+                   "cbc_ctx_size");
+    }
+
+    unsigned long allocs = fuzz_ctx_allocs;
+    check_ctx_encoders(fuzz_heap_ctx, msg, len, max_len, 1);
+    fuzz_check(fuzz_ctx_allocs - allocs <= 1, "context allocated more than once per message");
+    allocs = fuzz_ctx_allocs;
+    check_ctx_encoders(fuzz_heap_ctx, msg, len, max_len, 1);
+    fuzz_check(fuzz_ctx_allocs == allocs, "context allocated for a message that fits");
+
+    check_ctx_encoders(fuzz_static_ctx, msg, len, max_len, len <= FUZZ_CTX_STATIC_MSG);
+}
+
+// ------------------------------------------------------------
+// The input as a frame
+// ------------------------------------------------------------
+
+// No decoder may crash or write past its output on arbitrary bytes
+static void check_as_frame(const uint8_t *data, size_t size, uint32_t r) {
+    size_t n = r % (4 * size + 16);
+    uint8_t *out = fuzz_alloc(n);
+    size_t out_len = 0;
+
+    diff_plain(data, size, n, NULL);
+    cbc_decompress_framed(data, size, out, n, &out_len);
+    fuzz_check(out_len <= n, "cbc_decompress_framed past out_cap");
+    cbc_decompress_container(NULL, data, size, out, n, &out_len);
+    fuzz_check(out_len <= n, "cbc_decompress_container past out_cap");
+
+    cbc_container c;
+    if (cbc_container_parse(data, size, &c) == CBC_OK && c.original_len < ((size_t)1 << 24)) {
+        size_t len = c.original_len;
+        uint8_t *whole = fuzz_alloc(len);
+        uint8_t *part = fuzz_alloc(len);
+        size_t whole_len = 0, part_len = 0;
+        int status = cbc_decompress_container(NULL, data, size, whole, len, &whole_len);
+        size_t offset = len ? (r >> 8) % (len + 1) : 0;
+        size_t count = (r >> 16) % (len - offset + 1);
+        int range_status = cbc_decompress_range(NULL, data, size, offset, count,
+                                                part, &part_len);
+        fuzz_check(part_len <= count, "cbc_decompress_range past count");
+        if (status == CBC_OK && range_status == CBC_OK) {
+            fuzz_check(part_len == count && same_bytes(part, whole + offset, count),
+                       "range and whole decode differ");
+        }
+        free(part);
+        free(whole);
+    } else if (cbc_container_parse(data, size, &c) == CBC_OK) {
+        // Too long to decode whole, but a short slice anywhere in it must
+        // still be bounds-checked against the header
+        size_t count = r % 17;
+        size_t offset = ((size_t)r << 24) % (c.original_len - count);
+        uint8_t *part = fuzz_alloc(count);
+        size_t part_len = 0;
+        cbc_decompress_range(NULL, data, size, offset, count, part, &part_len);
+        fuzz_check(part_len <= count, "cbc_decompress_range past count");
+        free(part);
+    }
+
+    cbc_session s;
+    cbc_session_init(&s);
+    cbc_session_decompress(&s, data, size, n, out, &out_len);
+    fuzz_check(out_len <= n, "cbc_session_decompress past original_len");
+    free(out);
+}
+
+// ------------------------------------------------------------
+// Regressions
+// ------------------------------------------------------------
+
+static const char *fuzz_text = "In wireless sensor networks, the energy cost of transmitting a single byte is often far higher than the cost of executing hundreds or even thousands of local instructions. {\"id\":17,\"temp\":21.5,\"ok\":true}\n3,-12.07,40961\n";
+
+// Indexed frame with original_len = 2^64 - 1 and interval 2, whose
+// segment count used to wrap to 0 and pass the index bound
+static const uint8_t fuzz_wrapped_index[] = {
+    CBC_CONTAINER_MAGIC, CBC_CONTAINER_VERSION << 4 | CBC_CF_INDEXED,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01,
+    0x03, 0x02, 0x01, 'a', 0x40};
+
+static void check_regressions(void) {
+    uint8_t *frame = fuzz_alloc(sizeof(fuzz_wrapped_index));
+    memcpy(frame, fuzz_wrapped_index, sizeof(fuzz_wrapped_index));
+    cbc_container c;
+    if (cbc_container_parse(frame, sizeof(fuzz_wrapped_index), &c) == CBC_OK) {
+        uint8_t out[1];
+        size_t out_len = 0;
+        int status = cbc_decompress_range(NULL, frame, sizeof(fuzz_wrapped_index),
+                                          (size_t)1 << 40, 1, out, &out_len);
+        fuzz_check(status == CBC_ERR_CORRUPT && out_len == 0,
+                   "indexed frame with a wrapped segment count");
+        check_as_frame(frame, sizeof(fuzz_wrapped_index), 0);
+    }
+    free(frame);
+
+    // A block of all 256 byte values used to fail the stream for good;
+    // it is stored raw and the text after it still goes through a table
+    size_t text_len = strlen(fuzz_text);
+    uint8_t *msg = fuzz_alloc(256 + text_len);
+    for (int i = 0; i < 256; i++) msg[i] = (uint8_t)i;
+    memcpy(msg + 256, fuzz_text, text_len);
+    check_stream(msg, 256 + text_len, 256, 100);
+    free(msg);
+}
+
+// ------------------------------------------------------------
+// Target
+// ------------------------------------------------------------
+
+static void fuzz_one(const uint8_t *data, size_t size) {
+    static int sessions_ready = 0;
+    if (!sessions_ready) {
+        cbc_session_init(&fuzz_enc_session);
+        cbc_session_init(&fuzz_dec_session);
+        sessions_ready = 1;
+        fuzz_input = fuzz_wrapped_index;
+        fuzz_input_size = sizeof(fuzz_wrapped_index);
+        check_regressions();
+    }
+    fuzz_input = data;
+    fuzz_input_size = size;
+
+    // Parameters from the first byte and a hash of the input
+    uint32_t r = 2166136261u;
+    for (size_t i = 0; i < size; i++) r = (r ^ data[i]) * 16777619u;
+    int param = size ? data[0] : 0;
+    int max_len = 2 + param % (MAX_CODE_LENGTH - 1);
+    const uint8_t *msg = size ? data + 1 : data;
+    size_t len = size ? size - 1 : 0;
+
+    check_kernels(msg, len);
+    check_plain(msg, len, r);
+    check_string_api(msg, len);
+    check_framed(msg, len);
+    check_bounded(msg, len, max_len);
+    check_containers(msg, len, param & 0x80 ? 0 : max_len, r);
+    check_dict(msg, len, r);
+    check_session(msg, len, param & 0x40);
+    check_ctx(msg, len, param & 0x80 ? 0 : max_len);
+    check_stream(msg, len, 1 + (r >> 4) % 512, 1 + (r >> 13) % 700);
+    check_as_frame(data, size, r);
+}
+
+#ifdef CBC_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    fuzz_one(data, size);
+    return 0;
+}
+
+#else
+
+// ------------------------------------------------------------
+// Standalone driver
+// ------------------------------------------------------------
+
+static uint64_t fuzz_rng;
+
+static uint32_t fuzz_next(void) {
+    // xorshift64*
+    fuzz_rng ^= fuzz_rng >> 12;
+    fuzz_rng ^= fuzz_rng << 25;
+    fuzz_rng ^= fuzz_rng >> 27;
+    return (uint32_t)((fuzz_rng * 2685821657736338717ull) >> 32);
+}
+
+#define GEN_KINDS 9
+
+static const char *gen_names[GEN_KINDS] = {
+    "random", "alphabet", "k255", "k256", "one-symbol", "empty", "skewed",
+    "text", "frame"};
+
+// Fills msg (room for max bytes) with a case of the given kind
+static size_t gen_message(int kind, uint8_t *msg, size_t max) {
+    size_t len = max ? fuzz_next() % (max + 1) : 0;
+    switch (kind) {
+    case 0:  // uniform bytes
+        for (size_t i = 0; i < len; i++) msg[i] = (uint8_t)fuzz_next();
+        break;
+    case 1: {  // a random alphabet of 1..255 bytes
+        uint8_t alphabet[255];
+        int A = 1 + (int)(fuzz_next() % 255);
+        for (int i = 0; i < A; i++) alphabet[i] = (uint8_t)fuzz_next();
+        for (size_t i = 0; i < len; i++) msg[i] = alphabet[fuzz_next() % (uint32_t)A];
+        break;
+    }
+    case 2:  // every byte value but one: the largest plain table
+    case 3: {  // all 256 byte values
+        int missing = kind == 2 ? (int)(fuzz_next() % 256) : -1;
+        size_t n = 0;
+        for (int c = 0; c < ALPHABET_SIZE && n < max; c++) {
+            if (c != missing) msg[n++] = (uint8_t)c;
+        }
+        if (len < n) len = n;
+        for (size_t i = n; i < len; i++) {
+            uint8_t c = (uint8_t)fuzz_next();
+            msg[i] = (int)c == missing ? (uint8_t)(c + 1) : c;
+        }
+        for (size_t i = len; i > 1; i--) {
+            size_t j = fuzz_next() % i;
+            uint8_t t = msg[i - 1];
+            msg[i - 1] = msg[j];
+            msg[j] = t;
+        }
+        break;
+    }
+    case 4:  // one symbol repeated
+        memset(msg, (int)(fuzz_next() & 0xFF), len);
+        break;
+    case 5:
+        len = 0;
+        break;
+    case 6:  // geometric ranks: long codes for the tail symbols
+        for (size_t i = 0; i < len; i++) {
+            int rank = 0;
+            while (rank < 255 && (fuzz_next() & 3) != 0) rank++;
+            msg[i] = (uint8_t)(rank * 37);
+        }
+        break;
+    case 7: {  // slices of text
+        size_t n = strlen(fuzz_text);
+        size_t start = fuzz_next() % n;
+        for (size_t i = 0; i < len; i++) msg[i] = (uint8_t)fuzz_text[(start + i) % n];
+        break;
+    }
+    default: {  // a plain frame of a random message, then damaged
+        size_t m = len / 2;
+        uint8_t *tmp = fuzz_alloc(m);
+        for (size_t i = 0; i < m; i++) tmp[i] = (uint8_t)(fuzz_text[i % 40] ^ (fuzz_next() & 1));
+        size_t written = 0;
+        if (cbc_compress_into(tmp, m, msg, max, &written) != CBC_OK) written = 0;
+        free(tmp);
+        len = written;
+        if (len > 1) {
+            switch (fuzz_next() % 3) {
+            case 0: len = 1 + fuzz_next() % (len - 1); break;
+            case 1: memset(msg + len / 2, 0, len - len / 2); break;
+            default: msg[fuzz_next() % len] ^= (uint8_t)(1u << (fuzz_next() % 8)); break;
+            }
+        }
+        break;
+    }
+    }
+    return len;
+}
+
+static double fuzz_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Runs each file given on the command line as one input
+static int replay(int argc, char **argv, int first) {
+    for (int i = first; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if (!f) {
+            fprintf(stderr, "cbc_fuzz: cannot open %s\n", argv[i]);
+            return 1;
+        }
+        size_t cap = 1 << 16, size = 0;
+        uint8_t *buf = fuzz_alloc(cap);
+        size_t got;
+        while ((got = fread(buf + size, 1, cap - size, f)) > 0) {
+            size += got;
+            if (size == cap) {
+                uint8_t *grown = (uint8_t *)realloc(buf, cap * 2);
+                if (!grown) abort();
+                buf = grown;
+                cap *= 2;
+            }
+        }
+        fclose(f);
+        fuzz_one(buf, size);
+        free(buf);
+        printf("%s: ok (%zu bytes)\n", argv[i], size);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    double seconds = FUZZ_DEFAULT_SECONDS;
+    uint64_t seed = (uint64_t)time(NULL);
+    size_t max_len = FUZZ_DEFAULT_MAX_LEN;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--max-len") == 0 && i + 1 < argc) {
+            max_len = (size_t)strtoull(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "usage: %s [--seconds S] [--seed N] [--max-len N] [FILE...]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (i < argc) return replay(argc, argv, i);
+
+#ifdef CBC_DECODER_TABLE
+    const char *backend = "table decoder";
+#else
+    const char *backend = "clz decoder";
+#endif
+    printf("seed %llu, %.0f s, messages up to %zu bytes, %s\n",
+           (unsigned long long)seed, seconds, max_len, backend);
+    fuzz_rng = seed ? seed : 1;
+
+    // One spare byte in front for the parameter
+    uint8_t *input = fuzz_alloc(max_len + 1);
+    unsigned long long cases[GEN_KINDS] = {0};
+    double bytes[GEN_KINDS] = {0};
+    unsigned long long total = 0;
+    double total_bytes = 0;
+    double start = fuzz_seconds(), elapsed = 0;
+    while (elapsed < seconds) {
+        for (int n = 0; n < 64; n++) {
+            int kind = (int)(fuzz_next() % GEN_KINDS);
+            input[0] = (uint8_t)fuzz_next();
+            size_t len = gen_message(kind, input + 1, max_len);
+            fuzz_one(input, len + 1);
+            cases[kind]++;
+            bytes[kind] += (double)len;
+        }
+        total += 64;
+        elapsed = fuzz_seconds() - start;
+    }
+    free(input);
+
+    for (int k = 0; k < GEN_KINDS; k++) total_bytes += bytes[k];
+    printf("%-11s %10s %12s\n", "kind", "cases", "bytes");
+    for (int k = 0; k < GEN_KINDS; k++) {
+        printf("%-11s %10llu %12.0f\n", gen_names[k], cases[k], bytes[k]);
+    }
+    printf("%llu cases, %llu checks in %.1f s: %.0f cases/s, %.2f MB/s of messages\n",
+           total, fuzz_checks, elapsed, total / elapsed, total_bytes / 1e6 / elapsed);
+    return 0;
+}
+
+#endif
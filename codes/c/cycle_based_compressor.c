@@ -5,41 +5,325 @@
 // Basic implementation of the cycle-based compressor (0^m 1^j)
 // with header [K][s1]...[sK] + bit payload.
 
-#include <stdio.h>
+#include "cbc.h"
+
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef CBC_NO_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#endif
+
+#ifdef CBC_STATS
+#include <time.h>
+#endif
+
+// Run-skipping histogram kernels (disable with -DCBC_NO_SIMD)
+#if !defined(CBC_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define CBC_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#if !defined(CBC_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+#define CBC_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Count-leading-zeros intrinsics where the compiler has no __builtin_clzll
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#elif defined(__ICCARM__)
+#include <intrinsics.h>
+#endif
+
+// Plain-payload decoder (override with -DCBC_DECODER_TABLE or
+// -DCBC_DECODER_CLZ). The table decoder resolves a whole byte per lookup
+// but keeps 5 KB of step tables in RAM; the clz decoder finds each run
+// with one count-leading-zeros on a 64-bit window and needs no table.
+// Microcontroller-class targets, where those 5 KB compete for SRAM or
+// cache, default to clz.
+#if !defined(CBC_DECODER_TABLE) && !defined(CBC_DECODER_CLZ)
+#if (defined(__arm__) && !defined(__aarch64__)) || defined(__AVR__) || \
+    defined(__MSP430__) || defined(__XTENSA__) || \
+    (defined(__riscv) && __riscv_xlen == 32)
+#define CBC_DECODER_CLZ 1
+#else
+#define CBC_DECODER_TABLE 1
+#endif
+#endif
+
 // ------------------------------------------------------------
-// Constants
-#define MAX_SIZE_MESSAGE 1024
-#define ALPHABET_SIZE 256   // ASCII
+// Constants (internal)
+#define CBC_MT_TASK_RECORDS 16   // records per work-stealing task
+#define CBC_MT_MAX_THREADS 64
+#define HIST_MULTI_MIN 512       // shortest input for the sub-histogram kernels
+
+#define CBC_VARINT_MAX 10   // bytes of a varint holding 64 bits
+
+// Prefetch hint for the next record of a batch
+#if defined(__GNUC__) || defined(__clang__)
+#define CBC_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define CBC_PREFETCH(p) ((void)(p))
+#endif
 
 // ------------------------------------------------------------
-// Structures
+// Structures (internal)
 
-// Entry in the code table: symbol, frequency, pair (m, j)
+// Buffers the histogram and ranking kernels otherwise keep on the stack
 typedef struct {
-    unsigned char symbol;
-    int freq;
-    int m;
-    int j;
-} CodeEntry;
+    uint32_t sub[4][ALPHABET_SIZE];   // count_frequency sub-histograms
+    CodeEntry rank_tmp[ALPHABET_SIZE];
+    int rank_start[ALPHABET_SIZE + 1];
+} cbc_work;
 
-// Bit writer for the compressed payload
+// Per-message tables, kept clean between messages (freq all zero, every
+// word len 0) so that a batch only rewrites the entries a message touched
 typedef struct {
-    unsigned char *data;
-    int capacity;   // capacity in bytes
-    int size;       // bytes actually used
-    int bit_pos;    // next bit position (0..7) inside the last byte
-} BitWriter;
+    int freq[ALPHABET_SIZE];
+    CodeEntry codes[ALPHABET_SIZE];
+    CodeWord words[ALPHABET_SIZE];
+    cbc_work *work;   // a cbc_ctx's buffers, NULL to use the stack
+} cbc_scratch;
+
+// ------------------------------------------------------------
+// Instrumentation
+//
+// With CBC_STATS every thread counts into a slot of its own, found
+// through a thread-local pointer and written only by that thread: no lock
+// and no atomic read-modify-write on the hot path. Owners store and
+// cbc_stats_collect loads the counters with relaxed atomics, so
+// collecting while other threads work is race-free. A thread that exits
+// frees up its slot, counts included, for the next new thread, so
+// short-lived pool workers neither lose counts nor grow the slot list.
+// Without CBC_STATS every hook below compiles to nothing.
+// ------------------------------------------------------------
+
+#ifdef CBC_STATS
+
+typedef struct cbc_stats_slot {
+    cbc_stats stats;
+    int owned;                     // by a live thread
+    struct cbc_stats_slot *next;
+} cbc_stats_slot;
+
+static cbc_trace_fn stats_trace;
+static void *stats_trace_user;
+
+#ifndef CBC_NO_THREADS
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;    // runs stats_release at thread exit
+static cbc_stats_slot *stats_slots;
+static _Thread_local cbc_stats_slot *stats_self;
+
+static void stats_release(void *slot) {
+    pthread_mutex_lock(&stats_lock);
+    ((cbc_stats_slot *)slot)->owned = 0;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void stats_key_init(void) {
+    pthread_key_create(&stats_key, stats_release);
+}
+
+// The calling thread's counters, claimed on first use; NULL only if no
+// slot could be allocated
+static cbc_stats *stats_local(void) {
+    if (stats_self) return &stats_self->stats;
+    pthread_once(&stats_once, stats_key_init);
+    pthread_mutex_lock(&stats_lock);
+    cbc_stats_slot *slot = stats_slots;
+    while (slot && slot->owned) slot = slot->next;
+    if (!slot && (slot = calloc(1, sizeof(*slot))) != NULL) {
+        slot->next = stats_slots;
+        stats_slots = slot;
+    }
+    if (slot) slot->owned = 1;
+    pthread_mutex_unlock(&stats_lock);
+    if (!slot) return NULL;
+    stats_self = slot;
+    pthread_setspecific(stats_key, slot);
+    return &slot->stats;
+}
+#else
+static cbc_stats_slot stats_single;
+static cbc_stats_slot *stats_slots = &stats_single;
+
+static cbc_stats *stats_local(void) {
+    return &stats_single.stats;
+}
+#endif
+
+static inline void stats_add(uint64_t *c, uint64_t n) {
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+#else
+    *c += n;
+#endif
+}
+
+static inline uint64_t stats_load(const uint64_t *c) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(c, __ATOMIC_RELAXED);
+#else
+    return *c;
+#endif
+}
+
+// Time stamp counter on x86, the generic timer on AArch64, else ns
+static inline uint64_t stats_clock(void) {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_ia32_rdtsc();
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    return __rdtsc();
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+    uint64_t t;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+#else
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Ticks of the encoder stages (those before CBC_STAGE_DECODE) for the
+// message being encoded. stats_message adds them to the counters once
+// the frame is written; stats_begin drops what a size probe, an estimate
+// or a failed call left behind.
+#ifndef CBC_NO_THREADS
+static _Thread_local uint64_t stats_pending[CBC_STAGE_DECODE];
+#else
+static uint64_t stats_pending[CBC_STAGE_DECODE];
+#endif
+
+static inline void stats_begin(void) {
+    memset(stats_pending, 0, sizeof(stats_pending));
+}
+
+static inline void stats_stage(int stage, uint64_t start) {
+    uint64_t ticks = stats_clock() - start;
+    if (stage < CBC_STAGE_DECODE) {
+        stats_pending[stage] += ticks;
+        return;
+    }
+    cbc_stats *s = stats_local();
+    if (s) stats_add(&s->stage_ticks[stage], ticks);
+}
+
+// One compressed message, counted by the encoder that wrote its frame
+static void stats_message(int K, size_t in_bytes, size_t out_bytes,
+                          size_t header_bytes) {
+    cbc_stats *s = stats_local();
+    if (s) {
+        for (int i = 0; i < CBC_STAGE_DECODE; i++) {
+            stats_add(&s->stage_ticks[i], stats_pending[i]);
+        }
+        stats_add(&s->messages, 1);
+        stats_add(&s->in_bytes, in_bytes);
+        stats_add(&s->out_bytes, out_bytes);
+        stats_add(&s->header_bytes, header_bytes);
+        stats_add(&s->k_hist[K], 1);
+    }
+    stats_begin();
+    if (stats_trace) {
+        cbc_trace_event ev = {CBC_TRACE_MESSAGE, CBC_OK, K,
+                              in_bytes, out_bytes, header_bytes};
+        stats_trace(stats_trace_user, &ev);
+    }
+}
+
+// Framing a wrapper adds around a frame already counted by stats_message
+static void stats_framing(size_t bytes) {
+    cbc_stats *s = stats_local();
+    if (s) {
+        stats_add(&s->out_bytes, bytes);
+        stats_add(&s->header_bytes, bytes);
+    }
+}
+
+// Codes emitted for ranked codes[0..K): cycles for the first table_K,
+// escapes of escape_len bits for the rest
+static void stats_codes(const CodeEntry *codes, int table_K, int K,
+                        int escape_len) {
+    cbc_stats *s = stats_local();
+    if (!s) return;
+    for (int i = 0; i < K; i++) {
+        int len = i < table_K ? cbc_cycles[i].len : escape_len;
+        stats_add(&s->code_lengths[len], (uint64_t)codes[i].freq);
+    }
+}
+
+static int stats_decoded(int status, size_t decoded) {
+    cbc_stats *s = stats_local();
+    if (s) {
+        stats_add(&s->decoded_bytes, decoded);
+        if (status < 0 && status > -8) stats_add(&s->decode_errors[-status], 1);
+    }
+    if (status != CBC_OK && stats_trace) {
+        cbc_trace_event ev = {CBC_TRACE_DECODE_ERROR, status, 0, 0, decoded, 0};
+        stats_trace(stats_trace_user, &ev);
+    }
+    return status;
+}
+
+#define STATS_START(t) uint64_t t = stats_clock()
+#define STATS_STAGE(stage, t) stats_stage(stage, t)
+
+#else
+
+#define STATS_START(t) do { } while (0)
+#define STATS_STAGE(stage, t) ((void)0)
+#define stats_begin() ((void)0)
+#define stats_message(K, in_bytes, out_bytes, header_bytes) ((void)0)
+#define stats_framing(bytes) ((void)0)
+#define stats_codes(codes, table_K, K, escape_len) ((void)0)
+#define stats_decoded(status, decoded) (status)
+
+#endif
+
+void cbc_stats_collect(cbc_stats *out) {
+    memset(out, 0, sizeof(*out));
+#ifdef CBC_STATS
+    // cbc_stats is all uint64_t counters, summed field by field
+    uint64_t *dst = (uint64_t *)out;
+    size_t n = sizeof(cbc_stats) / sizeof(uint64_t);
+#ifndef CBC_NO_THREADS
+    pthread_mutex_lock(&stats_lock);
+#endif
+    for (const cbc_stats_slot *slot = stats_slots; slot; slot = slot->next) {
+        const uint64_t *src = (const uint64_t *)&slot->stats;
+        for (size_t i = 0; i < n; i++) dst[i] += stats_load(&src[i]);
+    }
+#ifndef CBC_NO_THREADS
+    pthread_mutex_unlock(&stats_lock);
+#endif
+#endif
+}
+
+void cbc_stats_set_trace(cbc_trace_fn fn, void *user) {
+#ifdef CBC_STATS
+    stats_trace_user = user;
+    stats_trace = fn;
+#else
+    (void)fn;
+    (void)user;
+#endif
+}
 
 // ------------------------------------------------------------
 // BitWriter helpers
 void bw_init(BitWriter *bw, int capacity) {
     bw->data = (unsigned char *)malloc(capacity);
-    bw->capacity = capacity;
+    bw->capacity = bw->data ? capacity : 0;
     bw->size = 0;
     bw->bit_pos = 0;
+    bw->failed = 0;
     if (bw->data) {
         memset(bw->data, 0, capacity);
     }
@@ -53,68 +337,252 @@ void bw_free(BitWriter *bw) {
     bw->bit_pos = 0;
 }
 
-// Ensure we have space for at least one more byte
-static void bw_ensure_space(BitWriter *bw) {
+// Slow path of bw_reserve: grow data by at least one byte; returns 0
+// (and sets failed) if the buffer cannot grow
+int bw_grow(BitWriter *bw) {
     if (bw->size >= bw->capacity) {
         int new_cap = bw->capacity * 2;
         if (new_cap < 16) new_cap = 16;
         unsigned char *new_data = (unsigned char *)realloc(bw->data, new_cap);
         if (!new_data) {
-            // simple error handling (example code)
-            fprintf(stderr, "Error in realloc inside BitWriter\n");
-            exit(1);
+            bw->failed = 1;
+            return 0;
         }
         // zero newly allocated space
         memset(new_data + bw->capacity, 0, new_cap - bw->capacity);
         bw->data = new_data;
         bw->capacity = new_cap;
     }
+    return 1;
 }
 
-void bw_put_bit(BitWriter *bw, int bit) {
-    if (bw->size == 0 && bw->bit_pos == 0) {
-        // start a new byte
-        bw_ensure_space(bw);
-        bw->size = 1;
-        bw->data[0] = 0;
-    }
+// ------------------------------------------------------------
+// BitWriter64 helpers
+void bw64_init(BitWriter64 *bw, size_t capacity) {
+    bw->data = (unsigned char *)malloc(capacity);
+    bw->capacity = bw->data ? capacity : 0;
+    bw->size = 0;
+    bw->acc = 0;
+    bw->acc_bits = 0;
+    bw->growable = 1;
+    bw->overflow = 0;
+}
 
-    if (bw->bit_pos == 8) {
-        // need a new byte
-        bw_ensure_space(bw);
-        bw->data[bw->size] = 0;
-        bw->size++;
-        bw->bit_pos = 0;
-    }
+// Write into a caller-provided buffer; never allocates
+void bw64_init_buffer(BitWriter64 *bw, unsigned char *buf, size_t capacity) {
+    bw->data = buf;
+    bw->capacity = capacity;
+    bw->size = 0;
+    bw->acc = 0;
+    bw->acc_bits = 0;
+    bw->growable = 0;
+    bw->overflow = 0;
+}
+
+void bw64_free(BitWriter64 *bw) {
+    if (bw->data && bw->growable) free(bw->data);
+    bw->data = NULL;
+    bw->capacity = 0;
+    bw->size = 0;
+    bw->acc = 0;
+    bw->acc_bits = 0;
+}
 
-    if (bit) {
-        bw->data[bw->size - 1] |= (1 << (7 - bw->bit_pos));
+// Slow path of bw64_reserve: make room for n more bytes; returns 0 if a
+// fixed buffer is full or growing failed
+int bw64_grow(BitWriter64 *bw, size_t n) {
+    if (bw->size + n > bw->capacity) {
+        if (!bw->growable) {
+            bw->overflow = 1;
+            return 0;
+        }
+        size_t new_cap = bw->capacity * 2;
+        if (new_cap < bw->size + n) new_cap = bw->size + n;
+        if (new_cap < 16) new_cap = 16;
+        unsigned char *new_data = (unsigned char *)realloc(bw->data, new_cap);
+        if (!new_data) {
+            bw->overflow = 1;
+            return 0;
+        }
+        bw->data = new_data;
+        bw->capacity = new_cap;
     }
-    bw->bit_pos++;
+    return 1;
 }
 
-// Write the cycle 0^m 1^j
-void bw_put_cycle(BitWriter *bw, int m, int j) {
-    for (int i = 0; i < m; i++) {
-        bw_put_bit(bw, 0);
+// Flush pending bits; the last byte is zero-padded like BitWriter's
+void bw64_finish(BitWriter64 *bw) {
+    if (!bw64_reserve(bw, (size_t)(bw->acc_bits + 7) / 8)) return;
+    while (bw->acc_bits >= 8) {
+        bw->acc_bits -= 8;
+        bw->data[bw->size++] = (unsigned char)(bw->acc >> bw->acc_bits);
     }
-    for (int i = 0; i < j; i++) {
-        bw_put_bit(bw, 1);
+    if (bw->acc_bits > 0) {
+        bw->data[bw->size++] = (unsigned char)(bw->acc << (8 - bw->acc_bits));
+        bw->acc_bits = 0;
     }
+    bw->acc = 0;
 }
 
 // ------------------------------------------------------------
 // Frequency counting
+//
+// Runs of identical bytes make consecutive increments of freq_table[c]
+// wait on each other (store-to-load forwarding). Longer inputs are counted
+// into four interleaved sub-histograms merged at the end. The AVX2 / NEON
+// kernels are run-skipping variants of that loop: one vector compare per
+// 32 / 16-byte chunk finds chunks of a single byte value (padding, idle
+// samples) and adds them in one step, while every other chunk goes
+// through the same scalar sub-histogram loop. Mixed data gains nothing
+// from them. The kernel is picked once, from the CPU features, on the
+// first call. Inputs shorter than HIST_MULTI_MIN use the plain loop, where
+// clearing the sub-histograms would cost more than it saves. The
+// sub-histograms come from the caller and are restrict-qualified along
+// with the input: a byte pointer may alias them, and without restrict
+// every increment would force the next input byte to be reloaded (about
+// 1.6x slower on 512-byte messages).
 // ------------------------------------------------------------
 
-void count_character_frequency(const char *text, int *freq_table) {
-    int length = (int)strlen(text);
-    for (int i = 0; i < length; i++) {
-        unsigned char c = (unsigned char)text[i];
-        freq_table[c]++;
+static void count_frequency_scalar(const uint8_t *in, size_t len,
+                                   int *freq_table) {
+    for (size_t i = 0; i < len; i++) {
+        freq_table[in[i]]++;
         // optional debug
-        // printf("%d: %c (freq: %d)\n", i, text[i], freq_table[c]);
+        // printf("%zu: %c (freq: %d)\n", i, in[i], freq_table[in[i]]);
+    }
+}
+
+static void merge_sub_histograms(uint32_t (*restrict sub)[ALPHABET_SIZE],
+                                 int *restrict freq_table) {
+    for (int c = 0; c < ALPHABET_SIZE; c++) {
+        freq_table[c] += (int)(sub[0][c] + sub[1][c] + sub[2][c] + sub[3][c]);
+    }
+}
+
+static void count_frequency_multi(const uint8_t *restrict in, size_t len,
+                                  int *freq_table,
+                                  uint32_t (*restrict sub)[ALPHABET_SIZE]) {
+    memset(sub, 0, 4 * sizeof(sub[0]));
+
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4) {
+        sub[0][in[i]]++;
+        sub[1][in[i + 1]]++;
+        sub[2][in[i + 2]]++;
+        sub[3][in[i + 3]]++;
+    }
+    for (; i < len; i++) sub[0][in[i]]++;
+    merge_sub_histograms(sub, freq_table);
+}
+
+#ifdef CBC_HAVE_AVX2
+__attribute__((target("avx2")))
+static void count_frequency_runs_avx2(const uint8_t *restrict in, size_t len,
+                                      int *freq_table,
+                                      uint32_t (*restrict sub)[ALPHABET_SIZE]) {
+    memset(sub, 0, 4 * sizeof(sub[0]));
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i first = _mm256_set1_epi8((char)in[i]);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, first)) == -1) {
+            sub[0][in[i]] += 32;  // uniform chunk
+            continue;
+        }
+        for (size_t k = i; k < i + 32; k += 4) {
+            sub[0][in[k]]++;
+            sub[1][in[k + 1]]++;
+            sub[2][in[k + 2]]++;
+            sub[3][in[k + 3]]++;
+        }
+    }
+    for (; i < len; i++) sub[0][in[i]]++;
+    merge_sub_histograms(sub, freq_table);
+}
+#endif
+
+#ifdef CBC_HAVE_NEON
+static void count_frequency_runs_neon(const uint8_t *restrict in, size_t len,
+                                      int *freq_table,
+                                      uint32_t (*restrict sub)[ALPHABET_SIZE]) {
+    memset(sub, 0, 4 * sizeof(sub[0]));
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(in + i);
+        if (vminvq_u8(vceqq_u8(v, vdupq_n_u8(in[i]))) == 0xFF) {
+            sub[0][in[i]] += 16;  // uniform chunk
+            continue;
+        }
+        for (size_t k = i; k < i + 16; k += 4) {
+            sub[0][in[k]]++;
+            sub[1][in[k + 1]]++;
+            sub[2][in[k + 2]]++;
+            sub[3][in[k + 3]]++;
+        }
+    }
+    for (; i < len; i++) sub[0][in[i]]++;
+    merge_sub_histograms(sub, freq_table);
+}
+#endif
+
+typedef void (*count_kernel_fn)(const uint8_t *restrict in, size_t len,
+                                int *freq_table,
+                                uint32_t (*restrict sub)[ALPHABET_SIZE]);
+
+#ifdef CBC_HAVE_NEON
+static count_kernel_fn count_kernel = count_frequency_runs_neon;  // NEON is baseline on AArch64
+#else
+static count_kernel_fn count_kernel = count_frequency_multi;
+#endif
+
+#ifdef CBC_HAVE_AVX2
+#ifndef CBC_NO_THREADS
+static pthread_once_t count_kernel_once = PTHREAD_ONCE_INIT;
+#else
+static int count_kernel_ready = 0;
+#endif
+
+static void select_count_kernel(void) {
+    if (__builtin_cpu_supports("avx2")) count_kernel = count_frequency_runs_avx2;
+}
+#endif
+
+static void ensure_count_kernel(void) {
+#ifdef CBC_HAVE_AVX2
+#ifndef CBC_NO_THREADS
+    pthread_once(&count_kernel_once, select_count_kernel);
+#else
+    if (!count_kernel_ready) {
+        select_count_kernel();
+        count_kernel_ready = 1;
     }
+#endif
+#endif
+}
+
+// Add the byte counts of in[0..len) to freq_table; binary-safe. sub is
+// the kernels' 4 KB of sub-histograms, so a cbc_ctx can own it.
+static void count_frequency(const uint8_t *in, size_t len, int *freq_table,
+                            uint32_t sub[4][ALPHABET_SIZE]) {
+    STATS_START(t);
+    if (len < HIST_MULTI_MIN) {
+        count_frequency_scalar(in, len, freq_table);
+    } else {
+        ensure_count_kernel();
+        count_kernel(in, len, freq_table, sub);
+    }
+    STATS_STAGE(CBC_STAGE_COUNT, t);
+}
+
+void cbc_count_frequency(const uint8_t *in, size_t len, int *freq_table) {
+    uint32_t sub[4][ALPHABET_SIZE];
+    count_frequency(in, len, freq_table, sub);
+}
+
+void count_character_frequency(const char *text, int *freq_table) {
+    cbc_count_frequency((const uint8_t *)text, strlen(text), freq_table);
 }
 
 // ------------------------------------------------------------
@@ -133,6 +601,44 @@ int compare_codeentry(const void *a, const void *b) {
     return 0;
 }
 
+// Non-comparison ranking: stable LSD radix sort on freq, one 8-bit digit
+// per pass, most frequent first. codes[0..K) must arrive in increasing
+// symbol order; stability then reproduces the compare_codeentry order
+// (freq desc, symbol asc) exactly. Messages under 256 bytes need a single
+// pass. tmp holds K entries between passes and start the ALPHABET_SIZE +
+// 1 digit offsets; restrict lets the compiler keep the offsets in
+// registers across the entry copies.
+static void rank_codes_buf(CodeEntry *restrict codes, int K,
+                           CodeEntry *restrict tmp, int *restrict start) {
+    int max_freq = 0;
+    for (int i = 0; i < K; i++) {
+        if (codes[i].freq > max_freq) max_freq = codes[i].freq;
+    }
+
+    CodeEntry *src = codes;
+    CodeEntry *dst = tmp;
+    for (int shift = 0; shift < 32 && (max_freq >> shift) > 0; shift += 8) {
+        memset(start, 0, (ALPHABET_SIZE + 1) * sizeof(int));
+        for (int i = 0; i < K; i++) {
+            start[256 - ((src[i].freq >> shift) & 0xFF)]++;  // digit 255 first
+        }
+        for (int d = 1; d <= ALPHABET_SIZE; d++) start[d] += start[d - 1];
+        for (int i = 0; i < K; i++) {
+            dst[start[255 - ((src[i].freq >> shift) & 0xFF)]++] = src[i];
+        }
+        CodeEntry *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != codes) memcpy(codes, src, (size_t)K * sizeof(CodeEntry));
+}
+
+void rank_codes(CodeEntry *codes, int K) {
+    CodeEntry tmp[ALPHABET_SIZE];
+    int start[ALPHABET_SIZE + 1];
+    rank_codes_buf(codes, K, tmp, start);
+}
+
 // ------------------------------------------------------------
 // Cycle generation (m, j) for codes
 //
@@ -142,46 +648,50 @@ int compare_codeentry(const void *a, const void *b) {
 // Example: L=2 => (1,1)  -> "01"
 //          L=3 => (2,1), (1,2)  -> "001", "011"
 //          L=4 => (3,1), (2,2), (1,3) -> ...
+//
+// Both directions are const tables expanded from CBC_CYCLE_LIST, so they
+// live in flash on MCU targets and cost no setup per message.
 // ------------------------------------------------------------
 
-void generate_cycles_for_codes(CodeEntry *codes, int K) {
-    int count = 0;
-    int L = 2;
+#define CBC_CYCLE_ENTRY(m, j) \
+    {(uint32_t)((1u << (j)) - 1), (m), (j), (m) + (j)},
+const cbc_cycle cbc_cycles[CBC_CYCLE_COUNT] = {CBC_CYCLE_LIST(CBC_CYCLE_ENTRY)};
+#undef CBC_CYCLE_ENTRY
 
-    while (count < K) {
-        for (int m = L - 1; m >= 1 && count < K; m--) {
-            int j = L - m;
-            codes[count].m = m;
-            codes[count].j = j;
-            count++;
-        }
-        L++;
+#define CBC_CYCLE_RANK_ENTRY(m, j) [m][j] = CBC_CYCLE_RANK(m, j) + 1,
+const uint16_t cbc_cycle_ranks[MAX_CODE_LENGTH][MAX_CODE_LENGTH] = {
+    CBC_CYCLE_LIST(CBC_CYCLE_RANK_ENTRY)};
+#undef CBC_CYCLE_RANK_ENTRY
+
+void generate_cycles_for_codes(CodeEntry *codes, int K) {
+    for (int i = 0; i < K; i++) {
+        codes[i].m = cbc_cycles[i].m;
+        codes[i].j = cbc_cycles[i].j;
     }
 }
 
+// Rank of the cycle 0^m 1^j in the order above, or -1 if (m, j) is not a
+// valid cycle or is longer than any code a 255-symbol table can assign.
+static int cycle_rank(int m, int j) {
+    if (m < 1 || j < 1 || m >= MAX_CODE_LENGTH || j >= MAX_CODE_LENGTH) return -1;
+    return (int)cbc_cycle_ranks[m][j] - 1;
+}
+
+// Length m + j of the cycle with the given rank
+static int cycle_length(int rank) {
+    return cbc_cycles[rank].len;
+}
+
 // ------------------------------------------------------------
-// Compression
-//
-// Input:
-//   text      - C string (null terminated)
-// Output:
-//   out_data  - pointer to allocated compressed buffer (malloc)
-//   out_size  - size in bytes of the compressed buffer
-//
-// Compressed format:
-//   [1 byte: K] [K bytes: ordered symbols] [bit payload]
+// Code table
 //
-// Header cost is K + 1 bytes.
+// Collect the symbols with freq > 0, sort them by decreasing frequency and
+// assign their cycles. Returns K, the number of distinct symbols.
 // ------------------------------------------------------------
 
-void compress_cycle_based(const char *text,
-                          unsigned char **out_data,
-                          int *out_size) {
-    int freq_table[ALPHABET_SIZE] = {0};
-    count_character_frequency(text, freq_table);
-
-    // Build the table of symbols with freq > 0
-    CodeEntry codes[ALPHABET_SIZE];
+static inline int build_code_table_buf(const int *freq_table, CodeEntry *codes,
+                                       CodeEntry *tmp, int start[ALPHABET_SIZE + 1]) {
+    STATS_START(t);
     int K = 0;
     for (int c = 0; c < ALPHABET_SIZE; c++) {
         if (freq_table[c] > 0) {
@@ -193,237 +703,3241 @@ void compress_cycle_based(const char *text,
         }
     }
 
-    if (K == 0) {
-        // empty text
-        *out_data = NULL;
-        *out_size = 0;
-        return;
-    }
-
-    if (K > 255) {
-        // for this example, we limit K to 255
-        fprintf(stderr, "Error: more than 255 distinct symbols\n");
-        exit(1);
-    }
-
     // Sort by decreasing frequency
-    qsort(codes, K, sizeof(CodeEntry), compare_codeentry);
+    rank_codes_buf(codes, K, tmp, start);
 
     // Generate pairs (m, j) for each symbol in the given order
     generate_cycles_for_codes(codes, K);
+    STATS_STAGE(CBC_STAGE_RANK, t);
+    return K;
+}
+
+int build_code_table(const int *freq_table, CodeEntry *codes) {
+    CodeEntry tmp[ALPHABET_SIZE];
+    int start[ALPHABET_SIZE + 1];
+    return build_code_table_buf(freq_table, codes, tmp, start);
+}
 
-    // Build LUT: symbol -> index in codes
-    int lut[ALPHABET_SIZE];
-    for (int i = 0; i < ALPHABET_SIZE; i++) lut[i] = -1;
+// Code word of every byte value, indexed directly by the symbol; codes
+// must be in rank order, as build_code_table leaves them
+void build_code_words(const CodeEntry *codes, int K, CodeWord *words) {
+    memset(words, 0, ALPHABET_SIZE * sizeof(CodeWord));
     for (int i = 0; i < K; i++) {
-        lut[codes[i].symbol] = i;
+        CodeWord *w = &words[codes[i].symbol];
+        w->bits = cbc_cycles[i].bits;
+        w->len = cbc_cycles[i].len;
     }
+}
 
-    // Write bit payload
-    BitWriter bw;
-    bw_init(&bw, 64);  // small initial capacity, grows dynamically
+// ------------------------------------------------------------
+// Varint helpers
+//
+// LEB128: 7 bits per byte, least significant group first, high bit set on
+// every byte but the last.
+// ------------------------------------------------------------
 
-    int len = (int)strlen(text);
-    for (int i = 0; i < len; i++) {
-        unsigned char c = (unsigned char)text[i];
-        int idx = lut[c];
-        if (idx < 0) {
-            fprintf(stderr, "Internal error: symbol not found in LUT\n");
-            exit(1);
-        }
-        bw_put_cycle(&bw, codes[idx].m, codes[idx].j);
+static size_t varint_size(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
     }
+    return n;
+}
 
-    // Build final buffer: [K][symbols][payload bits]
-    int header_size = 1 + K;  // 1 byte K + K symbol bytes
-    *out_size = header_size + bw.size;
-    *out_data = (unsigned char *)malloc(*out_size);
-
-    if (!*out_data) {
-        fprintf(stderr, "Error allocating output buffer\n");
-        exit(1);
+static size_t put_varint(uint8_t *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
     }
+    p[n++] = (uint8_t)v;
+    return n;
+}
 
-    // Fill header
-    (*out_data)[0] = (unsigned char)K;
-    for (int i = 0; i < K; i++) {
-        (*out_data)[1 + i] = codes[i].symbol;
+// Returns the bytes consumed, or 0 if the varint is truncated or too long
+static size_t get_varint(const uint8_t *p, size_t size, uint64_t *v) {
+    uint64_t value = 0;
+    for (size_t n = 0; n < size && n < CBC_VARINT_MAX; n++) {
+        value |= (uint64_t)(p[n] & 0x7F) << (7 * n);
+        if (!(p[n] & 0x80)) {
+            *v = value;
+            return n + 1;
+        }
     }
-
-    // Copy payload
-    memcpy(*out_data + header_size, bw.data, bw.size);
-
-    bw_free(&bw);
-
-    // Optional debug
-    printf("K = %d (header = %d bytes, payload = %d bytes, total = %d bytes)\n",
-           K, header_size, *out_size - header_size, *out_size);
+    return 0;
 }
 
 // ------------------------------------------------------------
-// Decompression (simple version)
-// ------------------------------------------------------------
+// Compression into a caller-provided buffer
 //
 // Input:
-//   comp_data    - compressed buffer
-//   comp_size    - compressed buffer size in bytes
-//   original_len - original text length in characters
-//
+//   in        - bytes to compress
+//   len       - number of bytes in `in`
+//   out       - output buffer
+//   out_cap   - capacity of `out` in bytes
 // Output:
-//   out_text     - output buffer (must have space >= original_len+1)
+//   written   - bytes written to `out`; on CBC_ERR_OVERFLOW, the size
+//               `out` would have needed
 //
-// Note: here we assume the receiver knows the original length (it could be
-//       transmitted in another protocol field, for example).
+// Same format as compress_cycle_based. The exact output size is known
+// once the code table is built, so the header and payload are written
+// straight into `out` and nothing is allocated.
 // ------------------------------------------------------------
 
-void decompress_cycle_based(const unsigned char *comp_data,
-                            int comp_size,
-                            int original_len,
-                            char *out_text) {
-    if (comp_size <= 0) {
-        out_text[0] = '\0';
-        return;
+// Upper bound of the compressed size of len bytes holding K distinct
+// symbols (use K = 255 when unknown)
+size_t cbc_max_compressed_size(size_t len, int K) {
+    if (len == 0) return 0;
+    if (K < 1) K = 1;
+    if (K > 255) K = 255;
+    return 1 + (size_t)K + (len * (size_t)cycle_length(K - 1) + 7) / 8;
+}
+
+// Exact payload size in bits: sum of freq * (m + j)
+static uint64_t payload_bits(const CodeEntry *codes, int K) {
+    uint64_t bits = 0;
+    for (int i = 0; i < K; i++) {
+        bits += (uint64_t)codes[i].freq * cbc_cycles[i].len;
     }
+    return bits;
+}
 
-    int K = comp_data[0];
-    if (K <= 0 || comp_size < 1 + K) {
-        fprintf(stderr, "Invalid compressed data\n");
-        out_text[0] = '\0';
-        return;
+// Encode in[0..len) with the given code words into dst
+static void encode_payload(const uint8_t *in, size_t len, const CodeWord *words,
+                           uint8_t *dst, size_t cap) {
+    STATS_START(t);
+    BitWriter64 bw;
+    bw64_init_buffer(&bw, dst, cap);
+    for (size_t i = 0; i < len; i++) {
+        bw64_put_symbol(&bw, words, in[i]);
     }
+    bw64_finish(&bw);
+    STATS_STAGE(CBC_STAGE_ENCODE, t);
+}
 
-    // Recover symbols
-    CodeEntry codes[ALPHABET_SIZE];
-    for (int i = 0; i < K; i++) {
-        codes[i].symbol = comp_data[1 + i];
-        codes[i].m = 0;
-        codes[i].j = 0;
-        codes[i].freq = 0;  // not needed here
+static void scratch_init(cbc_scratch *sc) {
+    memset(sc, 0, sizeof(*sc));
+}
+
+// Counts in into sc->freq
+static void scratch_count(cbc_scratch *sc, const uint8_t *in, size_t len) {
+    if (sc->work) {
+        count_frequency(in, len, sc->freq, sc->work->sub);
+    } else {
+        cbc_count_frequency(in, len, sc->freq);
     }
+}
 
-    // Generate the same cycles (m, j) in the same order
-    generate_cycles_for_codes(codes, K);
+// Ranks freq_table into sc->codes; returns K
+static int scratch_build(cbc_scratch *sc, const int *freq_table) {
+    if (sc->work) {
+        return build_code_table_buf(freq_table, sc->codes, sc->work->rank_tmp,
+                                    sc->work->rank_start);
+    }
+    return build_code_table(freq_table, sc->codes);
+}
 
-    // Pointer to the bit payload
-    const unsigned char *payload = comp_data + 1 + K;
-    int payload_bytes = comp_size - (1 + K);
+// Counts in into sc->freq and ranks it into sc->codes, leaving freq
+// clean; returns K
+static int scratch_rank(cbc_scratch *sc, const uint8_t *in, size_t len) {
+    int K;
+    if (sc->work) {
+        count_frequency(in, len, sc->freq, sc->work->sub);
+        K = build_code_table_buf(sc->freq, sc->codes, sc->work->rank_tmp,
+                                 sc->work->rank_start);
+    } else {
+        cbc_count_frequency(in, len, sc->freq);
+        K = build_code_table(sc->freq, sc->codes);
+    }
+    for (int i = 0; i < K; i++) sc->freq[sc->codes[i].symbol] = 0;
+    return K;
+}
 
-    int bit_index = 0;  // global bit index
-    int out_pos = 0;
+// Shared by the plain and framed formats: [K][symbols]([varint len])[payload].
+// Leaves sc clean for the next message.
+static int compress_message(cbc_scratch *sc, const uint8_t *in, size_t len,
+                            int framed, uint8_t *out, size_t out_cap,
+                            size_t *written) {
+    *written = 0;
+    stats_begin();
+    if (len == 0) return CBC_OK;
+    if (!in || len > INT_MAX) return CBC_ERR_INPUT;
+
+    // Ordered table of symbols with freq > 0 and their cycles
+    CodeEntry *codes = sc->codes;
+    int K = scratch_rank(sc, in, len);
+    if (K > 255) return CBC_ERR_SYMBOLS;
+
+    size_t header_size = 1 + (size_t)K + (framed ? varint_size(len) : 0);
+    *written = header_size + (size_t)((payload_bits(codes, K) + 7) / 8);
+    if (!out || *written > out_cap) return CBC_ERR_OVERFLOW;
+
+    // Header: [K][symbols]([varint len])
+    STATS_START(t);
+    out[0] = (uint8_t)K;
+    for (int i = 0; i < K; i++) {
+        out[1 + i] = codes[i].symbol;
+    }
+    if (framed) put_varint(out + 1 + K, len);
+    STATS_STAGE(CBC_STAGE_COPY, t);
 
-    while (out_pos < original_len && bit_index < payload_bytes * 8) {
-        // count zeros until the first 1
-        int m = 0;
-        int j = 0;
+    // Code word per byte value, only for the K symbols of this message
+    for (int i = 0; i < K; i++) {
+        CodeWord *w = &sc->words[codes[i].symbol];
+        w->bits = cbc_cycles[i].bits;
+        w->len = cbc_cycles[i].len;
+    }
 
-        // count zeros
-        while (bit_index < payload_bytes * 8) {
-            int byte_idx = bit_index / 8;
-            int bit_in_byte = bit_index % 8;
-            int bit = (payload[byte_idx] >> (7 - bit_in_byte)) & 1;
-            bit_index++;
+    // Payload, written in place after the header
+    encode_payload(in, len, sc->words, out + header_size, out_cap - header_size);
+    stats_codes(codes, K, K, 0);
+    stats_message(K, len, *written, header_size);
 
-            if (bit == 0) {
-                m++;
-            } else {
-                // found first 1
-                j = 1;
-                break;
-            }
-        }
+    for (int i = 0; i < K; i++) sc->words[codes[i].symbol].len = 0;
+    return CBC_OK;
+}
 
-        if (j == 0) {
-            // did not find a 1, truncated stream
-            break;
-        }
+int cbc_compress_into(const uint8_t *in, size_t len,
+                      uint8_t *out, size_t out_cap, size_t *written) {
+    cbc_scratch sc;
+    scratch_init(&sc);
+    return compress_message(&sc, in, len, 0, out, out_cap, written);
+}
 
-        // count consecutive 1s
-        while (bit_index < payload_bytes * 8) {
-            int byte_idx = bit_index / 8;
-            int bit_in_byte = bit_index % 8;
-            int bit = (payload[byte_idx] >> (7 - bit_in_byte)) & 1;
+// ------------------------------------------------------------
+// Bounded-length codes
+//
+// Compressed formats (chosen per message, smallest wins):
+//   plain   [K] [K symbols] [payload]            if every code fits in N bits
+//   bounded [0] [N] [K] [K symbols] [payload]
+//   raw     [0] [0] [len bytes]
+//
+// In the bounded format only the K most frequent symbols get a cycle, and
+// every code is at most N bits long; any other byte b is written as the
+// escape 0^N followed by the 8 bits of b. No cycle of N bits or less has
+// N leading zeros, so the escape is unambiguous, and the raw byte is read
+// by count, so its bits cannot merge with the cycles around it. K is
+// picked to minimize header + payload, not just to fill every code.
+// The raw fallback bounds any message to len + 2 bytes.
+// ------------------------------------------------------------
 
-            if (bit == 1) {
-                j++;
-                bit_index++;
-            } else {
-                // found 0, end of cycle
-                break;
-            }
-        }
+// Upper bound of cbc_compress_bounded_into's output for len bytes
+size_t cbc_max_bounded_size(size_t len) {
+    return len == 0 ? 0 : len + 2;
+}
 
-        // now we have (m, j) -> search symbol
-        int found = -1;
-        for (int i = 0; i < K; i++) {
-            if (codes[i].m == m && codes[i].j == j) {
-                found = i;
-                break;
-            }
+// Layout of a bounded-length message, from bounded_plan
+typedef struct {
+    int K;                    // distinct symbols, ranked in sc->codes
+    int bounded_K;            // symbols with a cycle in the bounded layout
+    size_t bounded_payload;   // payload bytes of the bounded layout
+    size_t plain_payload;     // same for plain, SIZE_MAX if a code exceeds N
+    uint64_t bounded_bits;    // exact payload bits of each layout
+    uint64_t plain_bits;
+} bounded_plan;
+
+enum { LAYOUT_PLAIN, LAYOUT_BOUNDED, LAYOUT_RAW };
+
+static void bounded_plan_build(cbc_scratch *sc, const uint8_t *in, size_t len,
+                               int max_len, bounded_plan *p) {
+    CodeEntry *codes = sc->codes;
+    int K = scratch_rank(sc, in, len);
+
+    // Best table size: keeping rank k-1 costs its header byte plus freq *
+    // len instead of freq * (N + 8) as an escape
+    const uint64_t escape_len = (uint64_t)max_len + 8;
+    int limit = max_len * (max_len - 1) / 2;
+    if (limit > K) limit = K;
+    if (limit > 255) limit = 255;
+    uint64_t bits = (uint64_t)len * escape_len;
+    size_t bounded_size = SIZE_MAX;
+    p->K = K;
+    p->bounded_K = 0;
+    for (int k = 1; k <= limit; k++) {
+        bits -= (uint64_t)codes[k - 1].freq * (escape_len - cbc_cycles[k - 1].len);
+        size_t size = (size_t)k + (size_t)((bits + 7) / 8);
+        if (size < bounded_size) {
+            bounded_size = size;
+            p->bounded_K = k;
+            p->bounded_payload = (size_t)((bits + 7) / 8);
+            p->bounded_bits = bits;
         }
+    }
 
-        if (found < 0) {
-            fprintf(stderr, "Pair (m=%d, j=%d) not found in code table\n", m, j);
-            break;
-        }
+    p->plain_payload = SIZE_MAX;
+    if (K <= 255 && cycle_length(K - 1) <= max_len) {
+        p->plain_bits = payload_bits(codes, K);
+        p->plain_payload = (size_t)((p->plain_bits + 7) / 8);
+    }
+}
+
+// Smallest layout given the bytes each one adds besides its symbols and
+// payload; ties go to plain, then bounded
+static int bounded_choose(const bounded_plan *p, size_t len, size_t plain_extra,
+                          size_t bounded_extra, size_t raw_extra) {
+    size_t plain_size = p->plain_payload == SIZE_MAX ? SIZE_MAX
+                      : plain_extra + (size_t)p->K + p->plain_payload;
+    size_t bounded_size = bounded_extra + (size_t)p->bounded_K + p->bounded_payload;
+    size_t raw_size = raw_extra + len;
+    if (plain_size <= bounded_size && plain_size <= raw_size) return LAYOUT_PLAIN;
+    return bounded_size < raw_size ? LAYOUT_BOUNDED : LAYOUT_RAW;
+}
+
+// Writes the table_K ranked symbols to symbols and the payload to dst:
+// cycles for those, escapes after max_len zeros for the rest
+static void bounded_emit(cbc_scratch *sc, const bounded_plan *p, int table_K,
+                         const uint8_t *in, size_t len, int max_len,
+                         uint8_t *symbols, uint8_t *dst, size_t cap) {
+    const CodeEntry *codes = sc->codes;
+    for (int i = 0; i < table_K; i++) {
+        symbols[i] = codes[i].symbol;
+        CodeWord *w = &sc->words[codes[i].symbol];
+        w->bits = cbc_cycles[i].bits;
+        w->len = cbc_cycles[i].len;
+    }
+    for (int i = table_K; i < p->K; i++) {
+        CodeWord *w = &sc->words[codes[i].symbol];
+        w->bits = codes[i].symbol;  // after max_len leading zeros
+        w->len = (uint8_t)(max_len + 8);
+    }
+    encode_payload(in, len, sc->words, dst, cap);
+    stats_codes(codes, table_K, p->K, max_len + 8);
+    for (int i = 0; i < p->K; i++) sc->words[codes[i].symbol].len = 0;
+}
+
+static int compress_bounded(cbc_scratch *sc, const uint8_t *in, size_t len,
+                            int max_len, uint8_t *out, size_t out_cap,
+                            size_t *written) {
+    *written = 0;
+    stats_begin();
+    if (len == 0) return CBC_OK;
+    if (!in || len > INT_MAX) return CBC_ERR_INPUT;
+    if (max_len < 2 || max_len > MAX_CODE_LENGTH) return CBC_ERR_INPUT;
+
+    bounded_plan p;
+    bounded_plan_build(sc, in, len, max_len, &p);
+
+    switch (bounded_choose(&p, len, 1, 3, 2)) {
+    case LAYOUT_PLAIN:
+        *written = 1 + (size_t)p.K + p.plain_payload;
+        if (!out || *written > out_cap) return CBC_ERR_OVERFLOW;
+        out[0] = (uint8_t)p.K;
+        bounded_emit(sc, &p, p.K, in, len, max_len, out + 1,
+                     out + 1 + p.K, out_cap - (1 + (size_t)p.K));
+        stats_message(p.K, len, *written, 1 + (size_t)p.K);
+        return CBC_OK;
+    case LAYOUT_BOUNDED:
+        *written = 3 + (size_t)p.bounded_K + p.bounded_payload;
+        if (!out || *written > out_cap) return CBC_ERR_OVERFLOW;
+        out[0] = 0;
+        out[1] = (uint8_t)max_len;
+        out[2] = (uint8_t)p.bounded_K;
+        bounded_emit(sc, &p, p.bounded_K, in, len, max_len, out + 3,
+                     out + 3 + p.bounded_K, out_cap - (3 + (size_t)p.bounded_K));
+        stats_message(p.bounded_K, len, *written, 3 + (size_t)p.bounded_K);
+        return CBC_OK;
+    default:
+        *written = len + 2;
+        if (!out || *written > out_cap) return CBC_ERR_OVERFLOW;
+        STATS_START(t);
+        out[0] = 0;
+        out[1] = CBC_EXT_RAW;
+        memcpy(out + 2, in, len);
+        STATS_STAGE(CBC_STAGE_COPY, t);
+        stats_message(0, len, *written, 2);
+        return CBC_OK;
+    }
+}
+
+int cbc_compress_bounded_into(const uint8_t *in, size_t len, int max_len,
+                              uint8_t *out, size_t out_cap, size_t *written) {
+    cbc_scratch sc;
+    scratch_init(&sc);
+    return compress_bounded(&sc, in, len, max_len, out, out_cap, written);
+}
+
+// ------------------------------------------------------------
+// Self-describing frame
+//
+// Compressed format:
+//   [1 byte: K] [K bytes: ordered symbols] [varint: original length]
+//   [bit payload]
+//
+// The original length makes the zero padding of the last byte
+// unambiguous, so the decoder needs no out-of-band size and can size its
+// output exactly with cbc_framed_length before decoding.
+// ------------------------------------------------------------
+
+size_t cbc_max_framed_size(size_t len, int K) {
+    if (len == 0) return 0;
+    return cbc_max_compressed_size(len, K) + varint_size(len);
+}
+
+int cbc_compress_framed_into(const uint8_t *in, size_t len,
+                             uint8_t *out, size_t out_cap, size_t *written) {
+    cbc_scratch sc;
+    scratch_init(&sc);
+    return compress_message(&sc, in, len, 1, out, out_cap, written);
+}
+
+// ------------------------------------------------------------
+// Versioned container
+//
+// Container format, shared with the Python implementation:
+//   [1 byte: CBC_CONTAINER_MAGIC] [1 byte: version << 4 | flags]
+//   [varint: original length] [varint: header size] [header] [payload]
+//
+//   flags            header                  payload
+//   0                [K] [K symbols]         cycles
+//   CBC_CF_BOUNDED   [N] [K] [K symbols]     cycles <= N bits and escapes
+//   CBC_CF_BOUNDED   [N | 0x80] [K] ...      same, byte-pair tokens (see below)
+//   CBC_CF_RAW       (empty)                 the message itself
+//   CBC_CF_DICT      [dictionary id]         cycles of a shared ranking
+//
+// Each frame is self-describing and the header is length-prefixed, so a
+// gateway can route or forward it from the prefix alone, and a decoder
+// rejects versions and flags it does not know before reading the header.
+// The encoder picks the smallest of the plain, bounded and raw layouts.
+// ------------------------------------------------------------
+
+static size_t container_prefix_size(size_t len, size_t header_size) {
+    return 2 + varint_size(len) + varint_size(header_size);
+}
+
+static size_t put_container_prefix(uint8_t *out, int flags, size_t len,
+                                   size_t header_size) {
+    size_t n = 0;
+    out[n++] = CBC_CONTAINER_MAGIC;
+    out[n++] = (uint8_t)(CBC_CONTAINER_VERSION << 4 | flags);
+    n += put_varint(out + n, len);
+    n += put_varint(out + n, header_size);
+    return n;
+}
+
+// A table layout is only picked when it is not larger than the message,
+// and its header size needs at most 2 varint bytes
+size_t cbc_max_container_size(size_t len) {
+    return 4 + varint_size(len) + len;
+}
+
+// Layout of a container frame with a single-byte table
+typedef struct {
+    bounded_plan p;
+    int layout;
+    int flags;
+    int table_K;
+    size_t header_size;
+    size_t payload_size;
+    size_t size;              // of the whole frame
+} container_plan;
+
+// Ranks in[0..len) into sc->codes and picks the smallest layout
+static void container_plan_build(cbc_scratch *sc, const uint8_t *in, size_t len,
+                                 int max_len, container_plan *cp) {
+    memset(&cp->p, 0, sizeof(cp->p));
+    cp->layout = LAYOUT_RAW;
+    if (len > 0) {
+        bounded_plan_build(sc, in, len, max_len, &cp->p);
+        // Each layout also pays the varint of its own header size
+        size_t plain_header = 1 + (size_t)cp->p.K;
+        size_t bounded_header = 2 + (size_t)cp->p.bounded_K;
+        cp->layout = bounded_choose(&cp->p, len,
+                                    1 + varint_size(plain_header),
+                                    2 + varint_size(bounded_header),
+                                    varint_size(0));
+    }
+
+    if (cp->layout == LAYOUT_PLAIN) {
+        cp->flags = 0;
+        cp->table_K = cp->p.K;
+        cp->header_size = 1 + (size_t)cp->table_K;
+        cp->payload_size = cp->p.plain_payload;
+    } else if (cp->layout == LAYOUT_BOUNDED) {
+        cp->flags = CBC_CF_BOUNDED;
+        cp->table_K = cp->p.bounded_K;
+        cp->header_size = 2 + (size_t)cp->table_K;
+        cp->payload_size = cp->p.bounded_payload;
+    } else {
+        cp->flags = CBC_CF_RAW;
+        cp->table_K = 0;
+        cp->header_size = 0;
+        cp->payload_size = len;
+    }
+    cp->size = container_prefix_size(len, cp->header_size) + cp->header_size +
+               cp->payload_size;
+}
+
+// Writes the frame of cp, whose ranking must still be in sc->codes
+static int container_emit(cbc_scratch *sc, const container_plan *cp,
+                          const uint8_t *in, size_t len, int max_len,
+                          uint8_t *out, size_t out_cap, size_t *written) {
+    *written = cp->size;
+    if (!out || *written > out_cap) return CBC_ERR_OVERFLOW;
+
+    uint8_t *h = out + put_container_prefix(out, cp->flags, len, cp->header_size);
+    if (cp->layout == LAYOUT_RAW) {
+        STATS_START(t);
+        if (len > 0) memcpy(h, in, len);
+        STATS_STAGE(CBC_STAGE_COPY, t);
+        stats_message(0, len, *written, *written - len);
+        return CBC_OK;
+    }
+    if (cp->layout == LAYOUT_BOUNDED) *h++ = (uint8_t)max_len;
+    *h++ = (uint8_t)cp->table_K;
+    bounded_emit(sc, &cp->p, cp->table_K, in, len, max_len, h, h + cp->table_K,
+                 cp->payload_size);
+    stats_message(cp->table_K, len, *written, *written - cp->payload_size);
+    return CBC_OK;
+}
+
+static int compress_container(cbc_scratch *sc, const uint8_t *in, size_t len,
+                              int max_len, uint8_t *out, size_t out_cap,
+                              size_t *written) {
+    *written = 0;
+    stats_begin();
+    if ((!in && len > 0) || len > INT_MAX) return CBC_ERR_INPUT;
+    if (max_len == 0) max_len = MAX_CODE_LENGTH;
+    if (max_len < 2 || max_len > MAX_CODE_LENGTH) return CBC_ERR_INPUT;
+
+    container_plan cp;
+    container_plan_build(sc, in, len, max_len, &cp);
+    return container_emit(sc, &cp, in, len, max_len, out, out_cap, written);
+}
+
+int cbc_compress_container_into(const uint8_t *in, size_t len, int max_len,
+                                uint8_t *out, size_t out_cap, size_t *written) {
+    cbc_scratch sc;
+    scratch_init(&sc);
+    return compress_container(&sc, in, len, max_len, out, out_cap, written);
+}
+
+size_t cbc_max_container_dict_size(const cbc_dict *dict, size_t len) {
+    size_t longest = (size_t)cycle_length(dict->K - 1);
+    return 4 + varint_size(len) + (len * longest + 7) / 8;
+}
+
+int cbc_compress_container_dict_into(const cbc_dict *dict,
+                                     const uint8_t *in, size_t len,
+                                     uint8_t *out, size_t out_cap,
+                                     size_t *written) {
+    *written = 0;
+    if (!in && len > 0) return CBC_ERR_INPUT;
+
+    // The dictionary header is [id], which cbc_compress_dict_into writes
+    size_t prefix = container_prefix_size(len, 1);
+    if (len == 0) {
+        *written = prefix + 1;
+        if (!out || out_cap < *written) return CBC_ERR_OVERFLOW;
+        put_container_prefix(out, CBC_CF_DICT, len, 1);
+        out[prefix] = dict->id;
+        return CBC_OK;
+    }
+
+    // Without room for the prefix, the inner call is a size probe
+    int room = out && out_cap > prefix;
+    size_t inner = 0;
+    int status = cbc_compress_dict_into(dict, in, len, room ? out + prefix : NULL,
+                                        room ? out_cap - prefix : 0, &inner);
+    *written = inner ? prefix + inner : 0;
+    if (status != CBC_OK) return status;
+    put_container_prefix(out, CBC_CF_DICT, len, 1);
+    stats_framing(prefix);
+    return CBC_OK;
+}
+
+// ------------------------------------------------------------
+// Byte-pair tokens
+//
+// Header of a CBC_CF_BOUNDED frame with pair tokens:
+//   [N | CBC_BOUNDED_PAIRS] [K] [ceil(K / 8) bytes: pair bitmap]
+//   [K tokens: 1 byte, or 2 bytes where bit i of the bitmap is set]
+//
+// Frequent digrams (": ", "0.", ", " in JSON telemetry) become one token
+// and one cycle instead of two. The message is tokenized left to right,
+// taking a pair wherever it is one of the P most frequent adjacent pairs;
+// tokens ranked past K are written as one escape per byte, exactly as in
+// the bounded layout. P is tried in powers of two up to CBC_PAIRS_MAX and
+// the frame is only used when it is smaller than the single-byte one.
+// ------------------------------------------------------------
+
+#define CBC_PAIRS_MAX 128       // candidate pairs per message
+#define CBC_PAIRS_MIN_COUNT 3   // rarer pairs never pay for 2 header bytes
+
+typedef struct {
+    uint16_t value;   // byte, or first << 8 | second for a pair
+    int pair;
+    int freq;
+} pair_token;
+
+typedef struct {
+    // Candidate lookup: slot[row[first] - 1][second] is 1 + the index of
+    // the candidate pair, 0 if it has none. Rows are handed out to first
+    // bytes on demand, so at most CBC_PAIRS_MAX exist.
+    uint8_t row[ALPHABET_SIZE];
+    uint8_t slot[CBC_PAIRS_MAX][ALPHABET_SIZE];
+    int n_rows;
+    uint16_t cand[CBC_PAIRS_MAX];
+    int n_cand;
+    pair_token tokens[ALPHABET_SIZE + CBC_PAIRS_MAX];
+    int n_tokens;
+    int K;                     // tokens in the table
+    size_t header_size;
+    size_t payload_size;
+
+    // Working tables, kept here rather than on the stack
+    size_t start[ALPHABET_SIZE];
+    size_t count[ALPHABET_SIZE];
+    uint32_t cand_count[CBC_PAIRS_MAX];
+    int freq[ALPHABET_SIZE + CBC_PAIRS_MAX];
+    pair_token tmp[ALPHABET_SIZE + CBC_PAIRS_MAX];
+    int rank_start[ALPHABET_SIZE + 1];
+    CodeWord words[ALPHABET_SIZE];
+    CodeWord pair_words[CBC_PAIRS_MAX];
+} pair_plan;
+
+static inline unsigned pair_slot(const pair_plan *pp, uint8_t first, uint8_t second) {
+    unsigned r = pp->row[first];
+    return r ? pp->slot[r - 1][second] : 0;
+}
+
+static void pair_set_slot(pair_plan *pp, uint16_t v, unsigned s) {
+    uint8_t first = (uint8_t)(v >> 8);
+    if (!pp->row[first]) {
+        memset(pp->slot[pp->n_rows], 0, ALPHABET_SIZE);
+        pp->row[first] = (uint8_t)++pp->n_rows;
+    }
+    pp->slot[pp->row[first] - 1][v & 0xFF] = (uint8_t)s;
+}
+
+// rank_codes for tokens: stable LSD radix sort on freq, most frequent
+// first. Tokens arrive as bytes in value order, then pairs in candidate
+// order, which breaks the ties.
+static void rank_pair_tokens(pair_token *restrict tokens, int T,
+                             pair_token *restrict tmp, int *restrict start) {
+    int max_freq = 0;
+    for (int i = 0; i < T; i++) {
+        if (tokens[i].freq > max_freq) max_freq = tokens[i].freq;
+    }
+
+    pair_token *src = tokens;
+    pair_token *dst = tmp;
+    for (int shift = 0; shift < 32 && (max_freq >> shift) > 0; shift += 8) {
+        memset(start, 0, (ALPHABET_SIZE + 1) * sizeof(int));
+        for (int i = 0; i < T; i++) {
+            start[256 - ((src[i].freq >> shift) & 0xFF)]++;  // digit 255 first
+        }
+        for (int d = 1; d <= ALPHABET_SIZE; d++) start[d] += start[d - 1];
+        for (int i = 0; i < T; i++) {
+            dst[start[255 - ((src[i].freq >> shift) & 0xFF)]++] = src[i];
+        }
+        pair_token *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != tokens) memcpy(tokens, src, (size_t)T * sizeof(pair_token));
+}
+
+// The CBC_PAIRS_MAX most frequent adjacent pairs seen at least
+// CBC_PAIRS_MIN_COUNT times, most frequent first (ties by value). The
+// pairs are counted by radix-sorting them rather than in a 64K-entry
+// histogram, so short messages stay cheap. sorted holds 2 * (len - 1)
+// values.
+static void pairs_candidates(pair_plan *pp, const uint8_t *in, size_t len,
+                             uint16_t *sorted) {
+    size_t n = len - 1;
+    uint16_t *tmp = sorted + n;
+
+    // By second byte, then stably by first
+    size_t *start = pp->start;
+    size_t *count = pp->count;
+    memset(pp->count, 0, sizeof(pp->count));
+    for (size_t i = 0; i < n; i++) count[in[i + 1]]++;
+    for (size_t c = 0, sum = 0; c < ALPHABET_SIZE; sum += count[c++]) start[c] = sum;
+    for (size_t i = 0; i < n; i++) {
+        tmp[start[in[i + 1]]++] = (uint16_t)(in[i] << 8 | in[i + 1]);
+    }
+    memset(pp->count, 0, sizeof(pp->count));
+    for (size_t i = 0; i < n; i++) count[in[i]]++;
+    for (size_t c = 0, sum = 0; c < ALPHABET_SIZE; sum += count[c++]) start[c] = sum;
+    for (size_t i = 0; i < n; i++) sorted[start[tmp[i] >> 8]++] = tmp[i];
+
+    uint32_t *cand_count = pp->cand_count;
+    int k = 0;
+    for (size_t i = 0; i < n;) {
+        size_t run = i;
+        while (run < n && sorted[run] == sorted[i]) run++;
+        uint32_t c = (uint32_t)(run - i);
+        uint16_t v = sorted[i];
+        i = run;
+        if (c < CBC_PAIRS_MIN_COUNT) continue;
+        if (k == CBC_PAIRS_MAX && c <= cand_count[k - 1]) continue;
+        int j = k < CBC_PAIRS_MAX ? k++ : k - 1;
+        while (j > 0 && cand_count[j - 1] < c) {
+            pp->cand[j] = pp->cand[j - 1];
+            cand_count[j] = cand_count[j - 1];
+            j--;
+        }
+        pp->cand[j] = v;
+        cand_count[j] = c;
+    }
+
+    memset(pp->row, 0, sizeof(pp->row));
+    pp->n_rows = 0;
+    pp->n_cand = k;
+}
+
+// Tokenizes in with the pairs that have a slot, ranks the tokens and
+// picks the table size K that minimizes header + payload
+static void pairs_plan_build(pair_plan *pp, const uint8_t *in, size_t len,
+                             int max_len) {
+    int *freq = pp->freq;
+    memset(pp->freq, 0, sizeof(pp->freq));
+    for (size_t i = 0; i < len;) {
+        unsigned s = i + 1 < len ? pair_slot(pp, in[i], in[i + 1]) : 0;
+        if (s) {
+            freq[ALPHABET_SIZE + s - 1]++;
+            i += 2;
+        } else {
+            freq[in[i]]++;
+            i++;
+        }
+    }
+
+    int T = 0;
+    for (int t = 0; t < ALPHABET_SIZE + pp->n_cand; t++) {
+        if (freq[t] == 0) continue;
+        pair_token *tok = &pp->tokens[T++];
+        tok->pair = t >= ALPHABET_SIZE;
+        tok->value = tok->pair ? pp->cand[t - ALPHABET_SIZE] : (uint16_t)t;
+        tok->freq = freq[t];
+    }
+    rank_pair_tokens(pp->tokens, T, pp->tmp, pp->rank_start);
+    pp->n_tokens = T;
+
+    // As in bounded_plan_build, but a token carries 1 + pair bytes, both
+    // in the header and as escapes
+    const uint64_t escape_len = (uint64_t)max_len + 8;
+    int limit = max_len * (max_len - 1) / 2;
+    if (limit > T) limit = T;
+    if (limit > 255) limit = 255;
+    uint64_t bits = (uint64_t)len * escape_len;
+    size_t symbols = 0;
+    size_t best = SIZE_MAX;
+    pp->K = 0;
+    for (int k = 1; k <= limit; k++) {
+        const pair_token *tok = &pp->tokens[k - 1];
+        int width = 1 + tok->pair;
+        bits -= (uint64_t)tok->freq * (escape_len * (uint64_t)width - cbc_cycles[k - 1].len);
+        symbols += (size_t)width;
+        size_t header = 2 + (size_t)(k + 7) / 8 + symbols;
+        size_t size = header + (size_t)((bits + 7) / 8);
+        if (size < best) {
+            best = size;
+            pp->K = k;
+            pp->header_size = header;
+            pp->payload_size = (size_t)((bits + 7) / 8);
+        }
+    }
+}
+
+// Writes the header and payload of the plan built last
+static void pairs_emit(pair_plan *pp, const uint8_t *in, size_t len,
+                       int max_len, uint8_t *h, size_t cap) {
+    CodeWord *words = pp->words;
+    CodeWord *pair_words = pp->pair_words;
+    for (int c = 0; c < ALPHABET_SIZE; c++) {
+        words[c].bits = (uint32_t)c;   // escape, after max_len zeros
+        words[c].len = (uint8_t)(max_len + 8);
+    }
+    for (int p = 0; p < pp->n_cand; p++) pair_words[p].len = 0;
+
+    int K = pp->K;
+    size_t bitmap = (size_t)(K + 7) / 8;
+    h[0] = (uint8_t)(max_len | CBC_BOUNDED_PAIRS);
+    h[1] = (uint8_t)K;
+    memset(h + 2, 0, bitmap);
+    uint8_t *sym = h + 2 + bitmap;
+    for (int i = 0; i < K; i++) {
+        const pair_token *tok = &pp->tokens[i];
+        CodeWord w = {cbc_cycles[i].bits, cbc_cycles[i].len};
+        if (tok->pair) {
+            h[2 + i / 8] |= (uint8_t)(1u << (i % 8));
+            *sym++ = (uint8_t)(tok->value >> 8);
+            *sym++ = (uint8_t)tok->value;
+            pair_words[pair_slot(pp, (uint8_t)(tok->value >> 8), (uint8_t)tok->value) - 1] = w;
+        } else {
+            *sym++ = (uint8_t)tok->value;
+            words[tok->value] = w;
+        }
+    }
+
+    BitWriter64 bw;
+    bw64_init_buffer(&bw, h + pp->header_size, cap - pp->header_size);
+    for (size_t i = 0; i < len;) {
+        unsigned s = i + 1 < len ? pair_slot(pp, in[i], in[i + 1]) : 0;
+        if (s && pair_words[s - 1].len) {
+            bw64_put_bits(&bw, pair_words[s - 1].bits, pair_words[s - 1].len);
+            i += 2;
+        } else if (s) {
+            // pair ranked past K: one escape per byte, as planned, even
+            // where a byte has its own cycle
+            bw64_put_bits(&bw, in[i], max_len + 8);
+            bw64_put_bits(&bw, in[i + 1], max_len + 8);
+            i += 2;
+        } else {
+            bw64_put_symbol(&bw, words, in[i]);
+            i++;
+        }
+    }
+    bw64_finish(&bw);
+}
+
+// pp and sorted (2 * (len - 1) values) are only used when len >= 2 *
+// CBC_PAIRS_MIN_COUNT
+static int compress_pairs(cbc_scratch *sc, pair_plan *pp, uint16_t *sorted,
+                          const uint8_t *in, size_t len, int max_len,
+                          uint8_t *out, size_t out_cap, size_t *written) {
+    *written = 0;
+    stats_begin();
+    if ((!in && len > 0) || len > INT_MAX) return CBC_ERR_INPUT;
+    if (max_len == 0) max_len = MAX_CODE_LENGTH;
+    if (max_len < 2 || max_len > MAX_CODE_LENGTH) return CBC_ERR_INPUT;
+
+    // The single-byte frame, planned once; its ranking stays in sc->codes
+    // for the fallbacks below, as the pair planning only uses pp
+    container_plan cp;
+    container_plan_build(sc, in, len, max_len, &cp);
+    if (len < 2 * CBC_PAIRS_MIN_COUNT) {
+        return container_emit(sc, &cp, in, len, max_len, out, out_cap, written);
+    }
+    pairs_candidates(pp, in, len, sorted);
+    if (pp->n_cand == 0) {
+        return container_emit(sc, &cp, in, len, max_len, out, out_cap, written);
+    }
+
+    // Pair counts 1, 2, 4, ... n_cand; each step gives the next
+    // candidates a slot
+    size_t best = cp.size;
+    int best_P = 0;
+    int n_cand = pp->n_cand;
+    for (int P = 1, prev = 0; prev < n_cand; prev = P, P *= 2) {
+        if (P > n_cand) P = n_cand;
+        for (int p = prev; p < P; p++) pair_set_slot(pp, pp->cand[p], (unsigned)(p + 1));
+        pp->n_cand = P;
+        pairs_plan_build(pp, in, len, max_len);
+        size_t size = container_prefix_size(len, pp->header_size) +
+                      pp->header_size + pp->payload_size;
+        if (pp->K > 0 && size < best) {
+            best = size;
+            best_P = P;
+        }
+    }
+    if (best_P == 0) {
+        return container_emit(sc, &cp, in, len, max_len, out, out_cap, written);
+    }
+
+    // Rebuild the winning plan
+    for (int p = best_P; p < n_cand; p++) pair_set_slot(pp, pp->cand[p], 0);
+    pp->n_cand = best_P;
+    pairs_plan_build(pp, in, len, max_len);
+
+    *written = best;
+    if (!out || best > out_cap) return CBC_ERR_OVERFLOW;
+    size_t prefix = put_container_prefix(out, CBC_CF_BOUNDED, len, pp->header_size);
+    pairs_emit(pp, in, len, max_len, out + prefix, out_cap - prefix);
+    stats_message(pp->K, len, best, prefix + pp->header_size);
+    return CBC_OK;
+}
+
+int cbc_compress_container_pairs_into(const uint8_t *in, size_t len, int max_len,
+                                      uint8_t *out, size_t out_cap,
+                                      size_t *written) {
+    *written = 0;
+    if ((!in && len > 0) || len > INT_MAX) return CBC_ERR_INPUT;
+    if (len > (SIZE_MAX - sizeof(pair_plan)) / (2 * sizeof(uint16_t))) {
+        return CBC_ERR_NOMEM;
+    }
+
+    cbc_scratch sc;
+    scratch_init(&sc);
+    pair_plan *pp = NULL;
+    if (len >= 2 * CBC_PAIRS_MIN_COUNT) {
+        // The plan and the sort buffer in one block
+        pp = malloc(sizeof(pair_plan) + 2 * (len - 1) * sizeof(uint16_t));
+        if (!pp) return CBC_ERR_NOMEM;
+    }
+    int status = compress_pairs(&sc, pp, pp ? (uint16_t *)(pp + 1) : NULL,
+                                in, len, max_len, out, out_cap, written);
+    free(pp);
+    return status;
+}
+
+// ------------------------------------------------------------
+// Indexed container
+//
+// A CBC_CF_INDEXED frame is one bit payload with a checkpoint every
+// `interval` symbols, so a slice decodes from the nearest checkpoint
+// instead of from the start of the message. Header:
+//   [varint: interval]
+//   [n x (u64 payload bit position, u32 table offset)]   n = ceil(len / interval)
+//   [tables: [K] [K symbols] ...]
+// Index integers are little-endian; table offsets count from the start
+// of the header. Symbol i * interval starts at bit position & 7 of
+// payload byte position >> 3, and its checkpoint's table codes the
+// segment as in the bounded layout with N = MAX_CODE_LENGTH: ranks get
+// cycles, any other byte the escape 0^N + 8 bits.
+//
+// Each block of block_size symbols (a multiple of interval) gets its own
+// ranking, and consecutive blocks with the same ranking share one table.
+// The header size varint is padded to a fixed width so the tables can be
+// written at their final place while the header is still being sized.
+// ------------------------------------------------------------
+
+#define INDEX_ENTRY 12   // bytes per checkpoint
+
+static void put_le(uint8_t *p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint64_t get_le(const uint8_t *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+// LEB128 padded with continuation bytes to exactly width bytes
+static void put_varint_fixed(uint8_t *p, uint64_t v, size_t width) {
+    for (size_t i = 0; i + 1 < width; i++) {
+        p[i] = (uint8_t)((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    p[width - 1] = (uint8_t)v;
+}
+
+// Largest header: every block with its own table of 255 symbols
+static size_t indexed_header_max(size_t len, size_t interval, size_t block_size) {
+    size_t n = len / interval + (len % interval != 0);
+    size_t blocks = len / block_size + (len % block_size != 0);
+    return varint_size(interval) + n * INDEX_ENTRY + blocks * 256;
+}
+
+size_t cbc_max_indexed_size(size_t len, size_t interval, size_t block_size) {
+    if (interval == 0 || block_size == 0) return 0;
+    size_t header_max = indexed_header_max(len, interval, block_size);
+    // Escapes are the longest codes: N + 8 = 32 bits
+    return 2 + varint_size(len) + varint_size(header_max) + header_max + len * 4;
+}
+
+// Leaves sc clean: scratch_rank clears freq, and pass 2 clears the words
+// it loaded
+static int compress_indexed(cbc_scratch *sc, const uint8_t *in, size_t len,
+                            size_t interval, size_t block_size,
+                            uint8_t *out, size_t out_cap, size_t *written) {
+    *written = 0;
+    stats_begin();
+    if (!in && len > 0) return CBC_ERR_INPUT;
+    if (interval == 0 || block_size < interval || block_size % interval != 0 ||
+        block_size > INT_MAX) {
+        return CBC_ERR_INPUT;
+    }
+    size_t header_max = indexed_header_max(len, interval, block_size);
+    if (header_max > UINT32_MAX) return CBC_ERR_INPUT;
+
+    const size_t n = len / interval + (len % interval != 0);
+    const size_t prefix = 2 + varint_size(len) + varint_size(header_max);
+    const size_t index_pos = varint_size(interval);
+    const size_t per_block = block_size / interval;
+    int fits = out && out_cap >= prefix + index_pos + n * INDEX_ENTRY;
+    uint8_t *header = fits ? out + prefix : NULL;
+
+    // Pass 1: rank every block, write its table (or point at the previous
+    // one) and total the payload bits
+    uint8_t prev[ALPHABET_SIZE];
+    int prev_K = 0;
+    size_t table = 0;
+    size_t header_size = index_pos + n * INDEX_ENTRY;
+    uint64_t bits = 0;
+    for (size_t start = 0, c = 0; start < len; start += block_size, c += per_block) {
+        size_t blen = len - start < block_size ? len - start : block_size;
+        bounded_plan p;
+        bounded_plan_build(sc, in + start, blen, MAX_CODE_LENGTH, &p);
+
+        int K = p.bounded_K;
+        uint64_t block_bits = p.bounded_bits;
+        if (p.plain_payload != SIZE_MAX &&
+            (size_t)p.K + p.plain_payload <= (size_t)p.bounded_K + p.bounded_payload) {
+            K = p.K;
+            block_bits = p.plain_bits;
+        }
+        bits += block_bits;
+
+        int same = K == prev_K;
+        for (int i = 0; same && i < K; i++) same = prev[i] == sc->codes[i].symbol;
+        if (!same) {
+            table = header_size;
+            header_size += 1 + (size_t)K;
+            fits = fits && out_cap >= prefix + header_size;
+            prev_K = K;
+            for (int i = 0; i < K; i++) prev[i] = sc->codes[i].symbol;
+            if (fits) {
+                header[table] = (uint8_t)K;
+                memcpy(header + table + 1, prev, (size_t)K);
+            }
+        }
+        size_t last = c + per_block < n ? c + per_block : n;
+        for (size_t i = c; fits && i < last; i++) {
+            put_le(header + index_pos + i * INDEX_ENTRY + 8, table, 4);
+        }
+    }
+
+    size_t payload_size = (size_t)((bits + 7) / 8);
+    *written = prefix + header_size + payload_size;
+    if (!fits || *written > out_cap) return CBC_ERR_OVERFLOW;
+
+    out[0] = CBC_CONTAINER_MAGIC;
+    out[1] = (uint8_t)(CBC_CONTAINER_VERSION << 4 | CBC_CF_INDEXED);
+    size_t pos = 2 + put_varint(out + 2, len);
+    put_varint_fixed(out + pos, header_size, varint_size(header_max));
+    put_varint(header, interval);
+
+    // Pass 2: encode with each checkpoint's table, recording where every
+    // segment starts
+    BitWriter64 bw;
+    bw64_init_buffer(&bw, header + header_size, payload_size);
+    uint64_t bit_pos = 0;
+    size_t loaded = SIZE_MAX;
+    for (size_t c = 0; c < n; c++) {
+        uint8_t *entry = header + index_pos + c * INDEX_ENTRY;
+        size_t t = (size_t)get_le(entry + 8, 4);
+        if (t != loaded) {
+            for (int b = 0; b < ALPHABET_SIZE; b++) {
+                sc->words[b].bits = (uint32_t)b;   // after N leading zeros
+                sc->words[b].len = MAX_CODE_LENGTH + 8;
+            }
+            for (int i = 0; i < header[t]; i++) {
+                CodeWord *w = &sc->words[header[t + 1 + i]];
+                w->bits = cbc_cycles[i].bits;
+                w->len = cbc_cycles[i].len;
+            }
+            loaded = t;
+        }
+        put_le(entry, bit_pos, 8);
+
+        size_t end = (c + 1) * interval < len ? (c + 1) * interval : len;
+        for (size_t i = c * interval; i < end; i++) {
+            const CodeWord w = sc->words[in[i]];
+            bw64_put_bits(&bw, w.bits, w.len);
+            bit_pos += w.len;
+        }
+    }
+    bw64_finish(&bw);
+    if (loaded != SIZE_MAX) {
+        for (int b = 0; b < ALPHABET_SIZE; b++) sc->words[b].len = 0;
+    }
+    stats_message(prev_K, len, *written, *written - payload_size);
+    return CBC_OK;
+}
+
+int cbc_compress_indexed_into(const uint8_t *in, size_t len,
+                              size_t interval, size_t block_size,
+                              uint8_t *out, size_t out_cap, size_t *written) {
+    cbc_scratch sc;
+    scratch_init(&sc);
+    return compress_indexed(&sc, in, len, interval, block_size, out, out_cap,
+                            written);
+}
+
+// ------------------------------------------------------------
+// Batch compression
+//
+// Compresses msgs[0..n) back to back into one arena, each in the framed
+// format so that any record decodes on its own. Record i occupies
+// arena[offsets[i] .. offsets[i + 1]), so offsets holds n + 1 entries.
+// The scratch tables are set up once and reused by every message, and the
+// next record is prefetched while the current one is encoded.
+//
+// On CBC_ERR_OVERFLOW, offsets[0..i] describe the records that fit.
+// ------------------------------------------------------------
+
+// Arena size that always fits the batch
+size_t cbc_max_batch_size(const cbc_msg *msgs, size_t n) {
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        total += cbc_max_framed_size(msgs[i].len, 255);
+    }
+    return total;
+}
+
+static int compress_batch(cbc_scratch *sc, const cbc_msg *msgs, size_t n,
+                          uint8_t *arena, size_t arena_cap, size_t *offsets) {
+    size_t pos = 0;
+    offsets[0] = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i + 1 < n) CBC_PREFETCH(msgs[i + 1].data);
+
+        size_t written = 0;
+        int status = compress_message(sc, msgs[i].data, msgs[i].len, 1,
+                                      arena ? arena + pos : NULL,
+                                      arena_cap - pos, &written);
+        if (status != CBC_OK) return status;
+        pos += written;
+        offsets[i + 1] = pos;
+    }
+    return CBC_OK;
+}
+
+int cbc_compress_batch(const cbc_msg *msgs, size_t n,
+                       uint8_t *arena, size_t arena_cap, size_t *offsets) {
+    cbc_scratch sc;
+    scratch_init(&sc);
+    return compress_batch(&sc, msgs, n, arena, arena_cap, offsets);
+}
+
+// ------------------------------------------------------------
+// Compression context
+//
+// A cbc_ctx holds everything the encoders otherwise take from the stack
+// (scratch tables, sub-histograms, radix buffers: about 16 KB) or from
+// malloc (the byte-pair plan and its sort buffer), plus an output buffer
+// for cbc_ctx_compress. It is laid out in one block:
+//   [cbc_ctx] [pair_plan] [2 * max_msg sort values] [output buffer]
+// with the pair part only present with CBC_CTX_PAIRS. The scratch tables
+// are left clean by every call, so nothing is reset between messages and
+// the tables stay warm in cache. A context from an allocator replaces
+// its buffers when a message outgrows them; a static one reports
+// CBC_ERR_NOMEM instead.
+// ------------------------------------------------------------
+
+#define CBC_CTX_ALIGN 16
+
+struct cbc_ctx {
+    cbc_scratch sc;
+    cbc_work work;
+    cbc_allocator alloc;   // alloc == NULL for a static context
+    int flags;             // CBC_CTX_* the buffers have room for
+    size_t max_msg;        // longest message the buffers hold
+    pair_plan *pairs;      // with CBC_CTX_PAIRS
+    uint16_t *sorted;
+    uint8_t *out;          // cbc_max_container_size(max_msg) bytes
+    void *grown;           // buffers allocated after creation
+};
+
+static size_t ctx_round(size_t n) {
+    return (n + CBC_CTX_ALIGN - 1) & ~(size_t)(CBC_CTX_ALIGN - 1);
+}
+
+// Bytes of the buffers after the context, 0 if max_msg is too large
+static size_t ctx_buffers_size(size_t max_msg, int flags) {
+    if (max_msg > SIZE_MAX / 8) return 0;
+    size_t size = ctx_round(cbc_max_container_size(max_msg));
+    if (flags & CBC_CTX_PAIRS) {
+        size += ctx_round(sizeof(pair_plan) + 2 * max_msg * sizeof(uint16_t));
+    }
+    return size;
+}
+
+static void ctx_set_buffers(cbc_ctx *ctx, uint8_t *p, size_t max_msg, int flags) {
+    ctx->flags = flags;
+    ctx->max_msg = max_msg;
+    ctx->pairs = NULL;
+    ctx->sorted = NULL;
+    if (flags & CBC_CTX_PAIRS) {
+        ctx->pairs = (pair_plan *)p;
+        ctx->sorted = (uint16_t *)(ctx->pairs + 1);
+        p += ctx_round(sizeof(pair_plan) + 2 * max_msg * sizeof(uint16_t));
+    }
+    ctx->out = p;
+}
+
+static cbc_ctx *ctx_init(void *mem, const cbc_allocator *alloc,
+                         size_t max_msg, int flags) {
+    cbc_ctx *ctx = (cbc_ctx *)mem;
+    scratch_init(&ctx->sc);
+    ctx->sc.work = &ctx->work;
+    if (alloc) {
+        ctx->alloc = *alloc;
+    } else {
+        memset(&ctx->alloc, 0, sizeof(ctx->alloc));
+    }
+    ctx->grown = NULL;
+    ctx_set_buffers(ctx, (uint8_t *)mem + ctx_round(sizeof(cbc_ctx)), max_msg, flags);
+    return ctx;
+}
+
+size_t cbc_ctx_size(size_t max_msg, int flags) {
+    size_t buffers = ctx_buffers_size(max_msg, flags);
+    if (buffers == 0) return 0;
+    return CBC_CTX_ALIGN - 1 + ctx_round(sizeof(cbc_ctx)) + buffers;
+}
+
+cbc_ctx *cbc_ctx_init_static(void *mem, size_t size, size_t max_msg, int flags) {
+    size_t need = cbc_ctx_size(max_msg, flags);
+    if (!mem || need == 0 || size < need) return NULL;
+    uintptr_t aligned = ((uintptr_t)mem + CBC_CTX_ALIGN - 1) &
+                        ~(uintptr_t)(CBC_CTX_ALIGN - 1);
+    return ctx_init((void *)aligned, NULL, max_msg, flags);
+}
+
+static void *heap_alloc(void *user, size_t size) {
+    (void)user;
+    return malloc(size);
+}
+
+static void heap_free(void *user, void *ptr) {
+    (void)user;
+    free(ptr);
+}
+
+// What a NULL cbc_allocator stands for
+static const cbc_allocator heap_allocator = {heap_alloc, heap_free, NULL};
+
+cbc_ctx *cbc_ctx_create(const cbc_allocator *alloc, size_t max_msg, int flags) {
+    if (!alloc) alloc = &heap_allocator;
+    if (!alloc->alloc || !alloc->free) return NULL;
+
+    // The allocator returns aligned blocks, so no slack is needed
+    size_t buffers = ctx_buffers_size(max_msg, flags);
+    if (buffers == 0) return NULL;
+    void *mem = alloc->alloc(alloc->user, ctx_round(sizeof(cbc_ctx)) + buffers);
+    return mem ? ctx_init(mem, alloc, max_msg, flags) : NULL;
+}
+
+void cbc_ctx_free(cbc_ctx *ctx) {
+    if (!ctx || !ctx->alloc.alloc) return;
+    cbc_allocator alloc = ctx->alloc;
+    if (ctx->grown) alloc.free(alloc.user, ctx->grown);
+    alloc.free(alloc.user, ctx);
+}
+
+// Makes the buffers hold a len-byte message, with the pair plan if
+// flags asks for it; grown buffers at least double, so a gateway settles
+// on its largest message after a few allocations
+static int ctx_reserve(cbc_ctx *ctx, size_t len, int flags) {
+    flags |= ctx->flags;
+    if (len <= ctx->max_msg && flags == ctx->flags) return CBC_OK;
+    if (!ctx->alloc.alloc) return CBC_ERR_NOMEM;
+
+    size_t max_msg = ctx->max_msg;
+    if (len > max_msg) max_msg = len / 2 > max_msg ? len : 2 * max_msg;
+    size_t size = ctx_buffers_size(max_msg, flags);
+    if (size == 0) return CBC_ERR_NOMEM;
+    void *p = ctx->alloc.alloc(ctx->alloc.user, size);
+    if (!p) return CBC_ERR_NOMEM;
+    if (ctx->grown) ctx->alloc.free(ctx->alloc.user, ctx->grown);
+    ctx->grown = p;
+    ctx_set_buffers(ctx, p, max_msg, flags);
+    return CBC_OK;
+}
+
+int cbc_ctx_compress_into(cbc_ctx *ctx, const uint8_t *in, size_t len,
+                          uint8_t *out, size_t out_cap, size_t *written) {
+    return compress_message(&ctx->sc, in, len, 0, out, out_cap, written);
+}
+
+int cbc_ctx_compress_framed_into(cbc_ctx *ctx, const uint8_t *in, size_t len,
+                                 uint8_t *out, size_t out_cap, size_t *written) {
+    return compress_message(&ctx->sc, in, len, 1, out, out_cap, written);
+}
+
+int cbc_ctx_compress_bounded_into(cbc_ctx *ctx, const uint8_t *in, size_t len,
+                                  int max_len, uint8_t *out, size_t out_cap,
+                                  size_t *written) {
+    return compress_bounded(&ctx->sc, in, len, max_len, out, out_cap, written);
+}
+
+int cbc_ctx_compress_container_into(cbc_ctx *ctx, const uint8_t *in, size_t len,
+                                    int max_len, uint8_t *out, size_t out_cap,
+                                    size_t *written) {
+    return compress_container(&ctx->sc, in, len, max_len, out, out_cap, written);
+}
+
+int cbc_ctx_compress_container_pairs_into(cbc_ctx *ctx, const uint8_t *in,
+                                          size_t len, int max_len,
+                                          uint8_t *out, size_t out_cap,
+                                          size_t *written) {
+    *written = 0;
+    if ((!in && len > 0) || len > INT_MAX) return CBC_ERR_INPUT;
+    if (len >= 2 * CBC_PAIRS_MIN_COUNT) {
+        int status = ctx_reserve(ctx, len, CBC_CTX_PAIRS);
+        if (status != CBC_OK) return status;
+    }
+    return compress_pairs(&ctx->sc, ctx->pairs, ctx->sorted, in, len, max_len,
+                          out, out_cap, written);
+}
+
+int cbc_ctx_compress_indexed_into(cbc_ctx *ctx, const uint8_t *in, size_t len,
+                                  size_t interval, size_t block_size,
+                                  uint8_t *out, size_t out_cap, size_t *written) {
+    return compress_indexed(&ctx->sc, in, len, interval, block_size, out, out_cap,
+                            written);
+}
+
+int cbc_ctx_compress_batch(cbc_ctx *ctx, const cbc_msg *msgs, size_t n,
+                           uint8_t *arena, size_t arena_cap, size_t *offsets) {
+    return compress_batch(&ctx->sc, msgs, n, arena, arena_cap, offsets);
+}
+
+int cbc_ctx_compress(cbc_ctx *ctx, const uint8_t *in, size_t len, int max_len,
+                     const uint8_t **out, size_t *out_size) {
+    *out = NULL;
+    *out_size = 0;
+    if ((!in && len > 0) || len > INT_MAX) return CBC_ERR_INPUT;
+    int status = ctx_reserve(ctx, len, 0);
+    if (status != CBC_OK) return status;
+    status = compress_container(&ctx->sc, in, len, max_len, ctx->out,
+                                cbc_max_container_size(ctx->max_msg), out_size);
+    if (status == CBC_OK) *out = ctx->out;
+    return status;
+}
+
+// ------------------------------------------------------------
+// Shared dictionary
+//
+// Compressed format:
+//   [1 byte: dictionary id] [bit payload]
+//
+// The ranking is trained offline from a corpus with the same ordering as
+// per-message tables (compare_codeentry), so frames carry no symbol list.
+// Byte values never seen in the corpus are ranked after the seen ones, in
+// symbol order, which keeps every message encodable.
+// ------------------------------------------------------------
+
+static void dict_build_words(cbc_dict *dict) {
+    memset(dict->words, 0, sizeof(dict->words));
+    for (int i = 0; i < dict->K; i++) {
+        CodeWord *w = &dict->words[dict->symbols[i]];
+        w->bits = cbc_cycles[i].bits;
+        w->len = cbc_cycles[i].len;
+    }
+}
+
+// Rank all 256 byte values by their total frequency over samples[0..n)
+int cbc_dict_train(cbc_dict *dict, uint8_t id,
+                   const uint8_t *const *samples, const size_t *lens, size_t n) {
+    int freq_table[ALPHABET_SIZE] = {0};
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (lens[i] > (size_t)INT_MAX - total) return CBC_ERR_INPUT;
+        total += lens[i];
+        cbc_count_frequency(samples[i], lens[i], freq_table);
+    }
+
+    CodeEntry codes[ALPHABET_SIZE];
+    for (int c = 0; c < ALPHABET_SIZE; c++) {
+        codes[c].symbol = (unsigned char)c;
+        codes[c].freq = freq_table[c];
+    }
+    rank_codes(codes, ALPHABET_SIZE);
+
+    dict->id = id;
+    dict->K = ALPHABET_SIZE;
+    for (int i = 0; i < ALPHABET_SIZE; i++) {
+        dict->symbols[i] = codes[i].symbol;
+    }
+    dict_build_words(dict);
+    return CBC_OK;
+}
+
+// Rebuild a dictionary from a stored ranking of K distinct symbols
+int cbc_dict_load(cbc_dict *dict, uint8_t id, const uint8_t *symbols, int K) {
+    if (K < 1 || K > ALPHABET_SIZE) return CBC_ERR_INPUT;
+    int seen[ALPHABET_SIZE] = {0};
+    for (int i = 0; i < K; i++) {
+        if (seen[symbols[i]]++) return CBC_ERR_INPUT;
+    }
+
+    dict->id = id;
+    dict->K = K;
+    memcpy(dict->symbols, symbols, (size_t)K);
+    dict_build_words(dict);
+    return CBC_OK;
+}
+
+// Payload bits of in under a shared ranking, CBC_ERR_SYMBOLS if a byte
+// has no code
+static int dict_payload_bits(const cbc_dict *dict, const uint8_t *in, size_t len,
+                             uint64_t *bits) {
+    int freq[ALPHABET_SIZE] = {0};
+    cbc_count_frequency(in, len, freq);
+    *bits = 0;
+    for (int c = 0; c < ALPHABET_SIZE; c++) {
+        if (freq[c] == 0) continue;
+        if (dict->words[c].len == 0) return CBC_ERR_SYMBOLS;
+        *bits += (uint64_t)freq[c] * dict->words[c].len;
+    }
+    return CBC_OK;
+}
+
+int cbc_compress_dict_into(const cbc_dict *dict, const uint8_t *in, size_t len,
+                           uint8_t *out, size_t out_cap, size_t *written) {
+    *written = 0;
+    stats_begin();
+    if (len == 0) return CBC_OK;
+    if (!in) return CBC_ERR_INPUT;
+    if (!out || out_cap < 1) {
+        // Size probe: the exact size from the histogram, as
+        // cbc_estimate_size computes it
+        uint64_t bits = 0;
+        int status = dict_payload_bits(dict, in, len, &bits);
+        if (status != CBC_OK) return status;
+        *written = 1 + (size_t)((bits + 7) / 8);
+        return CBC_ERR_OVERFLOW;
+    }
+
+    out[0] = dict->id;
+
+    // Single pass: the code words are fixed, so no counting is needed
+    STATS_START(t);
+    BitWriter64 bw;
+    bw64_init_buffer(&bw, out + 1, out_cap - 1);
+    uint64_t bits = 0;
+    for (size_t i = 0; i < len; i++) {
+        const CodeWord w = dict->words[in[i]];
+        if (w.len == 0) return CBC_ERR_SYMBOLS;  // not in a loaded ranking
+        bw64_put_bits(&bw, w.bits, w.len);
+        bits += w.len;
+    }
+    bw64_finish(&bw);
+    STATS_STAGE(CBC_STAGE_ENCODE, t);
+
+    *written = 1 + (size_t)((bits + 7) / 8);
+    if (bw.overflow) return CBC_ERR_OVERFLOW;
+    stats_message(dict->K, len, *written, 1);
+    return CBC_OK;
+}
+
+// ------------------------------------------------------------
+// Size estimation
+//
+// Exact output size of an encoder without running it: the histogram and
+// the ranking fix every code length, so the size is 1 + K + ceil(sum of
+// freq * (m + j) / 8) plus the layout's framing. Every encoder already
+// stops after planning when given no output buffer and reports the exact
+// size, so each mode reuses one; the dictionary encoders sum the fixed
+// code lengths over the histogram. Nothing is allocated or emitted.
+// ------------------------------------------------------------
+
+int cbc_estimate_size(const cbc_dict *dict, const uint8_t *in, size_t len,
+                      int mode, int max_len, size_t *size) {
+    *size = 0;
+    if (!in && len > 0) return CBC_ERR_INPUT;
+
+    int status;
+    switch (mode) {
+    case CBC_EST_PLAIN:
+        status = cbc_compress_into(in, len, NULL, 0, size);
+        break;
+    case CBC_EST_FRAMED:
+        status = cbc_compress_framed_into(in, len, NULL, 0, size);
+        break;
+    case CBC_EST_BOUNDED:
+        status = cbc_compress_bounded_into(in, len, max_len, NULL, 0, size);
+        break;
+    case CBC_EST_CONTAINER:
+        status = cbc_compress_container_into(in, len, max_len, NULL, 0, size);
+        break;
+    case CBC_EST_DICT:
+        if (!dict) return CBC_ERR_INPUT;
+        status = cbc_compress_dict_into(dict, in, len, NULL, 0, size);
+        break;
+    case CBC_EST_CONTAINER_DICT:
+        if (!dict) return CBC_ERR_INPUT;
+        status = cbc_compress_container_dict_into(dict, in, len, NULL, 0, size);
+        break;
+    default:
+        return CBC_ERR_INPUT;
+    }
+    // The encoders report the size they would need as an overflow
+    return status == CBC_ERR_OVERFLOW ? CBC_OK : status;
+}
+
+// ------------------------------------------------------------
+// Streaming
+//
+// Stream format: a sequence of blocks, then an end marker.
+//   [1 byte: CBC_BLOCK_TABLE]   [K] [K symbols] [varint n] [varint bytes] [payload]
+//   [1 byte: CBC_BLOCK_INHERIT] [varint n] [varint bytes] [payload]
+//   [1 byte: CBC_BLOCK_RAW]     [varint n] [n bytes]
+//   [1 byte: CBC_BLOCK_END]
+//
+// n is the number of symbols in the block (<= block_size) and bytes the
+// payload size. A block reuses the previous table whenever that is not
+// larger than sending its own. A block of all 256 byte values is stored
+// raw and leaves the previous table in place for the next block. Memory
+// stays at one input block plus one encoded block whatever the stream
+// length.
+// ------------------------------------------------------------
+
+// Capacity needed for one encoded block of block_size bytes
+static size_t stream_frame_cap(size_t block_size) {
+    return 1 + cbc_max_compressed_size(block_size, 255) + 2 * CBC_VARINT_MAX;
+}
+
+void cbc_stream_free(cbc_stream *st) {
+    if (st->block) st->alloc.free(st->alloc.user, st->block);
+    if (st->bw.data) st->alloc.free(st->alloc.user, st->bw.data);
+    st->block = NULL;
+    bw64_free(&st->bw);
+}
+
+int cbc_stream_init(cbc_stream *st, size_t block_size,
+                    cbc_write_fn write, void *user) {
+    return cbc_stream_init_alloc(st, block_size, write, user, NULL);
+}
+
+int cbc_stream_init_alloc(cbc_stream *st, size_t block_size,
+                          cbc_write_fn write, void *user,
+                          const cbc_allocator *alloc) {
+    if (!alloc) alloc = &heap_allocator;
+    if (block_size == 0 || block_size > INT_MAX || !write ||
+        !alloc->alloc || !alloc->free) {
+        return CBC_ERR_INPUT;
+    }
+
+    st->block_size = block_size;
+    st->block_len = 0;
+    st->K = 0;
+    st->write = write;
+    st->user = user;
+    st->alloc = *alloc;
+    size_t cap = cbc_max_compressed_size(block_size, 255);
+    st->block = (uint8_t *)alloc->alloc(alloc->user, block_size);
+    // Sized for the worst case, never reallocated
+    bw64_init_buffer(&st->bw, (unsigned char *)alloc->alloc(alloc->user, cap), cap);
+    if (!st->block || !st->bw.data) {
+        cbc_stream_free(st);
+        return CBC_ERR_NOMEM;
+    }
+    return CBC_OK;
+}
+
+// Encode the pending block and pass it to the sink
+static int stream_flush_block(cbc_stream *st) {
+    if (st->block_len == 0) return CBC_OK;
+    stats_begin();
+
+    int freq_table[ALPHABET_SIZE] = {0};
+    cbc_count_frequency(st->block, st->block_len, freq_table);
+    CodeEntry codes[ALPHABET_SIZE];
+    int K = build_code_table(freq_table, codes);
+    if (K > 255) {
+        uint8_t header[1 + CBC_VARINT_MAX];
+        size_t h = 0;
+        header[h++] = CBC_BLOCK_RAW;
+        h += put_varint(header + h, st->block_len);
+        size_t n = st->block_len;
+        stats_message(0, n, h + n, h);
+        st->block_len = 0;
+
+        if (st->write(st->user, header, h) != 0) return CBC_ERR_IO;
+        if (st->write(st->user, st->block, n) != 0) return CBC_ERR_IO;
+        return CBC_OK;
+    }
+
+    // Cost of the inherited table, if it covers every symbol of the block
+    uint64_t own_bits = payload_bits(codes, K) + 8 * (1 + (uint64_t)K);
+    int inherit = st->K > 0;
+    uint64_t inherited_bits = 0;
+    for (int i = 0; i < K && inherit; i++) {
+        const CodeWord w = st->words[codes[i].symbol];
+        if (w.len == 0) inherit = 0;
+        inherited_bits += (uint64_t)codes[i].freq * w.len;
+    }
+
+    uint8_t header[3 + ALPHABET_SIZE + 2 * CBC_VARINT_MAX];
+    size_t h = 0;
+    if (inherit && inherited_bits <= own_bits) {
+        header[h++] = CBC_BLOCK_INHERIT;
+    } else {
+        header[h++] = CBC_BLOCK_TABLE;
+        header[h++] = (uint8_t)K;
+        st->K = K;
+        for (int i = 0; i < K; i++) {
+            header[h++] = codes[i].symbol;
+            st->symbols[i] = codes[i].symbol;
+        }
+        build_code_words(codes, K, st->words);
+    }
+
+    // Payload through the stream's writer
+    BitWriter64 *bw = &st->bw;
+    bw->size = 0;
+    for (size_t i = 0; i < st->block_len; i++) {
+        bw64_put_symbol(bw, st->words, st->block[i]);
+    }
+    bw64_finish(bw);
+
+    h += put_varint(header + h, st->block_len);
+    h += put_varint(header + h, bw->size);
+    stats_message(st->K, st->block_len, h + bw->size, h);
+    st->block_len = 0;
+
+    if (st->write(st->user, header, h) != 0) return CBC_ERR_IO;
+    if (st->write(st->user, bw->data, bw->size) != 0) return CBC_ERR_IO;
+    return CBC_OK;
+}
+
+int cbc_stream_update(cbc_stream *st, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        size_t take = st->block_size - st->block_len;
+        if (take > len) take = len;
+        memcpy(st->block + st->block_len, data, take);
+        st->block_len += take;
+        data += take;
+        len -= take;
+
+        if (st->block_len == st->block_size) {
+            int status = stream_flush_block(st);
+            if (status != CBC_OK) return status;
+        }
+    }
+    return CBC_OK;
+}
+
+// Flush the last partial block and write the end marker
+int cbc_stream_finish(cbc_stream *st) {
+    int status = stream_flush_block(st);
+    if (status != CBC_OK) return status;
+
+    const uint8_t end = CBC_BLOCK_END;
+    return st->write(st->user, &end, 1) == 0 ? CBC_OK : CBC_ERR_IO;
+}
+
+// ------------------------------------------------------------
+// Session (delta headers)
+//
+// Encoder and decoder each keep the table of the previous message, so a
+// session frame only describes how the table changed:
+//   [0x00] [payload]                                   same table
+//   [0x01] [K] [n] [n x (rank, symbol)] [payload]      edited table
+//   [0x02] [K] [K symbols] [payload]                   full table
+//
+// An edit sets symbols[rank]; the previous table is first cut or extended
+// to K entries, and every rank past the previous K must be edited. Edits
+// are sent in increasing rank order. The encoder ranks each message with
+// compare_codeentry as usual and sends the smallest of: the previous table
+// (if it holds every symbol of the message), the previous table with the
+// missing symbols appended, an edit to the message's own ranking, or that
+// ranking in full.
+// Both sides adopt the table of every frame, so they stay in sync as long
+// as no frame is lost; after a loss, reset both sessions.
+// ------------------------------------------------------------
+
+void cbc_session_init(cbc_session *s) {
+    memset(s, 0, sizeof(*s));
+    s->drift = CBC_SESSION_DRIFT_DEFAULT;
+}
+
+// Upper bound of a session frame for len bytes
+size_t cbc_max_session_size(size_t len) {
+    return len == 0 ? 0 : 1 + cbc_max_compressed_size(len, 255);
+}
+
+// Make symbols[0..K) the session table and rebuild its code words
+static void session_adopt(cbc_session *s, const uint8_t *symbols, int K) {
+    for (int i = 0; i < s->K; i++) s->words[s->symbols[i]].len = 0;
+    for (int i = 0; i < K; i++) {
+        s->symbols[i] = symbols[i];
+        CodeWord *w = &s->words[symbols[i]];
+        w->bits = cbc_cycles[i].bits;
+        w->len = cbc_cycles[i].len;
+    }
+    s->K = K;
+}
+
+// Payload bytes of a message with the given byte counts under symbols[0..K)
+static size_t table_payload_size(const int *freq_table, const uint8_t *symbols,
+                                 int K) {
+    uint64_t bits = 0;
+    for (int i = 0; i < K; i++) {
+        bits += (uint64_t)freq_table[symbols[i]] * cbc_cycles[i].len;
+    }
+    return (size_t)((bits + 7) / 8);
+}
+
+// Session frame for in[0..len), whose byte counts are sc->freq, with
+// the message's own ranking candidate in sc->codes[0..K); that ranking
+// must count every byte of the message
+static int session_emit(cbc_scratch *sc, cbc_session *s, int K,
+                        const uint8_t *in, size_t len,
+                        uint8_t *out, size_t out_cap, size_t *written) {
+    const int *freq_table = sc->freq;
+    const CodeEntry *codes = sc->codes;
+    if (K > 255) return CBC_ERR_SYMBOLS;
+
+    // Candidate tables: the message's own ranking, and the previous table
+    // with the symbols it lacks appended in rank order (no such symbol
+    // means the previous table itself)
+    uint8_t ranked[ALPHABET_SIZE];
+    for (int i = 0; i < K; i++) ranked[i] = codes[i].symbol;
+    int missing = 0;
+    for (int i = 0; i < K; i++) {
+        int c = codes[i].symbol;
+        missing += freq_table[c] > 0 && s->words[c].len == 0;
+    }
+    uint8_t appended[ALPHABET_SIZE];
+    int appended_K = s->K + missing;
+    if (s->K > 0 && appended_K <= 255) {
+        memcpy(appended, s->symbols, (size_t)s->K);
+        int a = s->K;
+        for (int i = 0; i < K; i++) {
+            int c = codes[i].symbol;
+            if (freq_table[c] > 0 && s->words[c].len == 0) appended[a++] = (uint8_t)c;
+        }
+    }
+
+    // Frame size of each option
+    int edits = 0;
+    for (int i = 0; i < K; i++) {
+        if (i >= s->K || s->symbols[i] != ranked[i]) edits++;
+    }
+    size_t ranked_payload = table_payload_size(freq_table, ranked, K);
+    size_t full_size = 2 + (size_t)K + ranked_payload;
+    size_t delta_size = 3 + 2 * (size_t)edits + ranked_payload;
+
+    size_t append_size = SIZE_MAX;
+    if (s->K > 0 && appended_K <= 255) {
+        append_size = (missing ? 3 + 2 * (size_t)missing : 1) +
+                      table_payload_size(freq_table, appended, appended_K);
+    }
+
+    uint8_t *p = out;
+    if (append_size <= delta_size && append_size <= full_size) {
+        *written = append_size;
+        if (!out || *written > out_cap) return CBC_ERR_OVERFLOW;
+        if (missing == 0) {
+            *p++ = CBC_SESSION_SAME;
+        } else {
+            *p++ = CBC_SESSION_DELTA;
+            *p++ = (uint8_t)appended_K;
+            *p++ = (uint8_t)missing;
+            for (int i = s->K; i < appended_K; i++) {
+                *p++ = (uint8_t)i;
+                *p++ = appended[i];
+            }
+            session_adopt(s, appended, appended_K);
+        }
+    } else if (delta_size < full_size) {
+        *written = delta_size;
+        if (!out || *written > out_cap) return CBC_ERR_OVERFLOW;
+        *p++ = CBC_SESSION_DELTA;
+        *p++ = (uint8_t)K;
+        *p++ = (uint8_t)edits;
+        for (int i = 0; i < K; i++) {
+            if (i >= s->K || s->symbols[i] != ranked[i]) {
+                *p++ = (uint8_t)i;
+                *p++ = ranked[i];
+            }
+        }
+        session_adopt(s, ranked, K);
+    } else {
+        *written = full_size;
+        if (!out || *written > out_cap) return CBC_ERR_OVERFLOW;
+        *p++ = CBC_SESSION_FULL;
+        *p++ = (uint8_t)K;
+        memcpy(p, ranked, (size_t)K);
+        p += K;
+        session_adopt(s, ranked, K);
+    }
+
+    size_t header_size = (size_t)(p - out);
+    encode_payload(in, len, s->words, p, out_cap - header_size);
+    stats_message(s->K, len, *written, header_size);
+    return CBC_OK;
+}
+
+static int session_compress(cbc_scratch *sc, cbc_session *s,
+                            const uint8_t *in, size_t len,
+                            uint8_t *out, size_t out_cap, size_t *written) {
+    *written = 0;
+    stats_begin();
+    if (len == 0) return CBC_OK;
+    if (!in || len > INT_MAX) return CBC_ERR_INPUT;
+
+    scratch_count(sc, in, len);
+    int K = scratch_build(sc, sc->freq);
+    int status = session_emit(sc, s, K, in, len, out, out_cap, written);
+    for (int i = 0; i < K; i++) sc->freq[sc->codes[i].symbol] = 0;
+    return status;
+}
+
+// Sessions keep their own code words, so only freq must start clean
+static void session_scratch_init(cbc_scratch *sc) {
+    memset(sc->freq, 0, sizeof(sc->freq));
+    sc->work = NULL;
+}
+
+int cbc_session_compress(cbc_session *s, const uint8_t *in, size_t len,
+                         uint8_t *out, size_t out_cap, size_t *written) {
+    cbc_scratch sc;
+    session_scratch_init(&sc);
+    return session_compress(&sc, s, in, len, out, out_cap, written);
+}
+
+int cbc_ctx_session_compress(cbc_ctx *ctx, cbc_session *s,
+                             const uint8_t *in, size_t len,
+                             uint8_t *out, size_t out_cap, size_t *written) {
+    return session_compress(&ctx->sc, s, in, len, out, out_cap, written);
+}
+
+// ------------------------------------------------------------
+// Cached ranking (single pass)
+//
+// cbc_session_compress_cached encodes with the session's table right away
+// and counts the bytes in the same loop, so the input is read once. The
+// counts feed a running histogram of the session (halved once it holds
+// CBC_SESSION_HIST_LIMIT symbols, so old traffic fades out). The table is
+// re-ranked from that histogram, through a regular delta or full frame,
+// only when:
+//   - a byte is missing from the table (the single pass is abandoned), or
+//   - the previous message cost more than drift percent over the
+//     estimated cost sum(freq * (m + j)) / sum(freq) of the histogram
+//     under the table at the last re-rank.
+// Frames are ordinary session frames.
+// ------------------------------------------------------------
+
+#define CBC_SESSION_HIST_LIMIT (1 << 16)
+
+// Add a message's counts to the running histogram
+static void session_add_counts(cbc_session *s, const int *freq_table) {
+    for (int c = 0; c < ALPHABET_SIZE; c++) s->hist[c] += freq_table[c];
+    for (int c = 0; c < ALPHABET_SIZE; c++) s->hist_total += (uint64_t)freq_table[c];
+    while (s->hist_total > CBC_SESSION_HIST_LIMIT) {
+        s->hist_total = 0;
+        for (int c = 0; c < ALPHABET_SIZE; c++) {
+            s->hist[c] >>= 1;
+            s->hist_total += (uint64_t)s->hist[c];
+        }
+    }
+}
+
+// Estimated cost of the histogram under the current table
+static void session_set_baseline(cbc_session *s) {
+    s->base_bits = 0;
+    s->base_symbols = 0;
+    for (int i = 0; i < s->K; i++) {
+        s->base_bits += (uint64_t)s->hist[s->symbols[i]] * cbc_cycles[i].len;
+        s->base_symbols += (uint64_t)s->hist[s->symbols[i]];
+    }
+}
+
+// Zeroes the counts of the single pass, which only saw table symbols
+static void session_clear_counts(cbc_scratch *sc, const cbc_session *s) {
+    for (int i = 0; i < s->K; i++) sc->freq[s->symbols[i]] = 0;
+}
+
+static int session_rerank(cbc_scratch *sc, cbc_session *s,
+                          const uint8_t *in, size_t len,
+                          uint8_t *out, size_t out_cap, size_t *written) {
+    int *freq_table = sc->freq;
+    scratch_count(sc, in, len);
+
+    // Rank by the histogram including this message; if that holds more
+    // than 255 symbols, by the message alone
+    int rank_freq[ALPHABET_SIZE];
+    int K = 0;
+    for (int c = 0; c < ALPHABET_SIZE; c++) {
+        rank_freq[c] = s->hist[c] + freq_table[c];
+        K += rank_freq[c] > 0;
+    }
+    K = scratch_build(sc, K > 255 ? freq_table : rank_freq);
+    int status = session_emit(sc, s, K, in, len, out, out_cap, written);
+    if (status == CBC_OK) {
+        session_add_counts(s, freq_table);
+        session_set_baseline(s);
+        s->stale = 0;
+    }
+    // The ranking covers every byte of the message
+    for (int i = 0; i < K; i++) freq_table[sc->codes[i].symbol] = 0;
+    return status;
+}
+
+static int session_compress_cached(cbc_scratch *sc, cbc_session *s,
+                                   const uint8_t *in, size_t len,
+                                   uint8_t *out, size_t out_cap, size_t *written) {
+    *written = 0;
+    stats_begin();
+    if (len == 0) return CBC_OK;
+    if (!in || len > INT_MAX - CBC_SESSION_HIST_LIMIT) return CBC_ERR_INPUT;
+    if (s->K == 0 || s->stale || !out || out_cap < 1) {
+        return session_rerank(sc, s, in, len, out, out_cap, written);
+    }
+
+    // Single pass: SAME frame with the cached code words, counting as we go
+    int *freq_table = sc->freq;
+    BitWriter64 bw;
+    bw64_init_buffer(&bw, out + 1, out_cap - 1);
+    uint64_t bits = 0;
+    for (size_t i = 0; i < len; i++) {
+        const CodeWord w = cbc_code_word(s->words, in[i]);
+        if (w.len == 0) {
+            session_clear_counts(sc, s);
+            return session_rerank(sc, s, in, len, out, out_cap, written);
+        }
+        freq_table[in[i]]++;
+        bits += w.len;
+        bw64_put_bits(&bw, w.bits, w.len);
+    }
+    bw64_finish(&bw);
+    *written = 1 + (size_t)((bits + 7) / 8);
+    if (bw.overflow) {
+        session_clear_counts(sc, s);
+        return CBC_ERR_OVERFLOW;
+    }
+    out[0] = CBC_SESSION_SAME;
+    stats_message(s->K, len, *written, 1);
+
+    // Drift check against the estimate from the last re-rank
+    session_add_counts(s, freq_table);
+    session_clear_counts(sc, s);
+    if ((double)bits * (double)s->base_symbols * 100.0 >
+        (double)s->base_bits * (double)len * (100.0 + s->drift)) {
+        s->stale = 1;
+    }
+    return CBC_OK;
+}
+
+int cbc_session_compress_cached(cbc_session *s, const uint8_t *in, size_t len,
+                                uint8_t *out, size_t out_cap, size_t *written) {
+    cbc_scratch sc;
+    session_scratch_init(&sc);
+    return session_compress_cached(&sc, s, in, len, out, out_cap, written);
+}
+
+int cbc_ctx_session_compress_cached(cbc_ctx *ctx, cbc_session *s,
+                                    const uint8_t *in, size_t len,
+                                    uint8_t *out, size_t out_cap,
+                                    size_t *written) {
+    return session_compress_cached(&ctx->sc, s, in, len, out, out_cap, written);
+}
+
+// ------------------------------------------------------------
+// Compression
+//
+// Input:
+//   text      - C string (null terminated)
+// Output:
+//   out_data  - pointer to allocated compressed buffer (malloc)
+//   out_size  - size in bytes of the compressed buffer
+//
+// Compressed format:
+//   [1 byte: K] [K bytes: ordered symbols] [bit payload]
+//
+// Header cost is K + 1 bytes.
+// ------------------------------------------------------------
+
+// Binary-safe, allocating variant: *out_data is malloc'ed (NULL for empty
+// input) and must be freed by the caller
+int cbc_compress(const uint8_t *in, size_t len,
+                 uint8_t **out_data, size_t *out_size) {
+    *out_data = NULL;
+    *out_size = 0;
+    if (len == 0) return CBC_OK;
+
+    // One allocation sized for the worst case, trimmed afterwards
+    size_t cap = cbc_max_compressed_size(len, 255);
+    uint8_t *buf = (uint8_t *)malloc(cap);
+    if (!buf) return CBC_ERR_NOMEM;
+
+    size_t written = 0;
+    int status = cbc_compress_into(in, len, buf, cap, &written);
+    if (status != CBC_OK) {
+        free(buf);
+        return status;
+    }
+
+    uint8_t *trimmed = (uint8_t *)realloc(buf, written);
+    *out_data = trimmed ? trimmed : buf;
+    *out_size = written;
+    return CBC_OK;
+}
+
+// String wrapper around cbc_compress. info may be NULL; when given it
+// receives the header and payload sizes of the message.
+int compress_cycle_based(const char *text,
+                         unsigned char **out_data,
+                         int *out_size,
+                         cbc_compress_info *info) {
+    size_t size = 0;
+    int status = cbc_compress((const uint8_t *)text, strlen(text), out_data, &size);
+    *out_size = (int)size;
+    if (info) {
+        info->K = size ? (*out_data)[0] : 0;
+        info->header_bytes = size ? 1 + (size_t)info->K : 0;
+        info->payload_bytes = size - info->header_bytes;
+        info->total_bytes = size;
+    }
+    return status;
+}
+
+// ------------------------------------------------------------
+// Run-length decoding with count leading zeros
+//
+// Codes are at most N <= MAX_CODE_LENGTH bits and escapes N + 8, so a
+// 64-bit window refilled to more than 56 bits always holds the next code
+// whole: the zero run is a count of leading zeros and the one run a count
+// of leading zeros of the inverted rest. No table memory is needed, which
+// makes this the plain-payload backend on small targets (see
+// CBC_DECODER_CLZ) and the decoder of the bounded and indexed layouts.
+// ------------------------------------------------------------
+
+// Count of leading zeros of x != 0: one instruction (BSR / LZCNT on x86,
+// CLZ on ARM) wherever the compiler exposes it
+static inline int cbc_clz64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(x);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long i;
+    _BitScanReverse64(&i, x);
+    return 63 - (int)i;
+#elif defined(_MSC_VER)
+    unsigned long i;
+    if (_BitScanReverse(&i, (unsigned long)(x >> 32))) return 31 - (int)i;
+    _BitScanReverse(&i, (unsigned long)x);
+    return 63 - (int)i;
+#elif defined(__CC_ARM)
+    uint32_t hi = (uint32_t)(x >> 32);
+    return hi ? (int)__clz(hi) : 32 + (int)__clz((uint32_t)x);
+#elif defined(__ICCARM__)
+    uint32_t hi = (uint32_t)(x >> 32);
+    return hi ? (int)__CLZ(hi) : 32 + (int)__CLZ((uint32_t)x);
+#else
+    int n = 0;
+    if (!(x >> 32)) { n += 32; x <<= 32; }
+    if (!(x >> 48)) { n += 16; x <<= 16; }
+    if (!(x >> 56)) { n += 8;  x <<= 8; }
+    if (!(x >> 60)) { n += 4;  x <<= 4; }
+    if (!(x >> 62)) { n += 2;  x <<= 2; }
+    if (!(x >> 63)) { n += 1; }
+    return n;
+#endif
+}
+
+// Starts at bit start_bit of the payload, walks past skip symbols and
+// writes the next n. With escapes, a run of N zeros is followed by a raw
+// byte; without, every code is a cycle of at most N bits.
+static int decode_window(const uint8_t *symbols, int K, int N, int escapes,
+                         const uint8_t *payload, size_t payload_bytes,
+                         uint64_t start_bit, size_t skip, size_t n,
+                         uint8_t *out, size_t *decoded) {
+    uint64_t window = 0;  // next bits, most significant first
+    int avail = 0;        // valid bits in window; the rest are zero
+    size_t pos = (size_t)(start_bit >> 3);
+    size_t walked = 0;    // symbols decoded, skipped ones included
+    int status = CBC_OK;
+    STATS_START(t);
+
+    *decoded = 0;
+    if (start_bit >> 3 > payload_bytes) return stats_decoded(CBC_ERR_CORRUPT, 0);
+    int drop = (int)(start_bit & 7);
+    if (drop) {
+        if (pos == payload_bytes) return stats_decoded(CBC_ERR_CORRUPT, 0);
+        window = (uint64_t)payload[pos++] << (56 + drop);
+        avail = 8 - drop;
+    }
+
+    n += skip;
+    while (walked < n) {
+        while (avail <= 56 && pos < payload_bytes) {
+            window |= (uint64_t)payload[pos++] << (56 - avail);
+            avail += 8;
+        }
+
+        int m = window ? cbc_clz64(window) : 64;
+        if (m >= N) {
+            if (!escapes || avail < N + 8) {
+                // only padding left, or a zero run no cycle has; a run
+                // past the window is padding only if it reaches the end
+                if (!escapes && m >= avail) {
+                    while (pos < payload_bytes && payload[pos] == 0) pos++;
+                    if (pos < payload_bytes) m = avail - 1;
+                }
+                status = m >= avail || escapes ? CBC_ERR_TRUNCATED : CBC_ERR_CORRUPT;
+                break;
+            }
+            // escape: 0^N then the raw byte
+            uint8_t b = (uint8_t)((window << N) >> 56);
+            if (walked >= skip) out[walked - skip] = b;
+            walked++;
+            window <<= N + 8;
+            avail -= N + 8;
+            continue;
+        }
+        if (m >= avail) {
+            // only padding left
+            status = CBC_ERR_TRUNCATED;
+            break;
+        }
+
+        uint64_t ones = ~(window << m);
+        int j = ones ? cbc_clz64(ones) : 64 - m;
+        int rank = m + j <= N ? cycle_rank(m, j) : -1;
+        if (rank < 0 || rank >= K) {
+            status = CBC_ERR_CORRUPT;
+            break;
+        }
+        if (walked >= skip) out[walked - skip] = symbols[rank];
+        walked++;
+        window <<= m + j;
+        avail -= m + j;
+    }
+
+    *decoded = walked > skip ? walked - skip : 0;
+    STATS_STAGE(CBC_STAGE_DECODE, t);
+    return stats_decoded(status, *decoded);
+}
+
+// Token table of a pair-token header (see Byte-pair tokens)
+typedef struct {
+    int N;
+    int K;
+    uint8_t width[255];      // 1 or 2 bytes
+    uint8_t bytes[255][2];
+} pair_table;
+
+// decode_window for pair tokens: skip and n count original bytes, and a
+// pair straddling either end of the range is cut to the bytes inside it
+static int decode_pair_window(const pair_table *t,
+                              const uint8_t *payload, size_t payload_bytes,
+                              size_t skip, size_t n,
+                              uint8_t *out, size_t *decoded) {
+    const int N = t->N;
+    uint64_t window = 0;
+    int avail = 0;
+    size_t pos = 0;
+    size_t walked = 0;
+    int status = CBC_OK;
+    STATS_START(t0);
+
+    n += skip;
+    while (walked < n) {
+        while (avail <= 56 && pos < payload_bytes) {
+            window |= (uint64_t)payload[pos++] << (56 - avail);
+            avail += 8;
+        }
+
+        int m = window ? cbc_clz64(window) : 64;
+        if (m >= N) {
+            if (avail < N + 8) {
+                status = CBC_ERR_TRUNCATED;
+                break;
+            }
+            uint8_t b = (uint8_t)((window << N) >> 56);
+            if (walked >= skip) out[walked - skip] = b;
+            walked++;
+            window <<= N + 8;
+            avail -= N + 8;
+            continue;
+        }
+        if (m >= avail) {
+            status = CBC_ERR_TRUNCATED;
+            break;
+        }
+
+        uint64_t ones = ~(window << m);
+        int j = ones ? cbc_clz64(ones) : 64 - m;
+        int rank = m + j <= N ? cycle_rank(m, j) : -1;
+        if (rank < 0 || rank >= t->K) {
+            status = CBC_ERR_CORRUPT;
+            break;
+        }
+        for (int b = 0; b < t->width[rank] && walked < n; b++, walked++) {
+            if (walked >= skip) out[walked - skip] = t->bytes[rank][b];
+        }
+        window <<= m + j;
+        avail -= m + j;
+    }
+
+    *decoded = walked > skip ? walked - skip : 0;
+    STATS_STAGE(CBC_STAGE_DECODE, t0);
+    return stats_decoded(status, *decoded);
+}
+
+// ------------------------------------------------------------
+// Decompression (simple version)
+// ------------------------------------------------------------
+//
+// Input:
+//   comp_data    - compressed buffer
+//   comp_size    - compressed buffer size in bytes
+//   original_len - original text length in characters
+//
+// Output:
+//   out_text     - output buffer (must have space >= original_len+1)
+//
+// Returns CBC_OK, CBC_ERR_CORRUPT or CBC_ERR_TRUNCATED; out_text always
+// holds the symbols decoded before the error.
+//
+// Note: here we assume the receiver knows the original length (it could be
+//       transmitted in another protocol field, for example).
+// ------------------------------------------------------------
+
+int decompress_cycle_based(const unsigned char *comp_data,
+                           int comp_size,
+                           int original_len,
+                           char *out_text) {
+    if (comp_size <= 0) {
+        out_text[0] = '\0';
+        return original_len > 0 ? CBC_ERR_TRUNCATED : CBC_OK;
+    }
+
+    int K = comp_data[0];
+    if (K <= 0 || comp_size < 1 + K) {
+        out_text[0] = '\0';
+        return CBC_ERR_CORRUPT;
+    }
+
+    // Symbols are stored in cycle order, so the symbol of (m, j) is
+    // symbols[cycle_rank(m, j)]
+    const unsigned char *symbols = comp_data + 1;
+
+    // Pointer to the bit payload
+    const unsigned char *payload = comp_data + 1 + K;
+    int payload_bytes = comp_size - (1 + K);
+
+    int bit_index = 0;  // global bit index
+    int out_pos = 0;
+    int status = CBC_OK;
+
+    while (out_pos < original_len && bit_index < payload_bytes * 8) {
+        // count zeros until the first 1
+        int m = 0;
+        int j = 0;
+
+        // count zeros
+        while (bit_index < payload_bytes * 8) {
+            int byte_idx = bit_index / 8;
+            int bit_in_byte = bit_index % 8;
+            int bit = (payload[byte_idx] >> (7 - bit_in_byte)) & 1;
+            bit_index++;
+
+            if (bit == 0) {
+                m++;
+            } else {
+                // found first 1
+                j = 1;
+                break;
+            }
+        }
+
+        if (j == 0) {
+            // did not find a 1, truncated stream
+            break;
+        }
+
+        // count consecutive 1s
+        while (bit_index < payload_bytes * 8) {
+            int byte_idx = bit_index / 8;
+            int bit_in_byte = bit_index % 8;
+            int bit = (payload[byte_idx] >> (7 - bit_in_byte)) & 1;
+
+            if (bit == 1) {
+                j++;
+                bit_index++;
+            } else {
+                // found 0, end of cycle
+                break;
+            }
+        }
+
+        // now we have (m, j) -> rank in the code table
+        int found = cycle_rank(m, j);
+
+        if (found < 0 || found >= K) {
+            // pair (m, j) not in the code table
+            status = CBC_ERR_CORRUPT;
+            break;
+        }
 
-        out_text[out_pos++] = (char)codes[found].symbol;
+        out_text[out_pos++] = (char)symbols[found];
     }
 
     out_text[out_pos] = '\0';
+    if (status == CBC_OK && out_pos < original_len) status = CBC_ERR_TRUNCATED;
+    return status;
 }
 
+#ifdef CBC_DECODER_TABLE
+
+// ------------------------------------------------------------
+// Table-driven decompression (CBC_DECODER_TABLE)
 // ------------------------------------------------------------
-// Simple test
+//
+// The payload is consumed one byte per step. The decoder state is the cycle
+// still open at the end of the previous byte: its pending zero-run length z,
+// its pending one-run length o, and the phase (0 = still reading zeros,
+// 1 = reading ones). The table is indexed by [phase][byte] and tells how the
+// byte extends the open cycle, which short cycles sit entirely inside the byte
+// (already resolved to ranks, so several symbols come out of one lookup) and
+// which cycle is left open at the end of it.
+//
+// Ranks do not depend on the message, only on the cycle order, so the table
+// is built once and shared by every call.
 // ------------------------------------------------------------
 
-int main(void) {
-    // Full original text (em ingles, como no artigo)
-    const char *full_text = "In wireless sensor networks, the energy cost of transmitting a single byte is often far higher than the cost of executing hundreds or even thousands of local instructions. As a consequence, lightweight compression techniques are essential for extending device lifetime and reducing network congestion. A deterministic low-overhead compressor allows embedded devices to reduce traffic without adding excessive computational complexity to firmware. Modern IoT systems often operate under strict limitations: restricted memory, low clock frequencies, intermittent connectivity, and energy budgets that must last months or years. Under these conditions, traditional compression algorithms may introduce too much overhead or require dynamic structures that are unsuitable for constrained nodes. A predictable, prefix-free, cycle-based scheme provides a promising alternative by minimizing header cost and avoiding the reconstruction of probability models during decoding.";
+typedef struct {
+    unsigned char lead_zeros;  // zeros added to the open cycle
+    unsigned char lead_ones;   // ones added to the open cycle
+    unsigned char closes;      // 1 if the open cycle ends inside this byte
+    unsigned char count;       // cycles fully contained in this byte
+    unsigned char rank[3];     // their ranks, in stream order
+    unsigned char tail_zeros;  // cycle left open at the end of the byte
+    unsigned char tail_ones;
+    unsigned char next_phase;  // phase after this byte
+} DecodeStep;
+
+static DecodeStep decode_table[2][256];
+#ifndef CBC_NO_THREADS
+static pthread_once_t decode_table_once = PTHREAD_ONCE_INIT;
+#else
+static int decode_table_ready = 0;
+#endif
+
+static void build_decode_table(void) {
+    for (int phase = 0; phase < 2; phase++) {
+        for (int b = 0; b < 256; b++) {
+            DecodeStep *s = &decode_table[phase][b];
+            memset(s, 0, sizeof(*s));
+
+            int m = 0;          // zeros of the cycle being read
+            int j = 0;          // ones of the cycle being read
+            int ones = phase;   // 1 once the cycle being read has seen a 1
+            int open = 1;       // still extending the incoming open cycle
+
+            for (int k = 7; k >= 0; k--) {
+                int bit = (b >> k) & 1;
+                if (bit) {
+                    j++;
+                    ones = 1;
+                } else if (ones) {
+                    // a 0 after 1s ends the current cycle
+                    if (open) {
+                        s->closes = 1;
+                        s->lead_zeros = (unsigned char)m;
+                        s->lead_ones = (unsigned char)j;
+                        open = 0;
+                    } else {
+                        s->rank[s->count++] = (unsigned char)cycle_rank(m, j);
+                    }
+                    m = 1;
+                    j = 0;
+                    ones = 0;
+                } else {
+                    m++;
+                }
+            }
+
+            if (open) {
+                s->lead_zeros = (unsigned char)m;
+                s->lead_ones = (unsigned char)j;
+            } else {
+                s->tail_zeros = (unsigned char)m;
+                s->tail_ones = (unsigned char)j;
+            }
+            s->next_phase = (unsigned char)ones;
+        }
+    }
+}
+
+static void ensure_decode_table(void) {
+#ifndef CBC_NO_THREADS
+    pthread_once(&decode_table_once, build_decode_table);
+#else
+    if (!decode_table_ready) {
+        build_decode_table();
+        decode_table_ready = 1;
+    }
+#endif
+}
 
-    size_t full_len = strlen(full_text);
-    int target_sizes[] = {32, 64, 128, 256, 512};
-    int num_sizes = sizeof(target_sizes) / sizeof(target_sizes[0]);
+// Step-table kernel of decode_payload
+static int decode_steps(const uint8_t *symbols, int K,
+                        const uint8_t *payload, size_t payload_bytes,
+                        size_t n, uint8_t *out, size_t *decoded) {
 
-    printf("Full original length: %zu bytes\n\n", full_len);
+    int z = 0;       // pending zeros of the open cycle
+    int o = 0;       // pending ones of the open cycle
+    int phase = 0;
+    size_t out_pos = 0;
+    int status = CBC_OK;
 
-    for (int t = 0; t < num_sizes; t++) {
-        int S = target_sizes[t];
+    for (size_t i = 0; i < payload_bytes && out_pos < n; i++) {
+        const DecodeStep *s = &decode_table[phase][payload[i]];
 
-        // Skip if the full text is smaller than the target size
-        if (full_len < (size_t)S) {
-            continue;
+        if (s->closes) {
+            int r = cycle_rank(z + s->lead_zeros, o + s->lead_ones);
+            if (r < 0 || r >= K) {
+                status = CBC_ERR_CORRUPT;
+                break;
+            }
+            out[out_pos++] = symbols[r];
+
+            // short cycles fully inside this byte
+            for (int c = 0; c < s->count && out_pos < n; c++) {
+                if (s->rank[c] >= K) {
+                    *decoded = out_pos;
+                    return CBC_ERR_CORRUPT;
+                }
+                out[out_pos++] = symbols[s->rank[c]];
+            }
+
+            z = s->tail_zeros;
+            o = s->tail_ones;
+        } else {
+            z += s->lead_zeros;
+            o += s->lead_ones;
+            // No cycle is longer than MAX_CODE_LENGTH bits. One that
+            // already has its 1s is corrupt; 0s alone may still be a
+            // truncated tail, so they are only capped.
+            if (z + o > MAX_CODE_LENGTH) {
+                if (o > 0) {
+                    status = CBC_ERR_CORRUPT;
+                    break;
+                }
+                z = MAX_CODE_LENGTH + 1;
+            }
         }
+        phase = s->next_phase;
+    }
 
-        // Build truncated message
-        char example[MAX_SIZE_MESSAGE];
-        if (S >= MAX_SIZE_MESSAGE) {
-            fprintf(stderr, "Target size %d exceeds MAX_SIZE_MESSAGE=%d\n",
-                    S, MAX_SIZE_MESSAGE);
-            continue;
+    // A stream that ends inside a run of 1s ends with a complete cycle
+    if (status == CBC_OK && out_pos < n && o > 0) {
+        int r = cycle_rank(z, o);
+        if (r < 0 || r >= K) {
+            status = CBC_ERR_CORRUPT;
+        } else {
+            out[out_pos++] = symbols[r];
         }
+    }
+
+    *decoded = out_pos;
+    if (status == CBC_OK && out_pos < n) status = CBC_ERR_TRUNCATED;
+    return status;
+}
+
+// Decode n symbols from a payload whose code table is symbols[0..K).
+// Stops early on an invalid cycle (CBC_ERR_CORRUPT) or when the payload
+// runs out (CBC_ERR_TRUNCATED); *decoded always holds the symbols written.
+static int decode_payload(const uint8_t *symbols, int K,
+                          const uint8_t *payload, size_t payload_bytes,
+                          size_t n, uint8_t *out, size_t *decoded) {
+    ensure_decode_table();
+    STATS_START(t);
+    int status = decode_steps(symbols, K, payload, payload_bytes, n, out, decoded);
+    STATS_STAGE(CBC_STAGE_DECODE, t);
+    return stats_decoded(status, *decoded);
+}
+
+#else  // CBC_DECODER_CLZ
+
+// Same contract as the table decoder, with no table memory
+static int decode_payload(const uint8_t *symbols, int K,
+                          const uint8_t *payload, size_t payload_bytes,
+                          size_t n, uint8_t *out, size_t *decoded) {
+    return decode_window(symbols, K, MAX_CODE_LENGTH, 0, payload, payload_bytes,
+                         0, 0, n, out, decoded);
+}
+
+#endif
+
+// ------------------------------------------------------------
+// Binary-safe decompression
+//
+// Input:
+//   data         - compressed buffer
+//   size         - compressed buffer size in bytes
+//   original_len - number of bytes to decode
+// Output:
+//   out          - output buffer (must have space >= original_len)
+//   out_len      - bytes written to `out`
+//
+// No NUL terminator is written, so payloads may contain 0x00.
+// ------------------------------------------------------------
+
+static int decompress_extended(const uint8_t *data, size_t size,
+                               size_t original_len, uint8_t *out,
+                               size_t *out_len);
+
+int cbc_decompress(const uint8_t *data, size_t size, size_t original_len,
+                   uint8_t *out, size_t *out_len) {
+    *out_len = 0;
+    if (size == 0) return original_len == 0 ? CBC_OK : CBC_ERR_TRUNCATED;
+
+    int K = data[0];
+    if (K == 0) return decompress_extended(data, size, original_len, out, out_len);
+    if (size < 1 + (size_t)K) return CBC_ERR_CORRUPT;
 
-        memcpy(example, full_text, S);
-        example[S] = '\0';
+    // Symbols in rank order, followed by the payload
+    return decode_payload(data + 1, K, data + 1 + K, size - (1 + K),
+                          original_len, out, out_len);
+}
+
+// Same contract, output and status as decompress_cycle_based, which only
+// reads the plain format; this one also accepts raw and bounded frames.
+int decompress_cycle_based_table(const unsigned char *comp_data,
+                                 int comp_size,
+                                 int original_len,
+                                 char *out_text) {
+    size_t decoded = 0;
+    int status = cbc_decompress(comp_data, comp_size > 0 ? (size_t)comp_size : 0,
+                                original_len > 0 ? (size_t)original_len : 0,
+                                (uint8_t *)out_text, &decoded);
+    out_text[decoded] = '\0';
+    return status;
+}
+
+// ------------------------------------------------------------
+// Bounded-length decompression
+// ------------------------------------------------------------
+
+// Frames whose first byte is 0: raw store or bounded-length codes
+static int decompress_extended(const uint8_t *data, size_t size,
+                               size_t original_len, uint8_t *out,
+                               size_t *out_len) {
+    if (size < 2) return CBC_ERR_CORRUPT;
+    int N = data[1];
+    if (N == CBC_EXT_RAW) {
+        size_t n = size - 2 < original_len ? size - 2 : original_len;
+        memcpy(out, data + 2, n);
+        *out_len = n;
+        return n < original_len ? CBC_ERR_TRUNCATED : CBC_OK;
+    }
+    if (N < 2 || N > MAX_CODE_LENGTH || size < 3) return CBC_ERR_CORRUPT;
+
+    int K = data[2];
+    if (K <= 0 || K > N * (N - 1) / 2 || size < 3 + (size_t)K) {
+        return CBC_ERR_CORRUPT;
+    }
+    return decode_window(data + 3, K, N, 1, data + 3 + K, size - (3 + K),
+                         0, 0, original_len, out, out_len);
+}
+
+// ------------------------------------------------------------
+// Self-describing frame decompression
+// ------------------------------------------------------------
+
+// Parse a frame header; *header_size is the offset of the payload
+static int parse_framed_header(const uint8_t *data, size_t size,
+                               size_t *original_len, size_t *header_size) {
+    int K = data[0];
+    if (K <= 0 || size < 1 + (size_t)K) return CBC_ERR_CORRUPT;
+
+    uint64_t n = 0;
+    size_t n_bytes = get_varint(data + 1 + K, size - (1 + K), &n);
+    if (n_bytes == 0 || n > SIZE_MAX) return CBC_ERR_CORRUPT;
 
-        unsigned char *compressed = NULL;
-        int comp_size = 0;
+    *original_len = (size_t)n;
+    *header_size = 1 + (size_t)K + n_bytes;
+    return CBC_OK;
+}
+
+// Original length stored in a frame (0 for an empty frame)
+int cbc_framed_length(const uint8_t *data, size_t size, size_t *original_len) {
+    size_t header_size = 0;
+    *original_len = 0;
+    if (size == 0) return CBC_OK;
+    return parse_framed_header(data, size, original_len, &header_size);
+}
 
-        printf("=== Truncated to %d bytes ===\n", S);
-        printf("Original (first %d bytes): \"%s\"\n", S, example);
+int cbc_decompress_framed(const uint8_t *data, size_t size,
+                          uint8_t *out, size_t out_cap, size_t *out_len) {
+    *out_len = 0;
+    if (size == 0) return CBC_OK;
 
-        // Compress
-        compress_cycle_based(example, &compressed, &comp_size);
-        printf("Compressed size: %d bytes\n", comp_size);
+    size_t original_len = 0;
+    size_t header_size = 0;
+    int status = parse_framed_header(data, size, &original_len, &header_size);
+    if (status != CBC_OK) return status;
+    if (original_len > out_cap) return CBC_ERR_OVERFLOW;
 
-        // Decompress (we pass S as the original length)
-        char recovered[MAX_SIZE_MESSAGE];
-        decompress_cycle_based(compressed, comp_size, S, recovered);
+    return decode_payload(data + 1, data[0],
+                          data + header_size, size - header_size,
+                          original_len, out, out_len);
+}
 
-        printf("Recovered: \"%s\"\n\n", recovered);
+// ------------------------------------------------------------
+// Container decompression
+// ------------------------------------------------------------
 
-        free(compressed);
+// Validates the prefix of a container frame and locates its parts
+int cbc_container_parse(const uint8_t *data, size_t size, cbc_container *c) {
+    if (size < 2 || data[0] != CBC_CONTAINER_MAGIC) return CBC_ERR_CORRUPT;
+    c->version = data[1] >> 4;
+    c->flags = data[1] & 0x0F;
+    if (c->version != CBC_CONTAINER_VERSION || (c->flags & ~CBC_CF_KNOWN)) {
+        return CBC_ERR_CORRUPT;
     }
 
-    return 0;
+    size_t pos = 2;
+    uint64_t n = 0;
+    uint64_t h = 0;
+    size_t used = get_varint(data + pos, size - pos, &n);
+    if (used == 0 || n > SIZE_MAX) return CBC_ERR_CORRUPT;
+    pos += used;
+    used = get_varint(data + pos, size - pos, &h);
+    if (used == 0 || h > size - pos - used) return CBC_ERR_CORRUPT;
+    pos += used;
+
+    c->original_len = (size_t)n;
+    c->header = data + pos;
+    c->header_size = (size_t)h;
+    c->payload = data + pos + (size_t)h;
+    c->payload_size = size - pos - (size_t)h;
+    return CBC_OK;
+}
+
+// Decodes bytes [offset, offset + count) of a bounded frame with pair
+// tokens, validating its header first
+static int pairs_range(const cbc_container *c, size_t offset, size_t count,
+                       uint8_t *out, size_t *out_len) {
+    const uint8_t *h = c->header;
+    pair_table t;
+    t.N = h[0] & ~CBC_BOUNDED_PAIRS;
+    t.K = h[1];
+    if (t.N < 2 || t.N > MAX_CODE_LENGTH || t.K == 0 || t.K > t.N * (t.N - 1) / 2) {
+        return CBC_ERR_CORRUPT;
+    }
+    size_t pos = 2 + (size_t)(t.K + 7) / 8;
+    if (pos > c->header_size) return CBC_ERR_CORRUPT;
+    for (int i = 0; i < t.K; i++) {
+        t.width[i] = (uint8_t)(1 + (h[2 + i / 8] >> (i % 8) & 1));
+        if (t.width[i] > c->header_size - pos) return CBC_ERR_CORRUPT;
+        t.bytes[i][0] = h[pos];
+        t.bytes[i][1] = h[pos + t.width[i] - 1];
+        pos += t.width[i];
+    }
+    if (pos != c->header_size) return CBC_ERR_CORRUPT;
+    return decode_pair_window(&t, c->payload, c->payload_size, offset, count,
+                              out, out_len);
+}
+
+// Decodes symbols [offset, offset + count) of an indexed frame, touching
+// only the checkpoints and tables of the segments the slice covers
+static int indexed_range(const cbc_container *c, size_t offset, size_t count,
+                         uint8_t *out, size_t *out_len) {
+    const uint8_t *h = c->header;
+    uint64_t interval = 0;
+    size_t index_pos = get_varint(h, c->header_size, &interval);
+    if (index_pos == 0 || interval == 0) return CBC_ERR_CORRUPT;
+    // Written without the + interval - 1 round-up, which wraps for lengths
+    // near SIZE_MAX and would let n pass the bound below as 0
+    size_t n = (size_t)(c->original_len / interval + (c->original_len % interval != 0));
+    if (n > (c->header_size - index_pos) / INDEX_ENTRY) return CBC_ERR_CORRUPT;
+    size_t tables = index_pos + n * INDEX_ENTRY;
+
+    size_t done = 0;
+    for (size_t seg = (size_t)(offset / interval); done < count; seg++) {
+        if (seg >= n) return CBC_ERR_CORRUPT;
+        const uint8_t *entry = h + index_pos + seg * INDEX_ENTRY;
+        uint64_t bit_pos = get_le(entry, 8);
+        size_t t = (size_t)get_le(entry + 8, 4);
+        if (t < tables || t >= c->header_size || h[t] == 0 ||
+            (size_t)h[t] > c->header_size - t - 1) {
+            return CBC_ERR_CORRUPT;
+        }
+
+        size_t seg_start = seg * (size_t)interval;
+        size_t seg_len = c->original_len - seg_start < interval
+                       ? c->original_len - seg_start : (size_t)interval;
+        size_t skip = offset + done - seg_start;
+        size_t take = seg_len - skip < count - done ? seg_len - skip : count - done;
+
+        size_t decoded = 0;
+        int status = decode_window(h + t + 1, h[t], MAX_CODE_LENGTH, 1,
+                                   c->payload, c->payload_size, bit_pos,
+                                   skip, take, out + done, &decoded);
+        done += decoded;
+        *out_len = done;
+        if (status != CBC_OK) return status;
+    }
+    return CBC_OK;
 }
 
+// Decodes original bytes [offset, offset + count) of any container frame.
+// Indexed frames start from the checkpoint before offset, so a lookup
+// costs O(interval + count); the other layouts walk from the start.
+int cbc_decompress_range(const cbc_dict *dict, const uint8_t *data, size_t size,
+                         size_t offset, size_t count,
+                         uint8_t *out, size_t *out_len) {
+    *out_len = 0;
+    cbc_container c;
+    int status = cbc_container_parse(data, size, &c);
+    if (status != CBC_OK) return status;
+    if (offset > c.original_len || count > c.original_len - offset) {
+        return CBC_ERR_INPUT;
+    }
+    if (count == 0) return CBC_OK;
+
+    const uint8_t *h = c.header;
+    switch (c.flags) {
+    case 0:
+        if (c.header_size < 2 || h[0] == 0 || c.header_size != 1 + (size_t)h[0]) {
+            return CBC_ERR_CORRUPT;
+        }
+        return decode_window(h + 1, h[0], MAX_CODE_LENGTH, 0, c.payload, c.payload_size,
+                             0, offset, count, out, out_len);
+    case CBC_CF_BOUNDED: {
+        if (c.header_size < 3) return CBC_ERR_CORRUPT;
+        if (h[0] & CBC_BOUNDED_PAIRS) return pairs_range(&c, offset, count, out, out_len);
+        int N = h[0];
+        int K = h[1];
+        if (N < 2 || N > MAX_CODE_LENGTH || K == 0 || K > N * (N - 1) / 2 ||
+            c.header_size != 2 + (size_t)K) {
+            return CBC_ERR_CORRUPT;
+        }
+        return decode_window(h + 2, K, N, 1, c.payload, c.payload_size,
+                             0, offset, count, out, out_len);
+    }
+    case CBC_CF_RAW: {
+        if (c.header_size != 0) return CBC_ERR_CORRUPT;
+        size_t avail = c.payload_size > offset ? c.payload_size - offset : 0;
+        size_t n = avail < count ? avail : count;
+        if (n > 0) memcpy(out, c.payload + offset, n);
+        *out_len = n;
+        return n < count ? CBC_ERR_TRUNCATED : CBC_OK;
+    }
+    case CBC_CF_DICT:
+        if (c.header_size != 1) return CBC_ERR_CORRUPT;
+        if (!dict) return CBC_ERR_INPUT;
+        if (h[0] != dict->id) return CBC_ERR_CORRUPT;
+        return decode_window(dict->symbols, dict->K, MAX_CODE_LENGTH, 0,
+                             c.payload, c.payload_size, 0, offset, count, out, out_len);
+    case CBC_CF_INDEXED:
+        return indexed_range(&c, offset, count, out, out_len);
+    default:
+        return CBC_ERR_CORRUPT;   // more than one layout flag
+    }
+}
+
+int cbc_decompress_container(const cbc_dict *dict,
+                             const uint8_t *data, size_t size,
+                             uint8_t *out, size_t out_cap, size_t *out_len) {
+    *out_len = 0;
+    cbc_container c;
+    int status = cbc_container_parse(data, size, &c);
+    if (status != CBC_OK) return status;
+    if (c.original_len > out_cap) return CBC_ERR_OVERFLOW;
+
+    const uint8_t *h = c.header;
+    switch (c.flags) {
+    case 0:
+        if (c.header_size < 2 || h[0] == 0 || c.header_size != 1 + (size_t)h[0]) {
+            return CBC_ERR_CORRUPT;
+        }
+        return decode_payload(h + 1, h[0], c.payload, c.payload_size,
+                              c.original_len, out, out_len);
+    case CBC_CF_BOUNDED: {
+        if (c.header_size < 3) return CBC_ERR_CORRUPT;
+        if (h[0] & CBC_BOUNDED_PAIRS) {
+            return pairs_range(&c, 0, c.original_len, out, out_len);
+        }
+        int N = h[0];
+        int K = h[1];
+        if (N < 2 || N > MAX_CODE_LENGTH || K == 0 || K > N * (N - 1) / 2 ||
+            c.header_size != 2 + (size_t)K) {
+            return CBC_ERR_CORRUPT;
+        }
+        return decode_window(h + 2, K, N, 1, c.payload, c.payload_size,
+                             0, 0, c.original_len, out, out_len);
+    }
+    case CBC_CF_RAW: {
+        if (c.header_size != 0) return CBC_ERR_CORRUPT;
+        size_t n = c.payload_size < c.original_len ? c.payload_size : c.original_len;
+        if (n > 0) memcpy(out, c.payload, n);
+        *out_len = n;
+        return n < c.original_len ? CBC_ERR_TRUNCATED : CBC_OK;
+    }
+    case CBC_CF_DICT:
+        if (c.header_size != 1) return CBC_ERR_CORRUPT;
+        if (!dict) return CBC_ERR_INPUT;
+        if (h[0] != dict->id) return CBC_ERR_CORRUPT;
+        return decode_payload(dict->symbols, dict->K, c.payload, c.payload_size,
+                              c.original_len, out, out_len);
+    case CBC_CF_INDEXED:
+        return indexed_range(&c, 0, c.original_len, out, out_len);
+    default:
+        return CBC_ERR_CORRUPT;   // more than one layout flag
+    }
+}
+
+// ------------------------------------------------------------
+// Batch decompression
+//
+// Decodes the n framed records of a batch arena back to back into out;
+// message i lands in out[out_offsets[i] .. out_offsets[i + 1]).
+// ------------------------------------------------------------
+
+int cbc_decompress_batch(const uint8_t *arena, const size_t *offsets, size_t n,
+                         uint8_t *out, size_t out_cap, size_t *out_offsets) {
+    size_t pos = 0;
+    out_offsets[0] = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i + 1 < n) CBC_PREFETCH(arena + offsets[i + 1]);
+
+        size_t decoded = 0;
+        int status = cbc_decompress_framed(arena + offsets[i],
+                                           offsets[i + 1] - offsets[i],
+                                           out + pos, out_cap - pos, &decoded);
+        if (status != CBC_OK) return status;
+        pos += decoded;
+        out_offsets[i + 1] = pos;
+    }
+    return CBC_OK;
+}
+
+// ------------------------------------------------------------
+// Multithreaded batch engine
+//
+// Messages are independent, so a batch is cut into tasks of
+// CBC_MT_TASK_RECORDS records and spread over worker threads. Each worker
+// starts with a contiguous run of tasks and, once it is out of work,
+// steals tasks from the back of the other workers' runs, which absorbs the
+// imbalance of very different message sizes.
+//
+// Compression writes record i into a slot of cbc_max_framed_size(len_i)
+// bytes, then a single in-order pass slides the records together, so the
+// arena ends up identical to cbc_compress_batch's. Decompression reads
+// every record's length from its frame header first, so each worker
+// decodes straight into its final place.
+//
+// threads <= 0 uses one thread per online CPU.
+// ------------------------------------------------------------
+
+#ifndef CBC_NO_THREADS
+
+// Run of tasks [head, tail) packed in one word, so that the owner (taking
+// from the front) and thieves (taking from the back) agree with one CAS
+typedef struct {
+    _Atomic uint64_t range;
+    char pad[64 - sizeof(uint64_t)];  // one deque per cache line
+} TaskDeque;
+
+typedef struct {
+    TaskDeque *deques;
+    int threads;
+    size_t n;
+    int (*run)(void *job, size_t first, size_t last, cbc_scratch *sc);
+    void *job;
+    atomic_int status;
+} TaskPool;
+
+typedef struct {
+    TaskPool *pool;
+    int id;
+} TaskWorker;
+
+static long deque_pop_front(TaskDeque *d) {
+    uint64_t r = atomic_load(&d->range);
+    for (;;) {
+        uint32_t head = (uint32_t)(r >> 32);
+        uint32_t tail = (uint32_t)r;
+        if (head >= tail) return -1;
+        uint64_t next = ((uint64_t)(head + 1) << 32) | tail;
+        if (atomic_compare_exchange_weak(&d->range, &r, next)) return head;
+    }
+}
+
+static long deque_steal_back(TaskDeque *d) {
+    uint64_t r = atomic_load(&d->range);
+    for (;;) {
+        uint32_t head = (uint32_t)(r >> 32);
+        uint32_t tail = (uint32_t)r;
+        if (head >= tail) return -1;
+        uint64_t next = ((uint64_t)head << 32) | (tail - 1);
+        if (atomic_compare_exchange_weak(&d->range, &r, next)) return tail - 1;
+    }
+}
+
+static void *pool_worker(void *arg) {
+    TaskWorker *w = (TaskWorker *)arg;
+    TaskPool *pool = w->pool;
+    cbc_scratch sc;
+    scratch_init(&sc);
+
+    while (atomic_load(&pool->status) == CBC_OK) {
+        long task = deque_pop_front(&pool->deques[w->id]);
+        for (int k = 1; task < 0 && k < pool->threads; k++) {
+            task = deque_steal_back(&pool->deques[(w->id + k) % pool->threads]);
+        }
+        if (task < 0) break;  // nothing left anywhere
+
+        size_t first = (size_t)task * CBC_MT_TASK_RECORDS;
+        size_t last = first + CBC_MT_TASK_RECORDS;
+        if (last > pool->n) last = pool->n;
+        int status = pool->run(pool->job, first, last, &sc);
+        if (status != CBC_OK) {
+            int expected = CBC_OK;
+            atomic_compare_exchange_strong(&pool->status, &expected, status);
+        }
+    }
+    return NULL;
+}
+
+static int pool_threads(int threads) {
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    return threads > CBC_MT_MAX_THREADS ? CBC_MT_MAX_THREADS : threads;
+}
+
+// Run job over records [0, n) on the given number of threads
+static int pool_run(size_t n, int threads, void *job,
+                    int (*run)(void *job, size_t first, size_t last,
+                               cbc_scratch *sc)) {
+    size_t tasks = (n + CBC_MT_TASK_RECORDS - 1) / CBC_MT_TASK_RECORDS;
+    if (tasks > UINT32_MAX) return CBC_ERR_INPUT;
+    if ((size_t)threads > tasks) threads = tasks > 0 ? (int)tasks : 1;
+
+    if (threads == 1 || n == 0) {
+        cbc_scratch sc;
+        scratch_init(&sc);
+        return run(job, 0, n, &sc);
+    }
+
+    TaskDeque deques[CBC_MT_MAX_THREADS];
+    TaskWorker workers[CBC_MT_MAX_THREADS];
+    pthread_t tids[CBC_MT_MAX_THREADS];
+    TaskPool pool;
+    pool.deques = deques;
+    pool.threads = threads;
+    pool.n = n;
+    pool.run = run;
+    pool.job = job;
+    atomic_init(&pool.status, CBC_OK);
+
+    // Even initial split of the tasks, in index order
+    for (int t = 0; t < threads; t++) {
+        uint64_t head = tasks * (size_t)t / (size_t)threads;
+        uint64_t tail = tasks * (size_t)(t + 1) / (size_t)threads;
+        atomic_init(&deques[t].range, (head << 32) | tail);
+        workers[t].pool = &pool;
+        workers[t].id = t;
+    }
+
+    int started = 0;
+    for (int t = 1; t < threads; t++) {
+        if (pthread_create(&tids[t], NULL, pool_worker, &workers[t]) != 0) break;
+        started++;
+    }
+    pool_worker(&workers[0]);  // the caller works too, and steals the rest
+    for (int t = 1; t <= started; t++) pthread_join(tids[t], NULL);
+
+    return atomic_load(&pool.status);
+}
+
+typedef struct {
+    const cbc_msg *msgs;
+    uint8_t *arena;
+    size_t *slots;      // slot start of every record
+    size_t *sizes;      // compressed size of every record
+} CompressJob;
+
+static int compress_job_run(void *arg, size_t first, size_t last,
+                            cbc_scratch *sc) {
+    CompressJob *job = (CompressJob *)arg;
+    for (size_t i = first; i < last; i++) {
+        if (i + 1 < last) CBC_PREFETCH(job->msgs[i + 1].data);
+        size_t slot_cap = cbc_max_framed_size(job->msgs[i].len, 255);
+        int status = compress_message(sc, job->msgs[i].data, job->msgs[i].len, 1,
+                                      job->arena + job->slots[i], slot_cap,
+                                      &job->sizes[i]);
+        if (status != CBC_OK) return status;
+    }
+    return CBC_OK;
+}
+
+// Same result as cbc_compress_batch; arena_cap must be at least
+// cbc_max_batch_size(msgs, n) since records are first written to
+// worst-case slots
+int cbc_compress_batch_mt(const cbc_msg *msgs, size_t n,
+                          uint8_t *arena, size_t arena_cap, size_t *offsets,
+                          int threads) {
+    offsets[0] = 0;
+    if (n == 0) return CBC_OK;
+    if (cbc_max_batch_size(msgs, n) > arena_cap) return CBC_ERR_OVERFLOW;
+
+    size_t *slots = (size_t *)malloc(n * sizeof(size_t));
+    if (!slots) return CBC_ERR_NOMEM;
+    size_t pos = 0;
+    for (size_t i = 0; i < n; i++) {
+        slots[i] = pos;
+        pos += cbc_max_framed_size(msgs[i].len, 255);
+    }
+
+    // offsets[1..n] first hold the compressed sizes
+    CompressJob job = {msgs, arena, slots, offsets + 1};
+    int status = pool_run(n, pool_threads(threads), &job, compress_job_run);
+
+    if (status == CBC_OK) {
+        // Slide the records together, in order
+        pos = 0;
+        for (size_t i = 0; i < n; i++) {
+            size_t size = offsets[i + 1];
+            if (slots[i] != pos) memmove(arena + pos, arena + slots[i], size);
+            pos += size;
+            offsets[i + 1] = pos;
+        }
+    }
+    free(slots);
+    return status;
+}
+
+typedef struct {
+    const uint8_t *arena;
+    const size_t *offsets;
+    uint8_t *out;
+    const size_t *out_offsets;
+} DecompressJob;
+
+static int decompress_job_run(void *arg, size_t first, size_t last,
+                              cbc_scratch *sc) {
+    DecompressJob *job = (DecompressJob *)arg;
+    (void)sc;
+    for (size_t i = first; i < last; i++) {
+        size_t expected = job->out_offsets[i + 1] - job->out_offsets[i];
+        size_t decoded = 0;
+        int status = cbc_decompress_framed(job->arena + job->offsets[i],
+                                           job->offsets[i + 1] - job->offsets[i],
+                                           job->out + job->out_offsets[i],
+                                           expected, &decoded);
+        if (status != CBC_OK) return status;
+    }
+    return CBC_OK;
+}
+
+// Same result as cbc_decompress_batch
+int cbc_decompress_batch_mt(const uint8_t *arena, const size_t *offsets, size_t n,
+                            uint8_t *out, size_t out_cap, size_t *out_offsets,
+                            int threads) {
+    // Output layout from the frame headers alone
+    out_offsets[0] = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t len = 0;
+        int status = cbc_framed_length(arena + offsets[i],
+                                       offsets[i + 1] - offsets[i], &len);
+        if (status != CBC_OK) return status;
+        if (len > out_cap - out_offsets[i]) return CBC_ERR_OVERFLOW;
+        out_offsets[i + 1] = out_offsets[i] + len;
+    }
+
+    DecompressJob job = {arena, offsets, out, out_offsets};
+    return pool_run(n, pool_threads(threads), &job, decompress_job_run);
+}
+
+#endif  // CBC_NO_THREADS
+
+// ------------------------------------------------------------
+// Shared dictionary decompression
+// ------------------------------------------------------------
+
+// Id of the dictionary a frame was encoded with
+int cbc_frame_dict_id(const uint8_t *data, size_t size) {
+    return size > 0 ? data[0] : CBC_ERR_CORRUPT;
+}
+
+int cbc_decompress_dict(const cbc_dict *dict, const uint8_t *data, size_t size,
+                        size_t original_len, uint8_t *out, size_t *out_len) {
+    *out_len = 0;
+    if (size == 0) return original_len == 0 ? CBC_OK : CBC_ERR_TRUNCATED;
+    if (data[0] != dict->id) return CBC_ERR_CORRUPT;
+
+    return decode_payload(dict->symbols, dict->K, data + 1, size - 1,
+                          original_len, out, out_len);
+}
+
+// ------------------------------------------------------------
+// Streaming decompression
+// ------------------------------------------------------------
+
+void cbc_stream_decoder_free(cbc_stream_decoder *sd) {
+    if (sd->frame) sd->alloc.free(sd->alloc.user, sd->frame);
+    if (sd->block) sd->alloc.free(sd->alloc.user, sd->block);
+    sd->frame = NULL;
+    sd->block = NULL;
+}
+
+int cbc_stream_decoder_init(cbc_stream_decoder *sd, size_t block_size,
+                            cbc_write_fn write, void *user) {
+    return cbc_stream_decoder_init_alloc(sd, block_size, write, user, NULL);
+}
+
+int cbc_stream_decoder_init_alloc(cbc_stream_decoder *sd, size_t block_size,
+                                  cbc_write_fn write, void *user,
+                                  const cbc_allocator *alloc) {
+    if (!alloc) alloc = &heap_allocator;
+    if (block_size == 0 || block_size > INT_MAX || !write ||
+        !alloc->alloc || !alloc->free) {
+        return CBC_ERR_INPUT;
+    }
+
+    sd->block_size = block_size;
+    sd->frame_len = 0;
+    sd->frame_cap = stream_frame_cap(block_size);
+    sd->K = 0;
+    sd->finished = 0;
+    sd->write = write;
+    sd->user = user;
+    sd->alloc = *alloc;
+    sd->frame = (uint8_t *)alloc->alloc(alloc->user, sd->frame_cap);
+    sd->block = (uint8_t *)alloc->alloc(alloc->user, block_size);
+    if (!sd->frame || !sd->block) {
+        cbc_stream_decoder_free(sd);
+        return CBC_ERR_NOMEM;
+    }
+    return CBC_OK;
+}
+
+// Decode the block at the start of frame if it is complete. Returns the
+// bytes it used, 0 if more input is needed, or a negative status.
+static long stream_decode_block(cbc_stream_decoder *sd) {
+    const uint8_t *p = sd->frame;
+    size_t avail = sd->frame_len;
+    size_t pos = 1;
+
+    if (p[0] == CBC_BLOCK_END) {
+        sd->finished = 1;
+        return 1;
+    }
+    if (p[0] == CBC_BLOCK_RAW) {
+        uint64_t n = 0;
+        size_t used = get_varint(p + pos, avail - pos, &n);
+        if (used == 0) return avail - pos >= CBC_VARINT_MAX ? CBC_ERR_CORRUPT : 0;
+        pos += used;
+        if (n == 0 || n > sd->block_size) return CBC_ERR_CORRUPT;
+        if (avail - pos < n) return 0;
+        if (sd->write(sd->user, p + pos, (size_t)n) != 0) return CBC_ERR_IO;
+        return (long)(pos + n);
+    }
+
+    int K = sd->K;
+    const uint8_t *symbols = sd->symbols;
+    if (p[0] == CBC_BLOCK_TABLE) {
+        if (avail < 2) return 0;
+        K = p[1];
+        if (K == 0) return CBC_ERR_CORRUPT;
+        if (avail < 2 + (size_t)K) return 0;
+        symbols = p + 2;
+        pos = 2 + (size_t)K;
+    } else if (p[0] != CBC_BLOCK_INHERIT || K == 0) {
+        return CBC_ERR_CORRUPT;
+    }
+
+    uint64_t n = 0;
+    uint64_t bytes = 0;
+    size_t used = get_varint(p + pos, avail - pos, &n);
+    if (used == 0) return avail - pos >= CBC_VARINT_MAX ? CBC_ERR_CORRUPT : 0;
+    pos += used;
+    used = get_varint(p + pos, avail - pos, &bytes);
+    if (used == 0) return avail - pos >= CBC_VARINT_MAX ? CBC_ERR_CORRUPT : 0;
+    pos += used;
+
+    if (n == 0 || n > sd->block_size || bytes > sd->frame_cap - pos) {
+        return CBC_ERR_CORRUPT;
+    }
+    if (avail - pos < bytes) return 0;
+
+    size_t decoded = 0;
+    int status = decode_payload(symbols, K, p + pos, (size_t)bytes,
+                                (size_t)n, sd->block, &decoded);
+    if (status != CBC_OK) return status;
+
+    if (p[0] == CBC_BLOCK_TABLE) {
+        sd->K = K;
+        memcpy(sd->symbols, symbols, (size_t)K);
+    }
+    if (sd->write(sd->user, sd->block, decoded) != 0) return CBC_ERR_IO;
+    return (long)(pos + bytes);
+}
+
+// Feed any number of stream bytes; complete blocks are decoded right away
+int cbc_stream_decoder_update(cbc_stream_decoder *sd,
+                              const uint8_t *data, size_t len) {
+    while (len > 0) {
+        if (sd->finished) return CBC_ERR_CORRUPT;  // data after the end marker
+
+        size_t take = sd->frame_cap - sd->frame_len;
+        if (take > len) take = len;
+        memcpy(sd->frame + sd->frame_len, data, take);
+        sd->frame_len += take;
+        data += take;
+        len -= take;
+
+        // Decode every complete block now in the buffer
+        while (sd->frame_len > 0 && !sd->finished) {
+            long used = stream_decode_block(sd);
+            if (used < 0) return (int)used;
+            if (used == 0) {
+                if (sd->frame_len == sd->frame_cap) return CBC_ERR_CORRUPT;
+                break;
+            }
+            sd->frame_len -= (size_t)used;
+            memmove(sd->frame, sd->frame + used, sd->frame_len);
+        }
+        if (sd->finished && sd->frame_len > 0) return CBC_ERR_CORRUPT;
+    }
+    return CBC_OK;
+}
+
+// CBC_OK once the end marker has been decoded
+int cbc_stream_decoder_finish(cbc_stream_decoder *sd) {
+    return sd->finished && sd->frame_len == 0 ? CBC_OK : CBC_ERR_TRUNCATED;
+}
+
+// ------------------------------------------------------------
+// Session decompression
+// ------------------------------------------------------------
+
+int cbc_session_decompress(cbc_session *s, const uint8_t *data, size_t size,
+                           size_t original_len, uint8_t *out, size_t *out_len) {
+    *out_len = 0;
+    if (size == 0) return original_len == 0 ? CBC_OK : CBC_ERR_TRUNCATED;
+
+    const uint8_t *p = data + 1;
+    const uint8_t *end = data + size;
+    switch (data[0]) {
+    case CBC_SESSION_SAME:
+        if (s->K == 0) return CBC_ERR_CORRUPT;
+        break;
+    case CBC_SESSION_DELTA: {
+        if (end - p < 2) return CBC_ERR_CORRUPT;
+        int K = p[0];
+        int n = p[1];
+        p += 2;
+        if (K == 0 || end - p < 2 * (ptrdiff_t)n) return CBC_ERR_CORRUPT;
+
+        // Validate before touching the session: ranks increasing, below K,
+        // and covering every rank past the previous table
+        int prev = -1;
+        int extended = 0;
+        for (int e = 0; e < n; e++) {
+            int rank = p[2 * e];
+            if (rank <= prev || rank >= K) return CBC_ERR_CORRUPT;
+            if (rank >= s->K) extended++;
+            prev = rank;
+        }
+        if (K > s->K && extended != K - s->K) return CBC_ERR_CORRUPT;
+
+        for (int e = 0; e < n; e++) s->symbols[p[2 * e]] = p[2 * e + 1];
+        s->K = K;
+        p += 2 * (size_t)n;
+        break;
+    }
+    case CBC_SESSION_FULL: {
+        if (end - p < 1) return CBC_ERR_CORRUPT;
+        int K = p[0];
+        p++;
+        if (K == 0 || end - p < K) return CBC_ERR_CORRUPT;
+        memcpy(s->symbols, p, (size_t)K);
+        s->K = K;
+        p += K;
+        break;
+    }
+    default:
+        return CBC_ERR_CORRUPT;
+    }
+
+    return decode_payload(s->symbols, s->K, p, (size_t)(end - p),
+                          original_len, out, out_len);
+}
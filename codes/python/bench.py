@@ -0,0 +1,167 @@
+"""
+Benchmark for the Python compressor in the 32..512 byte regime.
+
+Usage: python3 bench.py [--reps N] [--quick] [--messages N] [--scaling]
+
+The corpora come from the same LCG as codes/c/cbc_bench.c
+(x = x * 1103515245 + 12345 mod 2^31), so both benches time identical
+messages and print the same table. The random-bytes corpus is skipped:
+the Python header is the UTF-8 text of the symbols, so only text
+alphabets round-trip.
+
+--scaling times single inputs of 1 KB .. 1 MB instead and prints ns/byte
+for the str API, the bytes API and, when libcbc.so loads, the C library;
+a flat ns/byte column means the path scales linearly.
+"""
+
+import argparse
+import statistics
+import time
+
+import cbc_native
+from cycle_based_compressor import compress, decompress, compress_bytes, decompress_bytes
+
+CORPUS_BYTES = 64 * 1024
+SIZES = [32, 64, 128, 256, 512]
+SCALING_SIZES = [1 << 10, 1 << 13, 1 << 16, 1 << 18, 1 << 20]
+
+PROSE = """In wireless sensor networks, the energy cost of transmitting a single byte is often far higher than the cost of executing hundreds or even thousands of local instructions. As a consequence, lightweight compression techniques are essential for extending device lifetime and reducing network congestion. A deterministic low-overhead compressor allows embedded devices to reduce traffic without adding excessive computational complexity to firmware. Modern IoT systems often operate under strict limitations: restricted memory, low clock frequencies, intermittent connectivity, and energy budgets that must last months or years. Under these conditions, traditional compression algorithms may introduce too much overhead or require dynamic structures that are unsuitable for constrained nodes. A predictable, prefix-free, cycle-based scheme provides a promising alternative by minimizing header cost and avoiding the reconstruction of probability models during decoding."""
+
+
+class Lcg:
+    def __init__(self, seed:int):
+        self.x = seed
+
+    def next(self) -> int:
+        self.x = (self.x * 1103515245 + 12345) & 0x7fffffff
+        return self.x
+
+
+def corpus_prose() -> str:
+    reps = CORPUS_BYTES // len(PROSE) + 1
+    return (PROSE * reps)[:CORPUS_BYTES]
+
+def corpus_json() -> str:
+    rng, parts, size, id_ = Lcg(1), [], 0, 0
+    while size < CORPUS_BYTES:
+        temp = 15 + rng.next() % 20
+        frac = rng.next() % 10
+        hum = 30 + rng.next() % 60
+        ok = "true" if rng.next() % 8 != 0 else "false"
+        rec = (f'{{"id":{id_},"ts":{1700000000 + id_ * 30},'
+               f'"temp":{temp}.{frac},"hum":{hum},"ok":{ok}}}\n')
+        parts.append(rec)
+        size += len(rec)
+        id_ += 1
+    return "".join(parts)[:CORPUS_BYTES]
+
+def corpus_csv() -> str:
+    rng, parts, size, row = Lcg(2), [], 0, 0
+    while size < CORPUS_BYTES:
+        sign = "-" if rng.next() % 2 != 0 else ""
+        whole = rng.next() % 100
+        cents = rng.next() % 100
+        counter = rng.next() % 65536
+        rec = f"{row},{sign}{whole}.{cents:02},{counter}\n"
+        parts.append(rec)
+        size += len(rec)
+        row += 1
+    return "".join(parts)[:CORPUS_BYTES]
+
+CORPORA = [("prose", corpus_prose), ("json", corpus_json), ("csv", corpus_csv)]
+
+
+def run_op(corpus:str, op_name:str, op, S:int, n:int, reps:int) -> None:
+    op()  # warmup
+    samples = []
+    for _ in range(reps):
+        t0 = time.perf_counter()
+        op()
+        samples.append(time.perf_counter() - t0)
+    median = statistics.median(samples)
+    best = min(samples)
+    stddev = statistics.stdev(samples) if reps > 1 else 0.0
+    mb = n * S / 1e6
+    print(f"{corpus:<7} {S:4}  {op_name:<10} {mb / median:9.1f} {mb / best:9.1f} "
+          f"{stddev / median * 100:8.1f} {median * 1e9 / n:10.1f}")
+
+def bench_corpus(name:str, text:str, n:int, reps:int) -> None:
+    for S in SIZES:
+        rng = Lcg(7)
+        msgs = [text[o:o + S] for o in
+                (rng.next() % (CORPUS_BYTES - S + 1) for _ in range(n))]
+        comp = [None] * n
+        out = [None] * n
+
+        def op_compress():
+            for i, m in enumerate(msgs):
+                comp[i] = compress(m)
+
+        def op_decompress():
+            for i, c in enumerate(comp):
+                out[i] = decompress(c)
+
+        run_op(name, "compress", op_compress, S, n, reps)
+        run_op(name, "decompress", op_decompress, S, n, reps)
+        ratio = sum(len(c) for c in comp) / (S * n)
+        print(f"{name:<7} {S:4}  ratio {ratio:.3f}{'' if out == msgs else ' MISMATCH'}")
+
+
+def best_of(op, reps:int) -> float:
+    op()  # warmup
+    best = float("inf")
+    for _ in range(reps):
+        t0 = time.perf_counter()
+        op()
+        best = min(best, time.perf_counter() - t0)
+    return best
+
+def bench_scaling(reps:int) -> None:
+    print(f"best of {reps} reps (ns/byte)\n")
+    print(f"{'corpus':<7} {'size':>8}  {'str comp':>9} {'str dec':>9} "
+          f"{'bytes comp':>10} {'bytes dec':>10} {'C comp':>8} {'C dec':>8}")
+    for name, fill in CORPORA:
+        text = fill()
+        for S in SCALING_SIZES:
+            msg = (text * (S // CORPUS_BYTES + 1))[:S]
+            data = msg.encode()
+            packed = compress(msg)
+            blob = compress_bytes(data)
+            assert decompress(packed) == msg and decompress_bytes(blob, S) == data
+            cols = [best_of(lambda: compress(msg), reps),
+                    best_of(lambda: decompress(packed), reps),
+                    best_of(lambda: compress_bytes(data), reps),
+                    best_of(lambda: decompress_bytes(blob, S), reps)]
+            line = f"{name:<7} {S:8}  " + " ".join(
+                f"{t * 1e9 / S:{w}.1f}" for t, w in zip(cols, (9, 9, 10, 10)))
+            if cbc_native.available:
+                assert cbc_native.compress(data) == blob
+                line += (f" {best_of(lambda: cbc_native.compress(data), reps) * 1e9 / S:8.1f}"
+                         f" {best_of(lambda: cbc_native.decompress(blob, S), reps) * 1e9 / S:8.1f}")
+            print(line)
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--reps", type = int, default = 7)
+    parser.add_argument("--quick", action = "store_true")
+    parser.add_argument("--messages", type = int, default = 256,
+                        help = "messages per (corpus, size) cell")
+    parser.add_argument("--scaling", action = "store_true",
+                        help = "time single 1 KB .. 1 MB inputs, ns/byte")
+    args = parser.parse_args()
+    reps = 3 if args.quick else max(args.reps, 1)
+
+    if args.scaling:
+        bench_scaling(reps)
+        return
+
+    print(f"{args.messages} messages per cell, {reps} reps (MB/s of original bytes)\n")
+    print(f"{'corpus':<7} {'size':>4}  {'op':<10} {'median':>9} {'best':>9} "
+          f"{'stddev%':>8} {'ns/msg':>10}")
+    for name, fill in CORPORA:
+        bench_corpus(name, fill(), args.messages, reps)
+
+
+if __name__ == "__main__":
+    main()
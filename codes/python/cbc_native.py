@@ -0,0 +1,166 @@
+"""
+Optional ctypes binding to the C library (codes/c/libcbc.so, `make lib`).
+
+The library is looked up in $CBC_LIB, then ../c/libcbc.so next to this
+file, then the system path. When none loads, `available` is False and the
+functions raise RuntimeError; callers fall back to the pure-Python
+compress_bytes / decompress_bytes, which produce the same plain format.
+"""
+
+import ctypes
+import ctypes.util
+import os
+
+STATUS = {
+    -1: "CBC_ERR_OVERFLOW",
+    -2: "CBC_ERR_SYMBOLS",
+    -3: "CBC_ERR_INPUT",
+    -4: "CBC_ERR_CORRUPT",
+    -5: "CBC_ERR_TRUNCATED",
+    -6: "CBC_ERR_NOMEM",
+    -7: "CBC_ERR_IO",
+}
+
+
+def _load():
+    here = os.path.dirname(os.path.abspath(__file__))
+    paths = [os.environ.get("CBC_LIB"),
+             os.path.join(here, "..", "c", "libcbc.so"),
+             ctypes.util.find_library("cbc")]
+    for path in paths:
+        if not path:
+            continue
+        try:
+            return ctypes.CDLL(path)
+        except OSError:
+            pass
+    return None
+
+_lib = _load()
+available:bool = _lib is not None
+
+if available:
+    _size_p = ctypes.POINTER(ctypes.c_size_t)
+    _lib.cbc_max_compressed_size.argtypes = [ctypes.c_size_t, ctypes.c_int]
+    _lib.cbc_max_compressed_size.restype = ctypes.c_size_t
+    _lib.cbc_max_framed_size.argtypes = [ctypes.c_size_t, ctypes.c_int]
+    _lib.cbc_max_framed_size.restype = ctypes.c_size_t
+    for fn in (_lib.cbc_compress_into, _lib.cbc_compress_framed_into):
+        fn.argtypes = [ctypes.c_char_p, ctypes.c_size_t,
+                       ctypes.c_char_p, ctypes.c_size_t, _size_p]
+        fn.restype = ctypes.c_int
+    _lib.cbc_decompress.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.c_size_t,
+                                    ctypes.c_char_p, _size_p]
+    _lib.cbc_decompress.restype = ctypes.c_int
+    _lib.cbc_framed_length.argtypes = [ctypes.c_char_p, ctypes.c_size_t, _size_p]
+    _lib.cbc_framed_length.restype = ctypes.c_int
+    _lib.cbc_decompress_framed.argtypes = [ctypes.c_char_p, ctypes.c_size_t,
+                                           ctypes.c_char_p, ctypes.c_size_t, _size_p]
+    _lib.cbc_decompress_framed.restype = ctypes.c_int
+    _lib.cbc_max_container_size.argtypes = [ctypes.c_size_t]
+    _lib.cbc_max_container_size.restype = ctypes.c_size_t
+    _lib.cbc_compress_container_into.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.c_int,
+                                                 ctypes.c_char_p, ctypes.c_size_t, _size_p]
+    _lib.cbc_compress_container_into.restype = ctypes.c_int
+    _lib.cbc_compress_container_pairs_into.argtypes = _lib.cbc_compress_container_into.argtypes
+    _lib.cbc_compress_container_pairs_into.restype = ctypes.c_int
+    _lib.cbc_decompress_container.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t,
+                                              ctypes.c_char_p, ctypes.c_size_t, _size_p]
+    _lib.cbc_decompress_container.restype = ctypes.c_int
+
+
+def _check(rc:int) -> None:
+    if rc != 0:
+        raise RuntimeError(STATUS.get(rc, f"status {rc}"))
+
+def _require() -> None:
+    if not available:
+        raise RuntimeError("libcbc not found (build it with `make lib` in codes/c)")
+
+
+def compress(data:bytes) -> bytes:
+    """
+    Plain format, identical to cycle_based_compressor.compress_bytes
+    """
+    _require()
+    cap = _lib.cbc_max_compressed_size(len(data), 255)
+    out = ctypes.create_string_buffer(cap)
+    written = ctypes.c_size_t()
+    _check(_lib.cbc_compress_into(data, len(data), out, cap, ctypes.byref(written)))
+    return out.raw[:written.value]
+
+def decompress(data:bytes, original_len:int) -> bytes:
+    _require()
+    out = ctypes.create_string_buffer(max(original_len, 1))
+    out_len = ctypes.c_size_t()
+    _check(_lib.cbc_decompress(data, len(data), original_len, out, ctypes.byref(out_len)))
+    return out.raw[:out_len.value]
+
+def decompress_status(data:bytes, original_len:int) -> tuple[int, bytes]:
+    """
+    cbc_decompress status and the bytes decoded before it stopped; does not
+    raise on a bad frame, so tests can compare errors
+    """
+    _require()
+    out = ctypes.create_string_buffer(max(original_len, 1))
+    out_len = ctypes.c_size_t()
+    rc = _lib.cbc_decompress(data, len(data), original_len, out, ctypes.byref(out_len))
+    return rc, out.raw[:out_len.value]
+
+def compress_framed(data:bytes) -> bytes:
+    """
+    Self-describing frame: the original length travels with the data
+    """
+    _require()
+    cap = _lib.cbc_max_framed_size(len(data), 255)
+    out = ctypes.create_string_buffer(cap)
+    written = ctypes.c_size_t()
+    _check(_lib.cbc_compress_framed_into(data, len(data), out, cap, ctypes.byref(written)))
+    return out.raw[:written.value]
+
+def decompress_framed(data:bytes) -> bytes:
+    _require()
+    n = ctypes.c_size_t()
+    _check(_lib.cbc_framed_length(data, len(data), ctypes.byref(n)))
+    out = ctypes.create_string_buffer(max(n.value, 1))
+    out_len = ctypes.c_size_t()
+    _check(_lib.cbc_decompress_framed(data, len(data), out, n.value, ctypes.byref(out_len)))
+    return out.raw[:out_len.value]
+
+def compress_container(data:bytes, max_len:int = 0) -> bytes:
+    """
+    Versioned container, identical to cycle_based_compressor.compress_container
+    """
+    _require()
+    cap = _lib.cbc_max_container_size(len(data))
+    out = ctypes.create_string_buffer(cap)
+    written = ctypes.c_size_t()
+    _check(_lib.cbc_compress_container_into(data, len(data), max_len,
+                                            out, cap, ctypes.byref(written)))
+    return out.raw[:written.value]
+
+def compress_container_pairs(data:bytes, max_len:int = 0) -> bytes:
+    """
+    Container whose table may hold frequent byte pairs; the pure-Python
+    decompress_container reads it
+    """
+    _require()
+    cap = _lib.cbc_max_container_size(len(data))
+    out = ctypes.create_string_buffer(cap)
+    written = ctypes.c_size_t()
+    _check(_lib.cbc_compress_container_pairs_into(data, len(data), max_len,
+                                                  out, cap, ctypes.byref(written)))
+    return out.raw[:written.value]
+
+def decompress_container(data:bytes) -> bytes:
+    """
+    Plain, bounded and raw container frames (dictionary frames need a
+    cbc_dict and are left to the Python reader)
+    """
+    _require()
+    from cycle_based_compressor import parse_container
+    n = parse_container(data)["original_len"]
+    out = ctypes.create_string_buffer(max(n, 1))
+    out_len = ctypes.c_size_t()
+    _check(_lib.cbc_decompress_container(None, data, len(data), out, n, ctypes.byref(out_len)))
+    return out.raw[:out_len.value]
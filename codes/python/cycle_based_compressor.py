@@ -3,6 +3,29 @@ Cycle-Based Compressor
 Ian dos Anjos Melo Aguiar
 """
 
+import re
+from collections import Counter
+
+# Every cycle 0^m 1^j up to 24 bits, in rank order: 01, 001, 011, 0001, ...
+CYCLES:list[str] = ["0"*m + "1"*(L - m) for L in range(2, 25) for m in range(L - 1, 0, -1)]
+
+# One match per cycle; trailing zero padding never matches
+CYCLE_RE = re.compile("0+1+")
+CYCLE_RANK:dict = {cycle:rank for rank, cycle in enumerate(CYCLES)}
+
+# Versioned container, same layout as codes/c/cbc.h:
+# [magic] [version << 4 | flags] [varint len] [varint header size] [header] [payload]
+CONTAINER_MAGIC = 0xCB
+CONTAINER_VERSION = 1
+CF_BOUNDED = 0x01   # header [N][K][symbols], escapes 0^N + 8 bits
+CF_RAW = 0x02       # empty header, payload is the message
+CF_DICT = 0x04      # header [dictionary id]
+CF_INDEXED = 0x08   # header [varint interval][checkpoints][tables], see cbc_compress_indexed_into
+CF_KNOWN = 0x0F
+BOUNDED_PAIRS = 0x80  # in N of a CF_BOUNDED header: [N][K][pair bitmap][tokens]
+INDEX_ENTRY = 12    # u64 payload bit position, u32 table offset
+MAX_CODE_LENGTH = 24
+
 # Functions:
 
 def compress(text:str, *, save:str = None, verbose:bool = False) -> str:
@@ -14,21 +37,15 @@ def compress(text:str, *, save:str = None, verbose:bool = False) -> str:
     symb_tab = symbol_table(freq_tab)
     print(f"\n{symb_tab = }") if verbose else None
 
-    compress_symbolic:str = ""
-    for t in text:
-        compress_symbolic += symb_tab[t]
-
-    while len(compress_symbolic)%8 != 0:
-        compress_symbolic += "0"
+    compress_symbolic:str = "".join(map(symb_tab.__getitem__, text))
+    compress_symbolic += "0"*(-len(compress_symbolic)%8)
     print(f"\n{compress_symbolic = }") if verbose else None
 
     header = ''.join(list(symb_tab.keys())) + "§"
     print(f"\n{header = }") if verbose else None
 
     compress_message:str = bytearray(header.encode("utf-8"))
-    for i in range(0, len(compress_symbolic), 8):
-        byte_val = int(compress_symbolic[i:i+8], 2)
-        compress_message.append(byte_val)
+    compress_message += pack_bits(compress_symbolic)
 
     print(f"\n{compress_message = }") if verbose else None
     print(f"\n{len(header)}(header) + {len(compress_symbolic)//8}(text compressed) = {len(compress_message)} Bytes") if verbose else None
@@ -47,40 +64,379 @@ def decompress(text:str = None, *, read:str = None, verbose:bool = False) -> str
         with open(read, "rb") as arq:
             text = arq.read()
     
-    for sep, b in enumerate(text):
-        if b == ord("§"):
-            break
-    header, text = text[:sep - 1], text[sep+1:]
+    header, text = split_header(text)
 
-    freq_tab:dict = [(chr(key), None) for key in header]
+    freq_tab:dict = [(key, None) for key in header]
     symb_tab:dict = symbol_table(freq_tab)
     print(f"\n{symb_tab = }") if verbose else None
     inv_symb_tab:dict = {value:key for key, value in symb_tab.items()}
 
-    compress_symbolic:str = ""
-    for t in text:
-        bits_temp:str = str(bin(t))[2:]
-        if len(bits_temp) < 8:
-            bits_temp = "0"*(8 - len(bits_temp)) + bits_temp
-        compress_symbolic += bits_temp
+    compress_symbolic:str = unpack_bits(text)
     print(f"\n{compress_symbolic = }") if verbose else None
 
-    real_text = ""
-    print(f"\nRead: ", end = "") if verbose else None
-    while True:
-        sep:int = compress_symbolic.find("10")
-        if len(compress_symbolic) == 0 or ((sep == -1) and (compress_symbolic[-1] != "1")): # The text end
-            break
-        elif (sep == -1) and compress_symbolic[-1] == "1": # When the text end with not change to 10
-            sep:int = len(compress_symbolic)
-        bit_part:str = compress_symbolic[:sep + 1]
-        compress_symbolic = compress_symbolic[sep+1:]
-        real_text += inv_symb_tab[bit_part]
-        print(f"{bit_part}({inv_symb_tab[bit_part]})", end = " ") if verbose else None
+    bit_parts:list = CYCLE_RE.findall(compress_symbolic.rstrip("0"))
+    real_text = "".join(map(inv_symb_tab.__getitem__, bit_parts))
+    if verbose:
+        print(f"\nRead: ", end = "")
+        for bit_part in bit_parts:
+            print(f"{bit_part}({inv_symb_tab[bit_part]})", end = " ")
     print(f"\n\n{real_text = }") if verbose else None
     return real_text
 
 
+def compress_bytes(data:bytes) -> bytes:
+    """
+    Binary-safe compression in the C plain format [K][K symbols][payload],
+    with the same ranking as the C encoder (frequency desc, byte value asc),
+    so the output is byte-identical to cbc_compress_into.
+    """
+    if not data:
+        return b""
+    counts = Counter(data)
+    order:list[int] = sorted(counts, key = lambda b:(-counts[b], b))
+    if len(order) > 255:
+        raise ValueError("more than 255 distinct symbols")
+    table:list = [None]*256
+    for rank, b in enumerate(order):
+        table[b] = CYCLES[rank]
+    bits = "".join(map(table.__getitem__, data))
+    return bytes([len(order)]) + bytes(order) + pack_bits(bits)
+
+def decompress_bytes(data:bytes, original_len:int = None) -> bytes:
+    """
+    Inverse of compress_bytes (and of the C cbc_compress_into). When
+    original_len is given, the payload must hold at least that many symbols.
+    """
+    if not data:
+        if original_len:
+            raise ValueError("truncated payload")
+        return b""
+    K = data[0]
+    if K == 0 or len(data) < 1 + K:
+        raise ValueError("corrupt header")
+    inv = {CYCLES[rank]:b for rank, b in enumerate(data[1:1 + K])}
+    bits = unpack_bits(data[1 + K:])
+    # findall would step over leading 1s, which no cycle starts with
+    if bits[:1] == "1" and original_len != 0:
+        raise ValueError("invalid cycle")
+    # Like the C decoder, stop at original_len: later bits are not read
+    # Trailing zeros are padding; a long run of them would make findall
+    # restart at each of its bits
+    cycles = CYCLE_RE.findall(bits.rstrip("0"))
+    if original_len is not None:
+        cycles = cycles[:original_len]
+    try:
+        out = bytes(map(inv.__getitem__, cycles))
+    except KeyError:
+        raise ValueError("invalid cycle") from None
+    if original_len is not None and len(out) < original_len:
+        raise ValueError("truncated payload")
+    return out
+
+
+def compress_container(data:bytes, max_len:int = MAX_CODE_LENGTH) -> bytes:
+    """
+    Versioned container read and written by both implementations; picks the
+    smallest of the plain, bounded (codes of at most max_len bits) and raw
+    layouts exactly as cbc_compress_container_into does.
+    """
+    if not 2 <= max_len <= MAX_CODE_LENGTH:
+        raise ValueError("max_len must be in 2..24")
+    if not data:
+        return container_prefix(CF_RAW, 0, 0)
+
+    counts = Counter(data)
+    order:list[int] = sorted(counts, key = lambda b:(-counts[b], b))
+    K = len(order)
+
+    # Bounded table size, as in the C planner: keeping rank k-1 saves
+    # freq * (N + 8 - len) bits for one header byte
+    escape_len = max_len + 8
+    limit = min(max_len*(max_len - 1)//2, K, 255)
+    bits = len(data)*escape_len
+    bounded_size, bounded_K, bounded_payload = None, 0, 0
+    for k in range(1, limit + 1):
+        bits -= counts[order[k - 1]]*(escape_len - len(CYCLES[k - 1]))
+        size = k + (bits + 7)//8
+        if bounded_size is None or size < bounded_size:
+            bounded_size, bounded_K, bounded_payload = size, k, (bits + 7)//8
+    # Each layout also pays the varint of its own header size
+    bounded_size += 2 + len(put_varint(2 + bounded_K))
+    raw_size = len(put_varint(0)) + len(data)
+
+    plain_size = None
+    if K <= 255 and len(CYCLES[K - 1]) <= max_len:
+        plain_bits = sum(counts[b]*len(CYCLES[rank]) for rank, b in enumerate(order))
+        plain_size = 1 + len(put_varint(1 + K)) + K + (plain_bits + 7)//8
+
+    if plain_size is not None and plain_size <= bounded_size and plain_size <= raw_size:
+        header = bytes([K]) + bytes(order)
+        table = {b:CYCLES[rank] for rank, b in enumerate(order)}
+        return container_prefix(0, len(data), len(header)) + header + \
+            pack_bits("".join(map(table.__getitem__, data)))
+    if bounded_size < raw_size:
+        header = bytes([max_len, bounded_K]) + bytes(order[:bounded_K])
+        table = {b:"0"*max_len + format(b, "08b") for b in order[bounded_K:]}
+        table.update((b, CYCLES[rank]) for rank, b in enumerate(order[:bounded_K]))
+        return container_prefix(CF_BOUNDED, len(data), len(header)) + header + \
+            pack_bits("".join(map(table.__getitem__, data)))
+    return container_prefix(CF_RAW, len(data), 0) + bytes(data)
+
+def compress_container_dict(data:bytes, dict_id:int, ranking:bytes) -> bytes:
+    """
+    Container with a shared ranking (cbc_dict: id plus symbols in cycle
+    order); raises ValueError for bytes the ranking does not cover.
+    """
+    table = {b:CYCLES[rank] for rank, b in enumerate(ranking)}
+    try:
+        bits = "".join(map(table.__getitem__, data))
+    except KeyError:
+        raise ValueError("symbol not in the dictionary") from None
+    return container_prefix(CF_DICT, len(data), 1) + bytes([dict_id]) + pack_bits(bits)
+
+def parse_container(data:bytes) -> dict:
+    """
+    Prefix of a container frame: version, flags, original_len, header, payload
+    """
+    if len(data) < 2 or data[0] != CONTAINER_MAGIC:
+        raise ValueError("not a container frame")
+    version, flags = data[1] >> 4, data[1] & 0x0F
+    if version != CONTAINER_VERSION or flags & ~CF_KNOWN:
+        raise ValueError(f"unsupported version {version} or flags {flags:#x}")
+    original_len, pos = get_varint(data, 2)
+    header_size, pos = get_varint(data, pos)
+    if header_size > len(data) - pos:
+        raise ValueError("corrupt header")
+    return {"version":version, "flags":flags, "original_len":original_len,
+            "header":data[pos:pos + header_size], "payload":data[pos + header_size:]}
+
+def decompress_container(data:bytes, dictionaries:dict = None) -> bytes:
+    """
+    Reads any container frame; dictionaries maps dictionary id -> ranking
+    and is only needed for CF_DICT frames.
+    """
+    frame = parse_container(data)
+    flags, n, header, payload = (frame["flags"], frame["original_len"],
+                                 frame["header"], frame["payload"])
+    if flags == CF_RAW:
+        if header:
+            raise ValueError("corrupt header")
+        if len(payload) < n:
+            raise ValueError("truncated payload")
+        return bytes(payload[:n])
+    if flags == 0:
+        if len(header) < 2 or header[0] == 0 or len(header) != 1 + header[0]:
+            raise ValueError("corrupt header")
+        return decompress_bytes(header + payload, n)
+    if flags == CF_DICT:
+        if len(header) != 1:
+            raise ValueError("corrupt header")
+        if not dictionaries or header[0] not in dictionaries:
+            raise ValueError(f"unknown dictionary {header[0]}")
+        return decode_ranked(dictionaries[header[0]], payload, n)
+    if flags == CF_BOUNDED:
+        if len(header) < 3:
+            raise ValueError("corrupt header")
+        if header[0] & BOUNDED_PAIRS:
+            return decode_pairs(header, payload, n)
+        N, K = header[0], header[1]
+        if not 2 <= N <= MAX_CODE_LENGTH or not 0 < K <= N*(N - 1)//2 or len(header) != 2 + K:
+            raise ValueError("corrupt header")
+        return decode_bounded(header[2:], N, payload, n)
+    if flags == CF_INDEXED:
+        return decompress_range(data, 0, n)
+    raise ValueError("corrupt header")
+
+def decode_ranked(ranking:bytes, payload:bytes, n:int) -> bytes:
+    """
+    n symbols of a plain payload coded with ranking (any length up to 256)
+    """
+    inv = {CYCLES[rank]:b for rank, b in enumerate(ranking)}
+    bits = unpack_bits(payload)
+    if bits[:1] == "1" and n:
+        raise ValueError("invalid cycle")
+    try:
+        out = bytes(map(inv.__getitem__, CYCLE_RE.findall(bits.rstrip("0"))[:n]))
+    except KeyError:
+        raise ValueError("invalid cycle") from None
+    if len(out) < n:
+        raise ValueError("truncated payload")
+    return out
+
+def decompress_range(data:bytes, offset:int, count:int, dictionaries:dict = None) -> bytes:
+    """
+    Original bytes [offset, offset + count) of a container frame. Indexed
+    frames decode only the segments the range covers; other layouts are
+    decoded whole and sliced.
+    """
+    frame = parse_container(data)
+    n = frame["original_len"]
+    if offset < 0 or count < 0 or offset + count > n:
+        raise ValueError("range past the end of the frame")
+    if frame["flags"] != CF_INDEXED:
+        return decompress_container(data, dictionaries)[offset:offset + count]
+
+    header, payload = frame["header"], frame["payload"]
+    interval, index_pos = get_varint(header, 0)
+    if interval == 0:
+        raise ValueError("corrupt header")
+    segments = -(-n//interval)
+    tables = index_pos + segments*INDEX_ENTRY
+    if tables > len(header):
+        raise ValueError("corrupt header")
+
+    out = bytearray()
+    seg = offset//interval
+    while len(out) < count:
+        entry = index_pos + seg*INDEX_ENTRY
+        bit_pos = int.from_bytes(header[entry:entry + 8], "little")
+        t = int.from_bytes(header[entry + 8:entry + 12], "little")
+        if not tables <= t < len(header) or header[t] == 0 or t + 1 + header[t] > len(header):
+            raise ValueError("corrupt header")
+        skip = offset + len(out) - seg*interval
+        take = min(interval - skip, n - seg*interval - skip, count - len(out))
+        # A segment spans at most interval escapes of N + 8 bits
+        first = bit_pos >> 3
+        window = payload[first:first + interval*(MAX_CODE_LENGTH + 8)//8 + 1]
+        out += decode_bounded(header[t + 1:t + 1 + header[t]], MAX_CODE_LENGTH, window,
+                              take, bit_pos & 7, skip)
+        seg += 1
+    return bytes(out)
+
+def decode_bounded(symbols:bytes, N:int, payload:bytes, n:int,
+                   start_bit:int = 0, skip:int = 0) -> bytes:
+    """
+    n symbols of a bounded payload: cycles of at most N bits, or 0^N and a
+    raw byte; decoding starts at start_bit and drops the first skip symbols
+    """
+    token = re.compile("0{%d}([01]{8})|(0+1+)" % N)
+    out = bytearray()
+    pos = start_bit
+    bits = unpack_bits(payload)
+    n += skip
+    for match in token.finditer(bits, start_bit):
+        if len(out) == n:
+            break
+        if match.start() != pos:
+            raise ValueError("invalid cycle")
+        pos = match.end()
+        if match.group(1) is not None:
+            out.append(int(match.group(1), 2))
+            continue
+        rank = CYCLE_RANK.get(match.group(2), len(symbols))
+        if rank >= len(symbols) or len(match.group(2)) > N:
+            raise ValueError("invalid cycle")
+        out.append(symbols[rank])
+    if len(out) < n:
+        raise ValueError("truncated payload")
+    return bytes(out[skip:])
+
+def decode_pairs(header:bytes, payload:bytes, n:int) -> bytes:
+    """
+    n bytes of a bounded frame whose table holds byte-pair tokens, as
+    written by cbc_compress_container_pairs_into
+    """
+    N, K = header[0] & ~BOUNDED_PAIRS, header[1]
+    if not 2 <= N <= MAX_CODE_LENGTH or not 0 < K <= N*(N - 1)//2:
+        raise ValueError("corrupt header")
+    pos = 2 + (K + 7)//8
+    if pos > len(header):
+        raise ValueError("corrupt header")
+    tokens = []
+    for i in range(K):
+        width = 1 + (header[2 + i//8] >> (i % 8) & 1)
+        if pos + width > len(header):
+            raise ValueError("corrupt header")
+        tokens.append(header[pos:pos + width])
+        pos += width
+    if pos != len(header):
+        raise ValueError("corrupt header")
+
+    token = re.compile("0{%d}([01]{8})|(0+1+)" % N)
+    out = bytearray()
+    pos = 0
+    for match in token.finditer(unpack_bits(payload)):
+        if len(out) >= n:
+            break
+        if match.start() != pos:
+            raise ValueError("invalid cycle")
+        pos = match.end()
+        if match.group(1) is not None:
+            out.append(int(match.group(1), 2))
+            continue
+        rank = CYCLE_RANK.get(match.group(2), K)
+        if rank >= K or len(match.group(2)) > N:
+            raise ValueError("invalid cycle")
+        out += tokens[rank]
+    if len(out) < n:
+        raise ValueError("truncated payload")
+    return bytes(out[:n])
+
+
+def container_prefix(flags:int, original_len:int, header_size:int) -> bytes:
+    return bytes([CONTAINER_MAGIC, CONTAINER_VERSION << 4 | flags]) + \
+        put_varint(original_len) + put_varint(header_size)
+
+def put_varint(v:int) -> bytes:
+    """
+    LEB128, as in the C implementation
+    """
+    out = bytearray()
+    while v >= 0x80:
+        out.append(v & 0x7F | 0x80)
+        v >>= 7
+    out.append(v)
+    return bytes(out)
+
+def get_varint(data:bytes, pos:int) -> tuple[int, int]:
+    """
+    (value, next position); at most 10 bytes like CBC_VARINT_MAX
+    """
+    value = 0
+    for n in range(10):
+        if pos + n >= len(data):
+            break
+        value |= (data[pos + n] & 0x7F) << (7*n)
+        if not data[pos + n] & 0x80:
+            return value, pos + n + 1
+    raise ValueError("corrupt varint")
+
+def split_header(data:bytes) -> tuple[str, bytes]:
+    """
+    Legacy format: symbols as UTF-8 up to the first "§" code point. The
+    scan steps over whole characters, so multi-byte symbols whose UTF-8
+    contains 0xA7 (such as "ç") stay intact; a text that contains "§"
+    itself needs the container.
+    """
+    sep = "§".encode("utf-8")
+    i = 0
+    while i < len(data):
+        b = data[i]
+        n = 1 if b < 0x80 else 2 if b < 0xE0 else 3 if b < 0xF0 else 4
+        if data[i:i + n] == sep:
+            return data[:i].decode("utf-8"), data[i + n:]
+        i += n
+    raise ValueError("missing § separator")
+
+
+def pack_bits(bits:str) -> bytes:
+    """
+    Bit string -> bytes, zero-padding the last byte
+    """
+    if not bits:
+        return b""
+    pad = -len(bits)%8
+    return int(bits + "0"*pad, 2).to_bytes((len(bits) + pad)//8, "big")
+
+def unpack_bits(data:bytes) -> str:
+    """
+    Bytes -> bit string, most significant bit first
+    """
+    if not data:
+        return ""
+    return bin(int.from_bytes(data, "big"))[2:].zfill(8*len(data))
+
+
 def bitpattern(m:int, j:int) -> str:
     """
     bitparttern = 0^m 1^j where m >= 1 and j >= 1
@@ -88,12 +444,8 @@ def bitpattern(m:int, j:int) -> str:
     return "0"*m + "1"*j
 
 def frequenci_table(text:str) -> dict:
-    freq_tab:dict = {}
-    for t in text:
-        if not t in freq_tab:
-            freq_tab[t] = 0
-        freq_tab[t] += 1
-    return sorted(freq_tab.items(), key = lambda x:x[1], reverse = True)
+    # Counter keeps first-appearance order, so ties sort as before
+    return sorted(Counter(text).items(), key = lambda x:x[1], reverse = True)
 
 def symbol_table(frequenci_table:list[tuple]) -> dict:
     symb_tab:dict = {}
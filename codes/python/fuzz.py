@@ -0,0 +1,188 @@
+"""
+Differential fuzz test of the Python implementation against libcbc.
+
+Usage: python3 fuzz.py [--seconds S] [--seed N] [--max-len N]
+
+Needs libcbc.so (`make lib` in codes/c, see cbc_native). The messages come
+from the same kinds of generators as codes/c/cbc_fuzz.c: random bytes,
+random alphabets, K = 255 and 256, one symbol, empty, skewed ranks, text
+and damaged frames. For every message:
+
+  - compress_bytes and compress_container equal the C encoders byte for byte
+  - decompress_bytes and decompress_container read the C frames (plain,
+    container and byte-pair) back to the message
+  - compress / decompress round-trip text messages in the legacy format
+  - the plain frame cut short, with an all-zero tail and with one bit
+    flipped decodes to the same bytes in both implementations, or both
+    report the same error
+
+A mismatch prints the seed, the case and the message and exits with 1.
+The run ends with cases/s and KB/s of message bytes.
+"""
+
+import argparse
+import random
+import sys
+import time
+
+import cbc_native
+from cycle_based_compressor import (compress, decompress, compress_bytes, decompress_bytes,
+                                    compress_container, decompress_container, MAX_CODE_LENGTH)
+
+TEXT = ("In wireless sensor networks, the energy cost of transmitting a single byte is "
+        "often far higher than the cost of executing hundreds or even thousands of local "
+        "instructions. {\"id\":17,\"temp\":21.5,\"ok\":true}\n3,-12.07,40961\n")
+
+KINDS = ["random", "alphabet", "k255", "k256", "one-symbol", "empty", "skewed", "text", "frame"]
+
+# ValueError text of the Python decoders -> C status
+ERRORS = {"corrupt header":"CBC_ERR_CORRUPT", "invalid cycle":"CBC_ERR_CORRUPT",
+          "truncated payload":"CBC_ERR_TRUNCATED"}
+
+
+class Mismatch(Exception):
+    pass
+
+def check(cond:bool, what:str) -> None:
+    if not cond:
+        raise Mismatch(what)
+
+
+def gen_message(kind:str, rng:random.Random, max_len:int) -> bytes:
+    n = rng.randint(0, max_len)
+    if kind == "random":
+        return rng.randbytes(n)
+    if kind == "alphabet":
+        alphabet = rng.randbytes(rng.randint(1, 255))
+        return bytes(rng.choice(alphabet) for _ in range(n))
+    if kind in ("k255", "k256"):
+        values = list(range(256))
+        if kind == "k255":
+            values.remove(rng.randrange(256))
+        data = values + [rng.choice(values) for _ in range(n - len(values))]
+        rng.shuffle(data)
+        return bytes(data)
+    if kind == "one-symbol":
+        return bytes([rng.randrange(256)])*n
+    if kind == "empty":
+        return b""
+    if kind == "skewed":
+        out = bytearray()
+        for _ in range(n):
+            rank = 0
+            while rank < 255 and rng.randrange(4) != 0:
+                rank += 1
+            out.append(rank*37 & 0xFF)
+        return bytes(out)
+    if kind == "text":
+        start = rng.randrange(len(TEXT))
+        return ((TEXT*(n//len(TEXT) + 2))[start:start + n]).encode()
+    # a plain frame of a text message, cut short, zero-tailed or bit-flipped
+    text = (TEXT*(n//len(TEXT) + 1))[:n//2]
+    frame = bytearray(compress_bytes(bytes(ord(c) ^ rng.randrange(2) for c in text)))
+    if len(frame) > 1:
+        damage = rng.randrange(3)
+        if damage == 0:
+            del frame[rng.randint(1, len(frame) - 1):]
+        elif damage == 1:
+            frame[len(frame)//2:] = bytes(len(frame) - len(frame)//2)
+        else:
+            frame[rng.randrange(len(frame))] ^= 1 << rng.randrange(8)
+    return bytes(frame)
+
+
+def python_status(decode) -> tuple[str, bytes]:
+    try:
+        return "CBC_OK", decode()
+    except ValueError as e:
+        return ERRORS.get(str(e), str(e)), b""
+
+def diff_plain(frame:bytes, n:int) -> None:
+    """
+    The same frame through decompress_bytes and cbc_decompress
+    """
+    rc, c_out = cbc_native.decompress_status(frame, n)
+    c_status = "CBC_OK" if rc == 0 else cbc_native.STATUS.get(rc, str(rc))
+    if frame[:1] == b"\x00":
+        return  # raw and bounded extension: C only
+    py_status, py_out = python_status(lambda: decompress_bytes(frame, n))
+    check(py_status == c_status, f"plain decode status: Python {py_status}, C {c_status}")
+    check(py_out == (c_out if rc == 0 else b""), "plain decode bytes")
+
+def diff_damaged(frame:bytes, n:int, rng:random.Random) -> None:
+    if len(frame) < 2:
+        return
+    diff_plain(frame[:rng.randint(1, len(frame) - 1)], n)
+    zero_from = rng.randint(1, len(frame) - 1)
+    diff_plain(frame[:zero_from] + bytes(len(frame) - zero_from), n)
+    flipped = bytearray(frame)
+    bit = rng.randrange(8*len(frame))
+    flipped[bit//8] ^= 0x80 >> (bit % 8)
+    diff_plain(bytes(flipped), n)
+    diff_plain(frame, n + rng.randint(1, 8))
+
+
+def fuzz_one(msg:bytes, rng:random.Random) -> None:
+    n = len(msg)
+    if len(set(msg)) < 256:
+        frame = compress_bytes(msg)
+        check(frame == cbc_native.compress(msg), "compress_bytes and cbc_compress_into differ")
+        check(decompress_bytes(frame, n) == msg, "decompress_bytes round trip")
+        diff_damaged(frame, n, rng)
+    diff_plain(msg, rng.randint(0, 4*n + 16))  # the message itself as a frame
+
+    max_len = rng.randint(2, MAX_CODE_LENGTH)
+    container = compress_container(msg, max_len)
+    check(container == cbc_native.compress_container(msg, max_len),
+          "compress_container and cbc_compress_container_into differ")
+    check(decompress_container(container) == msg, "decompress_container round trip")
+    check(decompress_container(cbc_native.compress_container_pairs(msg, max_len)) == msg,
+          "decompress_container of a byte-pair frame")
+
+    try:
+        text = msg.decode("ascii")
+    except UnicodeDecodeError:
+        return
+    if text and "\0" not in text:
+        check(decompress(compress(text)) == text, "compress / decompress round trip")
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--seconds", type = float, default = 10)
+    parser.add_argument("--seed", type = int, default = None)
+    parser.add_argument("--max-len", type = int, default = 1024)
+    args = parser.parse_args()
+    if not cbc_native.available:
+        sys.exit("libcbc.so not found: run `make lib` in codes/c")
+    seed = args.seed if args.seed is not None else time.time_ns() % 2**32
+
+    print(f"seed {seed}, {args.seconds:.0f} s, messages up to {args.max_len} bytes")
+    rng = random.Random(seed)
+    cases = {kind:0 for kind in KINDS}
+    size = {kind:0 for kind in KINDS}
+    start = time.perf_counter()
+    elapsed = 0.0
+    while elapsed < args.seconds:
+        kind = rng.choice(KINDS)
+        msg = gen_message(kind, rng, args.max_len)
+        try:
+            fuzz_one(msg, rng)
+        except Mismatch as e:
+            print(f"mismatch: {e}\ncase {sum(cases.values())} ({kind}), "
+                  f"message {msg.hex()}")
+            sys.exit(1)
+        cases[kind] += 1
+        size[kind] += len(msg)
+        elapsed = time.perf_counter() - start
+
+    print(f"{'kind':<11} {'cases':>8} {'bytes':>10}")
+    for kind in KINDS:
+        print(f"{kind:<11} {cases[kind]:8} {size[kind]:10}")
+    total = sum(cases.values())
+    print(f"{total} cases in {elapsed:.1f} s: {total / elapsed:.0f} cases/s, "
+          f"{sum(size.values()) / 1e3 / elapsed:.1f} KB/s of messages")
+
+
+if __name__ == "__main__":
+    main()